@@ -39,6 +39,13 @@
  * ]|
  * Re-stream RTMP to SRT.
  *
+ * |[
+ * gst-launch-1.0 rtmp2serversrc port=1935 output-mode=elementary name=src \
+ *   src.video_0 ! queue ! h264parse ! mpegtsmux name=mux ! srtsink uri="srt://:9000" \
+ *   src.audio_0 ! queue ! aacparse ! mux.
+ * ]|
+ * Re-stream RTMP to SRT without the FLV mux/demux round trip.
+ *
  * Since: 1.26
  */
 
@@ -47,10 +54,12 @@
 #endif
 
 #include "gstrtmp2serversrc.h"
+#include "rtmp/rtmpchunkstream.h"
 #include "rtmp/rtmphandshake.h"
 #include "rtmp/rtmpmessage.h"
 #include "rtmp/amf.h"
 
+#include <gio/gnetworking.h>
 #include <string.h>
 
 GST_DEBUG_CATEGORY_STATIC (gst_rtmp2_server_src_debug);
@@ -62,8 +71,39 @@ enum {
   PROP_PORT,
   PROP_APPLICATION,
   PROP_STREAM_KEY,
+  PROP_STREAM_KEYS,
+  PROP_STREAM_KEYS_FILE,
   PROP_TIMEOUT,
+  PROP_HANDSHAKE_TIMEOUT,
+  PROP_PUBLISH_TIMEOUT,
+  PROP_CHUNK_SIZE,
+  PROP_WINDOW_ACK_SIZE,
+  PROP_PEER_BANDWIDTH,
+  PROP_IO_THREADS,
+  PROP_SHARED_POOL,
   PROP_LOOP,
+  PROP_SEAMLESS_SWITCH,
+  PROP_DIRECT_PUSH,
+  PROP_MULTI_STREAM,
+  PROP_OUTPUT_MODE,
+  PROP_DO_TIMESTAMP,
+  PROP_SEGMENT_FORMAT,
+  PROP_GOP_CACHE_MAX_BYTES,
+  PROP_MAX_QUEUE_TAGS,
+  PROP_MAX_QUEUE_BYTES,
+  PROP_MAX_QUEUE_TIME,
+  PROP_MAX_LATENCY,
+  PROP_LEAKY,
+  PROP_HIGH_WATERMARK,
+  PROP_LOW_WATERMARK,
+  PROP_MAX_BATCH_TAGS,
+  PROP_MAX_BATCH_BYTES,
+  PROP_MAX_BATCH_TIME,
+  PROP_MAX_CONNECTIONS,
+  PROP_MAX_PENDING_HANDSHAKES,
+  PROP_MAX_SESSION_BYTES,
+  PROP_MAX_TOTAL_BYTES,
+  PROP_STATS,
 };
 
 /* Always pad template - raw FLV output */
@@ -73,6 +113,169 @@ static GstStaticPadTemplate src_template =
     GST_PAD_ALWAYS,
     GST_STATIC_CAPS ("video/x-flv"));
 
+/* Sometimes pad template - one FLV output per stream in multi-stream mode */
+static GstStaticPadTemplate stream_template =
+  GST_STATIC_PAD_TEMPLATE ("src_%s",
+    GST_PAD_SRC,
+    GST_PAD_SOMETIMES,
+    GST_STATIC_CAPS ("video/x-flv"));
+
+static GstStaticPadTemplate video_template =
+  GST_STATIC_PAD_TEMPLATE ("video_%u",
+    GST_PAD_SRC,
+    GST_PAD_SOMETIMES,
+    GST_STATIC_CAPS ("video/x-h264, stream-format = (string) avc, "
+        "alignment = (string) au; "
+        "video/x-h265, stream-format = (string) hvc1, "
+        "alignment = (string) au; "
+        "video/x-vp9; "
+        "video/x-av1, stream-format = (string) obu-stream"));
+
+static GstStaticPadTemplate audio_template =
+  GST_STATIC_PAD_TEMPLATE ("audio_%u",
+    GST_PAD_SRC,
+    GST_PAD_SOMETIMES,
+    GST_STATIC_CAPS ("audio/mpeg, mpegversion = (int) 4, "
+        "stream-format = (string) raw; "
+        "audio/mpeg, mpegversion = (int) 1, layer = (int) 3; "
+        "audio/x-opus"));
+
+/* Time a refused publisher gets to read the error before its connection
+ * is closed, in milliseconds */
+#define REJECT_LINGER_TIME 1000
+
+enum {
+  SIGNAL_RELOAD_STREAM_KEYS,
+  LAST_SIGNAL,
+};
+
+static guint signals[LAST_SIGNAL];
+
+/* Loop iterations a push worker of the shared pool spends on an output
+ * before the other outputs get a turn */
+#define POOL_PUSH_BUDGET 64
+
+/* Streams to replay the GOP cache on */
+#define REPLAY_VIDEO (1 << 0)
+#define REPLAY_AUDIO (1 << 1)
+#define REPLAY_ALL (REPLAY_VIDEO | REPLAY_AUDIO)
+
+/* One event loop thread with its own listening socket and main context.
+ * A connection stays on the thread that accepted it. */
+struct _Rtmp2ServerLoop {
+  Rtmp2ServerListener *listener;
+  guint index;
+
+  GSocketService *service;
+  GMainContext *context;
+  GThread *thread;
+  Rtmp2TimerWheel wheel;       /* timeouts of its sessions */
+  gint n_sessions;             /* connections it serves, atomic */
+};
+
+/* Listening sockets shared by all elements of the process on the same
+ * address and port, with the event loop threads serving their
+ * connections. Elements consume the publishers matching their
+ * application and stream key. */
+struct _Rtmp2ServerListener {
+  gchar *key;                  /* "host:port" */
+  gchar *host;
+  guint port;
+  GList *consumers;            /* elements, protected by listeners_lock */
+
+  /* With more than one loop, each binds its own SO_REUSEPORT socket and
+   * the kernel spreads the connections over them */
+  Rtmp2ServerLoop *loops;
+  guint n_loops;
+  gboolean pooled;             /* loops run on the shared pool's workers */
+  gboolean running;
+
+  /* Startup synchronization */
+  GMutex start_lock;
+  GCond start_cond;
+  guint n_started;
+  gboolean start_error;
+};
+
+static GMutex listeners_lock;
+static GHashTable *listeners;
+
+/* Payload bytes queued by all sessions of the process */
+static guint total_queued_bytes;
+
+/* Protects the throttle state of all sessions, so a pending resume can be
+ * checked for without touching a session that may be gone */
+static GMutex throttle_lock;
+
+/* Serializes creating listeners, without blocking the event loops that
+ * look up consumers meanwhile */
+static GMutex listeners_acquire_lock;
+
+/* Workers shared by the elements with shared-pool, sized to the number of
+ * cores. They run while an element or listener uses them. The event loop
+ * workers serve the sockets and connections of all their listeners and
+ * the wakeup timers of the outputs, the push workers drain the outputs. */
+typedef struct {
+  GMainContext *context;
+  GThread *thread;
+  gint running;
+} Rtmp2ServerWorker;
+
+typedef struct {
+  guint refcount;              /* protected by pool_lock */
+  Rtmp2ServerWorker *workers;
+  guint n_workers;
+  guint next_worker;           /* protected by listeners_acquire_lock */
+  GThreadPool *push_pool;
+  GMutex timer_lock;
+  guint next_timer_worker;     /* protected by timer_lock */
+} Rtmp2ServerPool;
+
+static GMutex pool_lock;
+
+static Rtmp2ServerPool shared_pool;
+
+#define GST_TYPE_RTMP2_SERVER_SRC_LEAKY (gst_rtmp2_server_src_leaky_get_type ())
+static GType
+gst_rtmp2_server_src_leaky_get_type (void)
+{
+  static GType leaky_type = 0;
+  static const GEnumValue leaky[] = {
+    {GST_RTMP2_SERVER_SRC_LEAKY_NONE, "Not leaky", "none"},
+    {GST_RTMP2_SERVER_SRC_LEAKY_OLDEST, "Drop the oldest tags", "oldest"},
+    {GST_RTMP2_SERVER_SRC_LEAKY_UNTIL_KEYFRAME,
+        "Drop video up to the next keyframe", "until-keyframe"},
+    {GST_RTMP2_SERVER_SRC_LEAKY_GOP,
+        "Drop whole GOPs up to the newest keyframe", "gop"},
+    {0, NULL, NULL},
+  };
+
+  if (!leaky_type) {
+    leaky_type = g_enum_register_static ("GstRtmp2ServerSrcLeaky", leaky);
+  }
+  return leaky_type;
+}
+
+#define GST_TYPE_RTMP2_SERVER_SRC_OUTPUT_MODE \
+    (gst_rtmp2_server_src_output_mode_get_type ())
+static GType
+gst_rtmp2_server_src_output_mode_get_type (void)
+{
+  static GType output_mode_type = 0;
+  static const GEnumValue output_modes[] = {
+    {GST_RTMP2_SERVER_SRC_OUTPUT_FLV, "FLV stream on the src pad", "flv"},
+    {GST_RTMP2_SERVER_SRC_OUTPUT_ELEMENTARY,
+        "Elementary streams on video and audio pads", "elementary"},
+    {0, NULL, NULL},
+  };
+
+  if (!output_mode_type) {
+    output_mode_type = g_enum_register_static ("GstRtmp2ServerSrcOutputMode",
+        output_modes);
+  }
+  return output_mode_type;
+}
+
 /* Forward declarations */
 static void gst_rtmp2_server_src_finalize (GObject *object);
 static void gst_rtmp2_server_src_set_property (GObject *object, guint prop_id,
@@ -82,397 +285,3119 @@ static void gst_rtmp2_server_src_get_property (GObject *object, guint prop_id,
 static GstStateChangeReturn gst_rtmp2_server_src_change_state (GstElement *element,
     GstStateChange transition);
 static void gst_rtmp2_server_src_loop (gpointer user_data);
+static gboolean gst_rtmp2_server_src_direct_push (ServerSession *session,
+    Rtmp2FlvTag *tag);
+static gboolean gst_rtmp2_server_src_switch_resume (
+    Rtmp2ServerSrcOutput *output, const Rtmp2FlvTag *tag);
+static void gst_rtmp2_server_src_pad_linked (GstPad *pad, GstPad *peer,
+    Rtmp2ServerSrcOutput *output);
+static gboolean gst_rtmp2_server_src_query (GstPad *pad, GstObject *parent,
+    GstQuery *query);
 static gboolean on_incoming_connection (GSocketService *service,
     GSocketConnection *connection, GObject *source_object, gpointer user_data);
+static void server_session_expire (ServerSession *session);
+static gboolean server_session_push_held_headers (ServerSession *session);
 
 #define gst_rtmp2_server_src_parent_class parent_class
 G_DEFINE_TYPE (GstRtmp2ServerSrc, gst_rtmp2_server_src, GST_TYPE_ELEMENT);
 GST_ELEMENT_REGISTER_DEFINE_WITH_CODE (rtmp2serversrc, "rtmp2serversrc",
     GST_RANK_NONE, GST_TYPE_RTMP2_SERVER_SRC, rtmp2_element_init (plugin));
 
-/* Session management */
-static ServerSession *
-server_session_new (GstRtmp2ServerSrc *src, GSocketConnection *socket_connection)
+/* Shared pool: queue the output on a push worker unless it already is */
+static void
+server_output_schedule_locked (Rtmp2ServerSrcOutput *output)
 {
-  ServerSession *session = g_new0 (ServerSession, 1);
-  session->socket_connection = g_object_ref (socket_connection);
-  session->state = SERVER_SESSION_STATE_NEW;
-  session->stream_id = 1;
-  session->tag_queue = g_queue_new ();
-  g_mutex_init (&session->queue_lock);
-  session->src = src;
-  return session;
+  output->pool_parked = FALSE;
+  if (output->running && !output->pool_scheduled) {
+    output->pool_scheduled = TRUE;
+    g_thread_pool_push (shared_pool.push_pool, output, NULL);
+  }
 }
 
+/* Wake up the streaming task. With start_task, there is work only the
+ * task can do and a direct-push output that did not need it so far
+ * starts it. */
 static void
-server_session_free (ServerSession *session)
+gst_rtmp2_server_src_wakeup_full (Rtmp2ServerSrcOutput *output,
+    gboolean start_task)
 {
-  if (!session)
-    return;
-
-  if (session->connection) {
-    gst_rtmp_connection_close (session->connection);
-    g_object_unref (session->connection);
+  g_mutex_lock (&output->wakeup_lock);
+  output->wakeup_pending = TRUE;
+  g_cond_signal (&output->wakeup_cond);
+  if (output->pooled) {
+    server_output_schedule_locked (output);
+  } else if (start_task && !output->task_needed) {
+    output->task_needed = TRUE;
+    if (output->running) {
+      output->task_started = TRUE;
+      gst_task_start (output->task);
+    }
   }
+  g_mutex_unlock (&output->wakeup_lock);
+}
 
-  g_clear_object (&session->socket_connection);
+/* Wake up the streaming task, called whenever there is new work for it */
+static void
+gst_rtmp2_server_src_wakeup (Rtmp2ServerSrcOutput *output)
+{
+  gst_rtmp2_server_src_wakeup_full (output, TRUE);
+}
 
-  g_free (session->app_name);
-  g_free (session->stream_key);
+static gboolean
+server_output_pool_timer_cb (gpointer user_data)
+{
+  Rtmp2ServerSrcOutput *output = user_data;
 
-  g_mutex_lock (&session->queue_lock);
-  while (!g_queue_is_empty (session->tag_queue)) {
-    Rtmp2FlvTag *tag = g_queue_pop_head (session->tag_queue);
-    rtmp2_flv_tag_free (tag);
-  }
-  g_queue_free (session->tag_queue);
-  g_mutex_unlock (&session->queue_lock);
-  g_mutex_clear (&session->queue_lock);
+  /* Destroyed under the lock before the output goes away */
+  g_mutex_lock (&shared_pool.timer_lock);
+  if (!g_source_is_destroyed (g_main_current_source ()))
+    gst_rtmp2_server_src_wakeup (output);
+  g_mutex_unlock (&shared_pool.timer_lock);
 
-  g_free (session);
+  return G_SOURCE_REMOVE;
 }
 
-/* Command handlers */
+/* Shared pool: wake up a parked output at end_time (monotonic time), on
+ * the event loop worker the output got for its timers */
 static void
-on_connect_command (const gchar *command_name, GPtrArray *args, gpointer user_data)
+server_output_pool_arm_timer (Rtmp2ServerSrcOutput *output, gint64 end_time)
 {
-  ServerSession *session = user_data;
-  const GstAmfNode *command_obj;
-  gdouble transaction_id = 1.0;
+  gint64 timeout = MAX (end_time - g_get_monotonic_time (), 0);
 
-  GST_DEBUG ("Received connect command");
+  g_mutex_lock (&shared_pool.timer_lock);
+  if (output->pool_timer) {
+    g_source_destroy (output->pool_timer);
+    g_source_unref (output->pool_timer);
+  }
+  if (!output->pool_context) {
+    output->pool_context = shared_pool.workers[shared_pool.next_timer_worker++
+        % shared_pool.n_workers].context;
+  }
+  output->pool_timer = g_timeout_source_new (timeout / 1000);
+  g_source_set_callback (output->pool_timer, server_output_pool_timer_cb,
+      output, NULL);
+  g_source_attach (output->pool_timer, output->pool_context);
+  g_mutex_unlock (&shared_pool.timer_lock);
+}
 
-  if (args && args->len > 0) {
-    command_obj = g_ptr_array_index (args, 0);
-    gst_rtmp_enhanced_caps_parse (command_obj, &session->enhanced_caps);
+/* Block the streaming task until woken up or until end_time (monotonic
+ * time, -1 to wait without timeout). Returns FALSE when flushing.
+ *
+ * With the shared pool, waiting does not block: without a pending wakeup,
+ * the output is parked and its worker moves on once the current iteration
+ * returned. The push itself may still block a push worker for as long as
+ * gst_pad_push() does. */
+static gboolean
+gst_rtmp2_server_src_wait (Rtmp2ServerSrcOutput *output, gint64 end_time)
+{
+  gboolean ret, parked = FALSE;
 
-    /* Extract app name */
-    const GstAmfNode *app_node = gst_amf_node_get_field (command_obj, "app");
-    if (app_node && gst_amf_node_get_type (app_node) == GST_AMF_TYPE_STRING) {
-      g_free (session->app_name);
-      session->app_name = gst_amf_node_get_string (app_node, NULL);
+  g_mutex_lock (&output->wakeup_lock);
+  if (output->pooled) {
+    if (!output->wakeup_pending || output->flushing)
+      output->pool_parked = parked = TRUE;
+  } else {
+    while (!output->wakeup_pending && !output->flushing) {
+      if (end_time < 0) {
+        g_cond_wait (&output->wakeup_cond, &output->wakeup_lock);
+      } else if (!g_cond_wait_until (&output->wakeup_cond,
+              &output->wakeup_lock, end_time)) {
+        break;
+      }
     }
   }
+  output->wakeup_pending = FALSE;
+  ret = !output->flushing;
+  g_mutex_unlock (&output->wakeup_lock);
 
-  /* Send connect result */
-  gst_rtmp_server_send_connect_result (session->connection, transaction_id,
-      &session->enhanced_caps);
-
-  session->state = SERVER_SESSION_STATE_CONNECTED;
-  GST_INFO ("Client connected, app=%s", session->app_name ? session->app_name : "");
-}
-
-static void
-on_create_stream_command (const gchar *command_name, GPtrArray *args, gpointer user_data)
-{
-  ServerSession *session = user_data;
-  gdouble transaction_id = 4.0; /* Default */
-  
-  GST_DEBUG ("Received createStream command");
+  if (parked && ret && end_time >= 0)
+    server_output_pool_arm_timer (output, end_time);
 
-  /* Transaction ID is the first arg in command args */
-  /* Actually for expected commands, args contains the objects after command name */
-  /* Transaction ID comes before the args passed here, extracted by connection */
-  
-  /* Send createStream result with stream ID 1 */
-  gst_rtmp_server_send_create_stream_result (session->connection, transaction_id, session->stream_id);
-  GST_INFO ("Sent createStream result with stream_id=%u", session->stream_id);
+  return ret;
 }
 
+/* Push worker of the shared pool, runs iterations of the output's loop
+ * until it parks or used up its turn */
 static void
-on_release_stream_command (const gchar *command_name, GPtrArray *args, gpointer user_data)
+rtmp2_server_pool_push_func (gpointer data, gpointer user_data)
 {
-  ServerSession *session = user_data;
-  gdouble transaction_id = 2.0;
+  Rtmp2ServerSrcOutput *output = data;
+  guint i;
+
+  for (i = 0; i < POOL_PUSH_BUDGET; i++) {
+    g_mutex_lock (&output->wakeup_lock);
+    if (!output->running || output->pool_parked) {
+      output->pool_scheduled = FALSE;
+      g_cond_broadcast (&output->wakeup_cond);
+      g_mutex_unlock (&output->wakeup_lock);
+      return;
+    }
+    g_mutex_unlock (&output->wakeup_lock);
 
-  GST_INFO ("Received releaseStream command");
+    g_rec_mutex_lock (&output->task_lock);
+    gst_rtmp2_server_src_loop (output);
+    g_rec_mutex_unlock (&output->task_lock);
+  }
 
-  /* Extract transaction ID from args if available */
-  /* Send _result response to acknowledge */
-  gst_rtmp_server_send_release_stream_result (session->connection, transaction_id);
-  GST_INFO ("Sent releaseStream result");
+  /* Still scheduled, back to the end of the queue */
+  g_thread_pool_push (shared_pool.push_pool, output, NULL);
 }
 
-static void
-on_fcpublish_command (const gchar *command_name, GPtrArray *args, gpointer user_data)
+static gpointer
+rtmp2_server_pool_worker_func (gpointer user_data)
 {
-  ServerSession *session = user_data;
-  gdouble transaction_id = 3.0;
+  Rtmp2ServerWorker *worker = user_data;
 
-  GST_INFO ("Received FCPublish command");
+  g_main_context_push_thread_default (worker->context);
+  while (g_atomic_int_get (&worker->running))
+    g_main_context_iteration (worker->context, TRUE);
+  g_main_context_pop_thread_default (worker->context);
 
-  /* Send _result to acknowledge - some clients wait for this */
-  gst_rtmp_server_send_fcpublish_result (session->connection, transaction_id);
-  GST_INFO ("Sent FCPublish result");
+  return NULL;
 }
 
-static void
-on_publish_command (const gchar *command_name, GPtrArray *args, gpointer user_data)
+/* Take a reference on the shared pool, starting its workers if it is not
+ * in use */
+static Rtmp2ServerPool *
+rtmp2_server_pool_acquire (void)
 {
-  ServerSession *session = user_data;
-  
-  GST_DEBUG ("Received publish command");
-
-  if (args && args->len > 0) {
-    const GstAmfNode *stream_name = g_ptr_array_index (args, 0);
-    if (stream_name && gst_amf_node_get_type (stream_name) == GST_AMF_TYPE_STRING) {
-      g_free (session->stream_key);
-      session->stream_key = gst_amf_node_get_string (stream_name, NULL);
+  g_mutex_lock (&pool_lock);
+  if (shared_pool.refcount++ == 0) {
+    guint i, n = MAX (g_get_num_processors (), 1);
+
+    shared_pool.workers = g_new0 (Rtmp2ServerWorker, n);
+    shared_pool.n_workers = n;
+    for (i = 0; i < n; i++) {
+      Rtmp2ServerWorker *worker = &shared_pool.workers[i];
+
+      worker->context = g_main_context_new ();
+      worker->running = TRUE;
+      worker->thread = g_thread_new ("rtmp-io-worker",
+          rtmp2_server_pool_worker_func, worker);
     }
-  }
+    shared_pool.push_pool = g_thread_pool_new (rtmp2_server_pool_push_func,
+        NULL, n, FALSE, NULL);
 
-  /* Send publish start */
-  gst_rtmp_server_send_publish_start (session->connection, session->stream_id);
+    GST_INFO ("Started shared pool with %u workers", n);
+  }
+  g_mutex_unlock (&pool_lock);
 
-  session->state = SERVER_SESSION_STATE_PUBLISHING;
-  GST_INFO ("Client publishing, stream=%s", session->stream_key ? session->stream_key : "");
+  return &shared_pool;
 }
 
-/* Media message handler */
+/* Drop a reference on the shared pool. The last one stops the workers,
+ * once no listener runs on them and no output is scheduled anymore. */
 static void
-on_media_message (GstRtmpConnection *connection, GstBuffer *buffer, gpointer user_data)
+rtmp2_server_pool_release (void)
 {
-  ServerSession *session = user_data;
-  GstRtmpMeta *meta;
-  Rtmp2FlvTag *tag;
-  GstMapInfo map;
-  GstClockTime dts;
-  guint32 timestamp_ms;
+  guint i;
 
-  meta = gst_buffer_get_rtmp_meta (buffer);
-  if (!meta) {
-    GST_DEBUG ("Media message without RTMP meta");
+  g_mutex_lock (&pool_lock);
+  if (--shared_pool.refcount > 0) {
+    g_mutex_unlock (&pool_lock);
     return;
   }
 
-  /* Get the absolute timestamp from buffer DTS (set by rtmpchunkstream) */
-  dts = GST_BUFFER_DTS (buffer);
-  if (GST_CLOCK_TIME_IS_VALID (dts)) {
-    timestamp_ms = (guint32) (dts / GST_MSECOND);
-  } else {
-    timestamp_ms = meta->ts_delta;  /* fallback to delta as absolute */
-  }
+  g_thread_pool_free (shared_pool.push_pool, FALSE, TRUE);
+  shared_pool.push_pool = NULL;
 
-  GST_LOG ("Received media message type=%d dts=%" GST_TIME_FORMAT " timestamp_ms=%u size=%" G_GSIZE_FORMAT,
-      meta->type, GST_TIME_ARGS(dts), timestamp_ms, gst_buffer_get_size (buffer));
+  for (i = 0; i < shared_pool.n_workers; i++) {
+    Rtmp2ServerWorker *worker = &shared_pool.workers[i];
 
-  /* Only process video and audio messages */
-  if (meta->type != GST_RTMP_MESSAGE_TYPE_VIDEO &&
-      meta->type != GST_RTMP_MESSAGE_TYPE_AUDIO &&
-      meta->type != GST_RTMP_MESSAGE_TYPE_DATA_AMF0) {
-    return;
+    g_atomic_int_set (&worker->running, FALSE);
+    g_main_context_wakeup (worker->context);
+    g_thread_join (worker->thread);
+    g_main_context_unref (worker->context);
   }
+  g_clear_pointer (&shared_pool.workers, g_free);
+  shared_pool.n_workers = 0;
 
-  /* Create FLV tag from RTMP message */
-  tag = rtmp2_flv_tag_new ();
-  
-  if (meta->type == GST_RTMP_MESSAGE_TYPE_VIDEO) {
-    tag->tag_type = RTMP2_FLV_TAG_VIDEO;
-  } else if (meta->type == GST_RTMP_MESSAGE_TYPE_AUDIO) {
-    tag->tag_type = RTMP2_FLV_TAG_AUDIO;
-  } else {
-    tag->tag_type = RTMP2_FLV_TAG_SCRIPT;
-  }
-  
-  /* Use absolute timestamp from buffer DTS */
-  tag->timestamp = timestamp_ms;
-  tag->data_size = gst_buffer_get_size (buffer);
-  tag->data = gst_buffer_ref (buffer);
+  GST_INFO ("Stopped shared pool");
+  g_mutex_unlock (&pool_lock);
+}
 
-  /* Parse video/audio codec info from first byte */
-  if (gst_buffer_map (buffer, &map, GST_MAP_READ)) {
-    if (map.size > 0) {
-      guint8 first_byte = map.data[0];
-      
-      if (tag->tag_type == RTMP2_FLV_TAG_VIDEO) {
-        tag->video_keyframe = ((first_byte >> 4) & 0x0F) == 1;
-        tag->video_codec = first_byte & 0x0F;
-      } else if (tag->tag_type == RTMP2_FLV_TAG_AUDIO) {
-        tag->audio_codec = (first_byte >> 4) & 0x0F;
-      }
-    }
-    gst_buffer_unmap (buffer, &map);
+/* Start, pause and stop pushing from an output, on its task or on the
+ * push workers of the shared pool */
+static void
+server_output_start (Rtmp2ServerSrcOutput *output)
+{
+  g_mutex_lock (&output->wakeup_lock);
+  output->running = TRUE;
+  if (output->pooled) {
+    server_output_schedule_locked (output);
+  } else if (output->task_needed || !output->src->direct_push) {
+    /* In direct-push mode, the first tag it has to queue starts the task */
+    output->task_needed = output->task_started = TRUE;
+    gst_task_start (output->task);
   }
-
-  /* Queue the tag */
-  g_mutex_lock (&session->queue_lock);
-  g_queue_push_tail (session->tag_queue, tag);
-  g_mutex_unlock (&session->queue_lock);
-
-  GST_LOG ("Queued %s tag, timestamp=%u, size=%u",
-      tag->tag_type == RTMP2_FLV_TAG_VIDEO ? "video" :
-      tag->tag_type == RTMP2_FLV_TAG_AUDIO ? "audio" : "data",
-      tag->timestamp, tag->data_size);
+  g_mutex_unlock (&output->wakeup_lock);
 }
 
-/* Connection error handler */
 static void
-on_connection_error (GstRtmpConnection *connection, GError *error, gpointer user_data)
+server_output_pause (Rtmp2ServerSrcOutput *output)
 {
-  ServerSession *session = user_data;
-  
-  GST_WARNING ("Connection error: %s", error->message);
-  session->state = SERVER_SESSION_STATE_DISCONNECTED;
+  g_mutex_lock (&output->wakeup_lock);
+  output->running = FALSE;
+  if (output->task_started)
+    gst_task_pause (output->task);
+  g_mutex_unlock (&output->wakeup_lock);
 }
 
-/* Handshake complete callback */
 static void
-on_handshake_done (GObject *source, GAsyncResult *result, gpointer user_data)
+server_output_stop (Rtmp2ServerSrcOutput *output)
 {
-  GIOStream *stream = G_IO_STREAM (source);
-  ServerSession *session = user_data;
-  GstRtmp2ServerSrc *src = session->src;
-  GError *error = NULL;
-  gboolean success;
+  g_mutex_lock (&output->wakeup_lock);
+  output->running = FALSE;
+  if (output->task_started) {
+    gst_task_stop (output->task);
+    output->task_started = FALSE;
+  }
+  output->task_needed = FALSE;
+  g_mutex_unlock (&output->wakeup_lock);
+}
 
-  success = gst_rtmp_server_handshake_finish (stream, result, &error);
-  if (!success) {
-    GST_WARNING_OBJECT (src, "Handshake failed: %s", error->message);
-    g_error_free (error);
-    
-    g_mutex_lock (&src->sessions_lock);
-    src->sessions = g_list_remove (src->sessions, session);
-    g_mutex_unlock (&src->sessions_lock);
-    
-    server_session_free (session);
+/* Wait until a stopped output is not pushing anymore */
+static void
+server_output_join (Rtmp2ServerSrcOutput *output)
+{
+  if (!output->pooled) {
+    gst_task_join (output->task);
     return;
   }
 
-  GST_INFO_OBJECT (src, "Handshake completed");
-
-  /* Create GstRtmpConnection from socket connection we stored earlier */
-  session->connection = gst_rtmp_connection_new (session->socket_connection, NULL);
+  g_mutex_lock (&output->wakeup_lock);
+  while (output->pool_scheduled)
+    g_cond_wait (&output->wakeup_cond, &output->wakeup_lock);
+  g_mutex_unlock (&output->wakeup_lock);
 
-  /* Set up message handlers */
-  gst_rtmp_connection_set_input_handler (session->connection,
-      on_media_message, session, NULL);
+  g_mutex_lock (&shared_pool.timer_lock);
+  if (output->pool_timer) {
+    g_source_destroy (output->pool_timer);
+    g_clear_pointer (&output->pool_timer, g_source_unref);
+  }
+  output->pool_context = NULL;
+  g_mutex_unlock (&shared_pool.timer_lock);
+}
 
-  g_signal_connect (session->connection, "error",
-      G_CALLBACK (on_connection_error), session);
+static gboolean
+server_output_is_running (Rtmp2ServerSrcOutput *output)
+{
+  gboolean running;
 
-  GST_INFO ("Setting up expected commands");
+  g_mutex_lock (&output->wakeup_lock);
+  running = output->running;
+  g_mutex_unlock (&output->wakeup_lock);
 
-  /* Expect connect command */
-  gst_rtmp_connection_expect_command (session->connection,
-      on_connect_command, session, 0, "connect");
+  return running;
+}
 
-  /* Also expect releaseStream, FCPublish, createStream and publish 
-   * Note: These all come on stream 0, and publish comes on stream 1 */
-  gst_rtmp_connection_expect_command (session->connection,
-      on_release_stream_command, session, 0, "releaseStream");
-  gst_rtmp_connection_expect_command (session->connection,
-      on_fcpublish_command, session, 0, "FCPublish");
-  gst_rtmp_connection_expect_command (session->connection,
-      on_create_stream_command, session, 0, "createStream");
-  gst_rtmp_connection_expect_command (session->connection,
-      on_publish_command, session, 1, "publish");
+/* Lossless mode pauses reading with a quarter of the ring still free, for
+ * the messages the connection already read from the socket */
+static guint
+server_session_throttle_level (ServerSessionMedia *media)
+{
+  return media->tag_ring.capacity - media->tag_ring.capacity / 4;
+}
 
-  GST_INFO ("All expected commands registered");
+/* Whether a throttled session queue drained enough to resume reading */
+static gboolean
+server_session_below_low_watermark (ServerSession *session)
+{
+  ServerSessionMedia *media = session->media;
+  GstRtmp2ServerSrc *src = session->src;
+  guint low = MIN (src->low_watermark, src->high_watermark);
 
-  /* Set as active session if none */
-  g_mutex_lock (&src->sessions_lock);
-  if (!src->active_session) {
-    src->active_session = session;
-  }
-  g_mutex_unlock (&src->sessions_lock);
+  return (src->high_watermark == 0 ||
+      rtmp2_flv_tag_ring_get_bytes (&media->tag_ring) <= low) &&
+      rtmp2_flv_tag_ring_get_level (&media->tag_ring) <=
+      media->tag_ring.capacity / 2;
 }
 
-/* Incoming connection handler */
+/* Move the backlog of a lossless session into the ring, in order. Returns
+ * whether all of it fit. Only called from the event loop thread. */
 static gboolean
-on_incoming_connection (GSocketService *service, GSocketConnection *connection,
-    GObject *source_object, gpointer user_data)
+server_session_flush_backlog (ServerSession *session)
 {
-  GstRtmp2ServerSrc *src = GST_RTMP2_SERVER_SRC (user_data);
-  ServerSession *session;
-  GIOStream *stream;
-
-  GST_INFO_OBJECT (src, "New incoming connection");
+  ServerSessionMedia *media = session->media;
+  Rtmp2FlvTag *tag;
 
-  session = server_session_new (src, connection);
-  
-  g_mutex_lock (&src->sessions_lock);
-  src->sessions = g_list_append (src->sessions, session);
-  g_mutex_unlock (&src->sessions_lock);
+  while ((tag = g_queue_peek_head (&media->backlog))) {
+    if (!server_session_push_held_headers (session) ||
+        !rtmp2_flv_tag_ring_push (&media->tag_ring, tag))
+      return FALSE;
 
-  /* Start server handshake */
-  stream = G_IO_STREAM (connection);
-  gst_rtmp_server_handshake (stream, FALSE, NULL, on_handshake_done, session);
+    /* Ownership of the payload moved into the ring */
+    g_free (g_queue_pop_head (&media->backlog));
+  }
 
   return TRUE;
 }
 
-/* Task loop - pushes FLV data to srcpad */
-static void
-gst_rtmp2_server_src_loop (gpointer user_data)
+static gboolean
+server_session_resume_cb (gpointer user_data)
 {
-  GstRtmp2ServerSrc *src = GST_RTMP2_SERVER_SRC (user_data);
-  ServerSession *session;
-  Rtmp2FlvTag *tag = NULL;
-  GstBuffer *buffer;
-  GstFlowReturn ret;
+  ServerSession *session = user_data;
+  ServerSessionMedia *media;
+  GstRtmp2ServerSrc *src;
+  gboolean flushed;
+
+  /* Destroyed under the lock before the session goes away. Only this
+   * thread disconnects a session, and only disconnected ones are freed
+   * elsewhere, so it stays valid once checked. */
+  g_mutex_lock (&throttle_lock);
+  if (g_source_is_destroyed (g_main_current_source ()) ||
+      session->state == SERVER_SESSION_STATE_DISCONNECTED) {
+    g_mutex_unlock (&throttle_lock);
+    return G_SOURCE_REMOVE;
+  }
+  media = session->media;
+  g_clear_pointer (&media->resume_source, g_source_unref);
+  g_mutex_unlock (&throttle_lock);
+
+  /* What was read before pausing goes first. If it doesn't all fit, stay
+   * paused, the next tag the streaming task takes schedules this again. */
+  flushed = server_session_flush_backlog (session);
+  gst_rtmp2_server_src_wakeup (session->output);
+  if (!flushed)
+    return G_SOURCE_REMOVE;
+
+  g_mutex_lock (&throttle_lock);
+  media->throttled_time += (g_get_monotonic_time () -
+      media->throttle_start) * GST_USECOND;
+  g_atomic_int_set (&media->throttled, FALSE);
+  g_mutex_unlock (&throttle_lock);
+
+  src = session->src;
+  GST_DEBUG_OBJECT (src, "Queue drained to %u bytes, resuming reads",
+      rtmp2_flv_tag_ring_get_bytes (&media->tag_ring));
+
+  /* The media timeout starts over */
+  session->last_activity = g_get_monotonic_time ();
+  rtmp2_pausable_connection_set_paused (session->pausable, FALSE);
+
+  return G_SOURCE_REMOVE;
+}
 
-  g_mutex_lock (&src->sessions_lock);
-  session = src->active_session;
-  g_mutex_unlock (&src->sessions_lock);
+/* Called by the streaming task after it took tags out of the queue, and
+ * by the event loop thread right after throttling. Resumes reading on the
+ * session's own event loop thread, like g_main_context_invoke() but with
+ * a source server_session_free() can cancel. */
+static void
+server_session_release_throttle (ServerSession *session)
+{
+  ServerSessionMedia *media = session->media;
 
-  if (!session) {
-    g_usleep (10000);  /* 10ms */
+  if (!g_atomic_int_get (&media->throttled) ||
+      !server_session_below_low_watermark (session))
     return;
+
+  g_mutex_lock (&throttle_lock);
+  if (media->throttled && !media->resume_source) {
+    media->resume_source = g_idle_source_new ();
+    g_source_set_priority (media->resume_source, G_PRIORITY_DEFAULT);
+    g_source_set_callback (media->resume_source, server_session_resume_cb,
+        session, NULL);
+    g_source_attach (media->resume_source, session->context);
+  }
+  g_mutex_unlock (&throttle_lock);
+}
+
+/* Lossless flow control. Once a session queue passes the high watermark
+ * or most of its slots are taken, stop reading from its connection until
+ * the streaming task drained it to the low watermark. TCP flow control
+ * then pushes back on that publisher alone, the event loop thread keeps
+ * serving every other connection. Only called from the event loop
+ * thread. */
+static void
+server_session_throttle (ServerSession *session)
+{
+  ServerSessionMedia *media = session->media;
+  GstRtmp2ServerSrc *src = session->src;
+
+  if (!session->pausable || g_atomic_int_get (&media->throttled))
+    return;
+
+  if (g_queue_is_empty (&media->backlog) &&
+      (src->high_watermark == 0 ||
+          rtmp2_flv_tag_ring_get_bytes (&media->tag_ring) <
+          src->high_watermark) &&
+      rtmp2_flv_tag_ring_get_level (&media->tag_ring) <
+      server_session_throttle_level (media))
+    return;
+
+  GST_DEBUG_OBJECT (src, "Queue above high watermark (%u bytes, %u tags), "
+      "pausing reads from the publisher",
+      rtmp2_flv_tag_ring_get_bytes (&media->tag_ring),
+      rtmp2_flv_tag_ring_get_level (&media->tag_ring));
+
+  g_mutex_lock (&throttle_lock);
+  media->throttle_start = g_get_monotonic_time ();
+  media->throttle_count++;
+  g_atomic_int_set (&media->throttled, TRUE);
+  g_mutex_unlock (&throttle_lock);
+
+  rtmp2_pausable_connection_set_paused (session->pausable, TRUE);
+
+  /* The task may have drained the queue before it saw the flag */
+  server_session_release_throttle (session);
+}
+
+/* Timeout of the current state of a session, on the timer wheel of its
+ * event loop. Replaces the current one, 0 only cancels it. Called on the
+ * event loop thread of the session. */
+static void
+server_session_arm_timeout (ServerSession *session, guint seconds)
+{
+  rtmp2_timer_wheel_arm (session->wheel, &session->timer, seconds);
+}
+
+/* From any thread. A session left over once its event loop is gone has no
+ * wheel anymore. */
+static void
+server_session_cancel_timeout (ServerSession *session)
+{
+  if (session->wheel)
+    rtmp2_timer_wheel_cancel (session->wheel, &session->timer);
+}
+
+/* Session management */
+static ServerSessionMedia *
+server_session_media_new (GstRtmp2ServerSrc *src)
+{
+  ServerSessionMedia *media = g_new0 (ServerSessionMedia, 1);
+
+  rtmp2_flv_tag_ring_init (&media->tag_ring, src->max_queue_tags);
+  rtmp2_flv_tag_ring_set_total (&media->tag_ring, &total_queued_bytes);
+  g_queue_init (&media->backlog);
+  g_mutex_init (&media->gop_lock);
+  g_queue_init (&media->gop_tags);
+  return media;
+}
+
+/* Once its resume source is gone */
+static void
+server_session_media_free (ServerSessionMedia *media)
+{
+  guint i;
+
+  rtmp2_flv_tag_ring_clear (&media->tag_ring);
+  for (i = 0; i < G_N_ELEMENTS (media->held_headers); i++)
+    rtmp2_flv_tag_clear (&media->held_headers[i]);
+  g_queue_clear_full (&media->backlog, (GDestroyNotify) rtmp2_flv_tag_free);
+
+  for (i = 0; i < G_N_ELEMENTS (media->gop_headers); i++)
+    rtmp2_flv_tag_clear (&media->gop_headers[i]);
+  g_queue_clear_full (&media->gop_tags, (GDestroyNotify) rtmp2_flv_tag_free);
+  g_mutex_clear (&media->gop_lock);
+
+  g_free (media);
+}
+
+static ServerSession *
+server_session_new (GstRtmp2ServerSrc *src, GSocketConnection *socket_connection)
+{
+  ServerSession *session = g_new0 (ServerSession, 1);
+  session->socket_connection = g_object_ref (socket_connection);
+  session->state = SERVER_SESSION_STATE_NEW;
+  session->stream_id = 1;
+  session->cancellable = g_cancellable_new ();
+  session->src = src;
+  rtmp2_timer_init (&session->timer, session);
+  return session;
+}
+
+/* The session stops counting as a connection of its event loop, on that
+ * thread */
+static void
+server_session_leave_loop (ServerSession *session)
+{
+  if (session->loop) {
+    g_atomic_int_add (&session->loop->n_sessions, -1);
+    session->loop = NULL;
+  }
+}
+
+static void
+server_session_free (ServerSession *session)
+{
+  if (!session)
+    return;
+
+  server_session_cancel_timeout (session);
+  server_session_leave_loop (session);
+
+  g_mutex_lock (&throttle_lock);
+  if (session->media && session->media->resume_source) {
+    g_source_destroy (session->media->resume_source);
+    g_clear_pointer (&session->media->resume_source, g_source_unref);
+  }
+  g_mutex_unlock (&throttle_lock);
+
+  if (session->connection) {
+    gst_rtmp_connection_close (session->connection);
+    g_object_unref (session->connection);
+    g_clear_object (&session->pausable);
+  } else {
+    g_atomic_int_add (&session->src->n_handshakes, -1);
+  }
+
+  g_clear_object (&session->socket_connection);
+  g_clear_object (&session->cancellable);
+
+  g_free (session->app_name);
+  g_free (session->stream_key);
+  g_free (session->stream_name);
+
+  if (session->media)
+    server_session_media_free (session->media);
+
+  g_free (session);
+}
+
+/* Session registry, all with the element's sessions_lock held for
+ * writing */
+static void
+server_registry_add_locked (GstRtmp2ServerSrc *src, ServerSession *session)
+{
+  g_hash_table_insert (src->sessions, session->socket_connection, session);
+  g_atomic_int_inc (&src->n_sessions);
+}
+
+static void
+server_registry_remove_locked (GstRtmp2ServerSrc *src,
+    ServerSession *session)
+{
+  GQueue *queue;
+
+  if (g_hash_table_remove (src->sessions, session->socket_connection))
+    g_atomic_int_add (&src->n_sessions, -1);
+
+  if (!session->stream_name)
+    return;
+
+  queue = g_hash_table_lookup (src->streams, session->stream_name);
+  if (queue) {
+    g_queue_remove (queue, session);
+    if (g_queue_is_empty (queue))
+      g_hash_table_remove (src->streams, session->stream_name);
+  }
+}
+
+/* Make a session publish to output, after the sessions that published to
+ * its stream before. It becomes the output's session if there is none. */
+static void
+server_registry_publish_locked (GstRtmp2ServerSrc *src,
+    ServerSession *session, Rtmp2ServerSrcOutput *output)
+{
+  GQueue *queue;
+
+  /* Most connections never get here, only publishers pay for the queue
+   * and the rest of the media state. The streaming task sees it once the
+   * session becomes the output's. */
+  if (!session->media)
+    session->media = server_session_media_new (src);
+
+  session->output = output;
+  session->stream_name = g_strdup_printf ("%s/%s",
+      session->app_name ? session->app_name : "",
+      session->stream_key ? session->stream_key : "");
+  session->publish_seq = src->publish_count++;
+
+  queue = g_hash_table_lookup (src->streams, session->stream_name);
+  if (!queue) {
+    queue = g_queue_new ();
+    g_hash_table_insert (src->streams, g_strdup (session->stream_name),
+        queue);
+  }
+  g_queue_push_tail (queue, session);
+
+  if (!output->session)
+    g_atomic_pointer_set (&output->session, session);
+}
+
+static gboolean
+server_session_is_waiting (ServerSession *session,
+    Rtmp2ServerSrcOutput *output)
+{
+  return session->output == output && session->connection &&
+      session->state != SERVER_SESSION_STATE_DISCONNECTED;
+}
+
+/* Publisher that waited longest for output, NULL if none */
+static ServerSession *
+server_registry_next_locked (GstRtmp2ServerSrc *src,
+    Rtmp2ServerSrcOutput *output)
+{
+  ServerSession *next = NULL;
+  GHashTableIter iter;
+  gpointer value;
+  GQueue *queue;
+  GList *l;
+
+  /* A multi-stream output serves the stream of its name only */
+  if (output->name) {
+    queue = g_hash_table_lookup (src->streams, output->name);
+    for (l = queue ? queue->head : NULL; l; l = l->next) {
+      if (server_session_is_waiting (l->data, output))
+        return l->data;
+    }
+    return NULL;
+  }
+
+  g_hash_table_iter_init (&iter, src->streams);
+  while (g_hash_table_iter_next (&iter, NULL, &value)) {
+    queue = value;
+    for (l = queue->head; l; l = l->next) {
+      ServerSession *waiting = l->data;
+
+      if (server_session_is_waiting (waiting, output)) {
+        if (!next || waiting->publish_seq < next->publish_seq)
+          next = waiting;
+        break;
+      }
+    }
+  }
+
+  return next;
+}
+
+/* Output on the always "src" pad if name is NULL, otherwise a multi-stream
+ * output on a new stream pad named pad_name */
+static Rtmp2ServerSrcOutput *
+server_output_new (GstRtmp2ServerSrc *src, const gchar *name,
+    const gchar *pad_name)
+{
+  Rtmp2ServerSrcOutput *output = g_new0 (Rtmp2ServerSrcOutput, 1);
+
+  output->src = src;
+  output->name = g_strdup (name);
+
+  if (name)
+    output->srcpad = gst_pad_new_from_static_template (&stream_template,
+        pad_name);
+  else
+    output->srcpad = gst_pad_new_from_static_template (&src_template, "src");
+  /* Kept while it is not on the element, as the default one in elementary
+   * output mode */
+  gst_object_ref_sink (output->srcpad);
+  gst_pad_use_fixed_caps (output->srcpad);
+  gst_pad_set_query_function (output->srcpad, gst_rtmp2_server_src_query);
+  g_signal_connect (output->srcpad, "linked",
+      G_CALLBACK (gst_rtmp2_server_src_pad_linked), output);
+
+  output->flow_combiner = gst_flow_combiner_new ();
+
+  g_rec_mutex_init (&output->task_lock);
+  output->task = gst_task_new ((GstTaskFunction) gst_rtmp2_server_src_loop,
+      output, NULL);
+  gst_task_set_lock (output->task, &output->task_lock);
+
+  g_mutex_init (&output->wakeup_lock);
+  g_cond_init (&output->wakeup_cond);
+  g_mutex_init (&output->push_lock);
+  output->flushing = !name;
+  output->pooled = src->shared_pool;
+
+  return output;
+}
+
+/* Unblock or re-arm the streaming task */
+static void
+server_output_set_flushing (Rtmp2ServerSrcOutput *output, gboolean flushing)
+{
+  g_mutex_lock (&output->wakeup_lock);
+  output->flushing = flushing;
+  output->wakeup_pending = FALSE;
+  g_cond_signal (&output->wakeup_cond);
+  g_mutex_unlock (&output->wakeup_lock);
+}
+
+/* Free an output whose task is stopped, removing its pad from the
+ * element */
+static void
+server_output_free (Rtmp2ServerSrcOutput *output)
+{
+  if (GST_OBJECT_PARENT (output->srcpad) == GST_OBJECT_CAST (output->src))
+    gst_element_remove_pad (GST_ELEMENT (output->src), output->srcpad);
+  gst_object_unref (output->srcpad);
+
+  gst_flow_combiner_free (output->flow_combiner);
+  gst_object_unref (output->task);
+  g_rec_mutex_clear (&output->task_lock);
+  g_mutex_clear (&output->wakeup_lock);
+  g_cond_clear (&output->wakeup_cond);
+  g_mutex_clear (&output->push_lock);
+  g_free (output->name);
+  g_free (output);
+}
+
+/* Try to queue the headers that were held back while the ring was full.
+ * Returns FALSE if some are still pending. */
+static gboolean
+server_session_push_held_headers (ServerSession *session)
+{
+  ServerSessionMedia *media = session->media;
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (media->held_headers); i++) {
+    Rtmp2FlvTag *held = &media->held_headers[i];
+
+    if (!held->data)
+      continue;
+    if (!rtmp2_flv_tag_ring_push (&media->tag_ring, held))
+      return FALSE;
+
+    /* Ownership of the payload moved into the ring */
+    held->data = NULL;
+  }
+
+  return TRUE;
+}
+
+/* Index of a header kind in per-session header arrays */
+static guint
+rtmp2_flv_tag_header_index (const Rtmp2FlvTag *tag)
+{
+  if (tag->tag_type == RTMP2_FLV_TAG_VIDEO)
+    return 0;
+  if (tag->tag_type == RTMP2_FLV_TAG_AUDIO)
+    return 1;
+  return 2;
+}
+
+static void
+server_session_gop_cache_flush (ServerSession *session)
+{
+  ServerSessionMedia *media = session->media;
+
+  g_queue_clear_full (&media->gop_tags, (GDestroyNotify) rtmp2_flv_tag_free);
+  media->gop_bytes = 0;
+  media->gop_has_keyframe = FALSE;
+}
+
+/* Remember the latest headers and everything since the last keyframe, so
+ * new output can start decoding right away. Called from the event loop
+ * thread for every tag received. */
+static void
+server_session_gop_cache_add (ServerSession *session, const Rtmp2FlvTag *tag)
+{
+  ServerSessionMedia *media = session->media;
+  guint max_bytes = session->src->gop_cache_max_bytes;
+  gboolean header = rtmp2_flv_tag_is_header (tag);
+
+  if (max_bytes == 0)
+    return;
+
+  g_mutex_lock (&media->gop_lock);
+
+  if (header) {
+    Rtmp2FlvTag *held =
+        &media->gop_headers[rtmp2_flv_tag_header_index (tag)];
+
+    rtmp2_flv_tag_clear (held);
+    *held = *tag;
+    gst_buffer_ref (held->data);
+
+    /* Headers before the GOP are replayed from gop_headers, later ones
+     * keep their place in the GOP */
+    if (g_queue_is_empty (&media->gop_tags))
+      goto done;
+  } else if (tag->tag_type == RTMP2_FLV_TAG_VIDEO) {
+    if (tag->video_keyframe) {
+      server_session_gop_cache_flush (session);
+      media->gop_has_keyframe = TRUE;
+    } else if (!media->gop_has_keyframe) {
+      /* Not decodable without the keyframe we missed */
+      goto done;
+    }
+  }
+
+  g_queue_push_tail (&media->gop_tags, rtmp2_flv_tag_copy (tag));
+  media->gop_bytes += tag->data_size;
+
+  while (media->gop_bytes > max_bytes) {
+    Rtmp2FlvTag *oldest;
+
+    if (media->gop_has_keyframe) {
+      /* The GOP doesn't fit, wait for the next keyframe */
+      GST_LOG ("GOP exceeds %u bytes, not caching it", max_bytes);
+      server_session_gop_cache_flush (session);
+      break;
+    }
+
+    /* Audio only, keep a sliding window */
+    oldest = g_queue_pop_head (&media->gop_tags);
+    media->gop_bytes -= oldest->data_size;
+    rtmp2_flv_tag_free (oldest);
+  }
+
+done:
+  g_mutex_unlock (&media->gop_lock);
+}
+
+static gint
+compare_tag_seqnum (gconstpointer a, gconstpointer b)
+{
+  const Rtmp2FlvTag *tag_a = *(Rtmp2FlvTag * const *) a;
+  const Rtmp2FlvTag *tag_b = *(Rtmp2FlvTag * const *) b;
+
+  return (gint32) (tag_a->seqnum - tag_b->seqnum);
+}
+
+/* Copy of the GOP cache in push order: the headers that preceded the GOP,
+ * then the GOP itself */
+static GPtrArray *
+server_session_gop_cache_get (ServerSession *session)
+{
+  ServerSessionMedia *media = session->media;
+  GPtrArray *tags = g_ptr_array_new_with_free_func (
+      (GDestroyNotify) rtmp2_flv_tag_free);
+  const Rtmp2FlvTag *first;
+  GList *l;
+  guint i;
+
+  g_mutex_lock (&media->gop_lock);
+
+  first = g_queue_peek_head (&media->gop_tags);
+  for (i = 0; i < G_N_ELEMENTS (media->gop_headers); i++) {
+    const Rtmp2FlvTag *header = &media->gop_headers[i];
+
+    if (header->data &&
+        (!first || (gint32) (header->seqnum - first->seqnum) < 0))
+      g_ptr_array_add (tags, rtmp2_flv_tag_copy (header));
+  }
+  g_ptr_array_sort (tags, compare_tag_seqnum);
+
+  for (l = media->gop_tags.head; l; l = l->next)
+    g_ptr_array_add (tags, rtmp2_flv_tag_copy (l->data));
+
+  g_mutex_unlock (&media->gop_lock);
+
+  return tags;
+}
+
+/* Hand a tag over to the streaming task, taking ownership of tag->data.
+ * Only called from the event loop thread, the single producer. */
+static void
+server_session_enqueue (ServerSession *session, Rtmp2FlvTag *tag)
+{
+  ServerSessionMedia *media = session->media;
+  gboolean header = rtmp2_flv_tag_is_header (tag);
+  gboolean keyframe = tag->tag_type == RTMP2_FLV_TAG_VIDEO &&
+      tag->video_keyframe;
+  gboolean over_budget;
+
+  /* Lossless mode queues everything in order. What doesn't fit waits in
+   * the backlog, reading is paused by then so only the rest of the current
+   * read ends up there. The watermarks bound the queue instead of the
+   * process wide budget. */
+  if (session->pausable) {
+    if (!g_queue_is_empty (&media->backlog) ||
+        !server_session_push_held_headers (session) ||
+        !rtmp2_flv_tag_ring_push (&media->tag_ring, tag))
+      g_queue_push_tail (&media->backlog,
+          g_memdup2 (tag, sizeof (Rtmp2FlvTag)));
+    return;
+  }
+
+  /* After an overflow, video resumes on the next keyframe */
+  if (media->need_keyframe && tag->tag_type == RTMP2_FLV_TAG_VIDEO &&
+      !keyframe && !header) {
+    rtmp2_flv_tag_clear (tag);
+    g_atomic_int_inc (&media->overflow_drops);
+    return;
+  }
+
+  /* The per-queue byte, time and latency limits belong to the leaky
+   * policy, applied when popping. Only the slot count and the process
+   * wide budget are hard limits here, and sequence headers may exceed
+   * the budget. */
+  over_budget = session->src->max_total_bytes > 0 &&
+      (guint) g_atomic_int_get (&total_queued_bytes) + tag->data_size >
+      session->src->max_total_bytes;
+
+  if (server_session_push_held_headers (session) && (header || !over_budget) &&
+      rtmp2_flv_tag_ring_push (&media->tag_ring, tag)) {
+    if (keyframe)
+      media->need_keyframe = FALSE;
+    return;
+  }
+
+  /* The queue is full. Keep the latest header of each kind aside so the
+   * stream stays decodable, drop everything else and resync video on
+   * the next keyframe. */
+  if (header) {
+    Rtmp2FlvTag *held =
+        &media->held_headers[rtmp2_flv_tag_header_index (tag)];
+
+    rtmp2_flv_tag_clear (held);
+    *held = *tag;
+    return;
+  }
+
+  if (tag->tag_type == RTMP2_FLV_TAG_VIDEO)
+    media->need_keyframe = TRUE;
+
+  GST_DEBUG ("Tag queue full (%u tags, %u bytes), dropping %s tag",
+      rtmp2_flv_tag_ring_get_level (&media->tag_ring),
+      rtmp2_flv_tag_ring_get_bytes (&media->tag_ring),
+      tag->tag_type == RTMP2_FLV_TAG_VIDEO ? "video" : "audio");
+
+  rtmp2_flv_tag_clear (tag);
+  g_atomic_int_inc (&media->overflow_drops);
+}
+
+static gboolean
+deferred_release_cb (gpointer user_data)
+{
+  return G_SOURCE_REMOVE;
+}
+
+/* Run release (data) on the event loop thread of context once the current
+ * callbacks returned, or when the server stops and the main context goes
+ * away */
+static void
+gst_rtmp2_server_src_defer_release (GMainContext *context,
+    GDestroyNotify release, gpointer data)
+{
+  GSource *source = g_idle_source_new ();
+
+  g_source_set_callback (source, deferred_release_cb, data, release);
+  g_source_attach (source, context);
+  g_source_unref (source);
+}
+
+static void
+server_session_release (gpointer user_data)
+{
+  ServerSession *session = user_data;
+  GstRtmp2ServerSrc *src = session->src;
+
+  g_rw_lock_writer_lock (&src->sessions_lock);
+  server_registry_remove_locked (src, session);
+  g_rw_lock_writer_unlock (&src->sessions_lock);
+
+  server_session_free (session);
+}
+
+/* Free a session that will never be output, once its connection's
+ * callbacks returned */
+static void
+server_session_discard (ServerSession *session)
+{
+  session->state = SERVER_SESSION_STATE_DISCONNECTED;
+  server_session_leave_loop (session);
+  gst_rtmp2_server_src_defer_release (session->context,
+      server_session_release, session);
+}
+
+/* Refuse a publish with an onStatus error. The session leaves the element
+ * right away, its connection is closed once the client had time to read
+ * the error. */
+static void
+server_session_reject (ServerSession *session, const gchar *code,
+    const gchar *description)
+{
+  GstRtmp2ServerSrc *src = session->src;
+  GSource *source;
+
+  gst_rtmp_server_send_publish_error (session->connection, session->stream_id,
+      code, description);
+
+  server_session_cancel_timeout (session);
+  session->state = SERVER_SESSION_STATE_DISCONNECTED;
+  server_session_leave_loop (session);
+  g_rw_lock_writer_lock (&src->sessions_lock);
+  server_registry_remove_locked (src, session);
+  g_rw_lock_writer_unlock (&src->sessions_lock);
+
+  source = g_timeout_source_new (REJECT_LINGER_TIME);
+  g_source_set_callback (source, deferred_release_cb, session,
+      (GDestroyNotify) server_session_free);
+  g_source_attach (source, session->context);
+  g_source_unref (source);
+}
+
+/* Whether the stream key table of the element lets stream_key publish */
+static gboolean
+gst_rtmp2_server_src_authorize (GstRtmp2ServerSrc *src,
+    const gchar *stream_key)
+{
+  GHashTable *keys;
+  gboolean ret;
+
+  g_mutex_lock (&src->keys_lock);
+  keys = src->keys ? g_hash_table_ref (src->keys) : NULL;
+  g_mutex_unlock (&src->keys_lock);
+
+  if (!keys)
+    return TRUE;
+
+  ret = stream_key && g_hash_table_contains (keys, stream_key);
+  g_hash_table_unref (keys);
+
+  return ret;
+}
+
+/* Key table of the non-empty lines of keys, surrounding whitespace
+ * stripped. With comments, lines starting with '#' are skipped. */
+static GHashTable *
+rtmp2_stream_keys_new (const gchar * const *keys, gboolean comments)
+{
+  GHashTable *table = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+      NULL);
+
+  for (; keys && *keys; keys++) {
+    gchar *key = g_strstrip (g_strdup (*keys));
+
+    if (*key && !(comments && *key == '#'))
+      g_hash_table_add (table, key);
+    else
+      g_free (key);
+  }
+
+  return table;
+}
+
+/* Swap in a new key table, NULL allows any key. Publishers looking up
+ * the old table meanwhile keep their reference. */
+static void
+gst_rtmp2_server_src_set_keys (GstRtmp2ServerSrc *src, GHashTable *keys)
+{
+  GHashTable *old;
+
+  g_mutex_lock (&src->keys_lock);
+  old = src->keys;
+  src->keys = keys;
+  g_mutex_unlock (&src->keys_lock);
+
+  if (old)
+    g_hash_table_unref (old);
+}
+
+/* Load the key table from stream-keys-file, one key per line. The current
+ * table stays if the file can't be read. */
+static gboolean
+gst_rtmp2_server_src_load_keys (GstRtmp2ServerSrc *src)
+{
+  GError *error = NULL;
+  GHashTable *keys;
+  gchar *path, *contents;
+  gchar **lines;
+
+  GST_OBJECT_LOCK (src);
+  path = g_strdup (src->stream_keys_file);
+  GST_OBJECT_UNLOCK (src);
+
+  if (!path)
+    return FALSE;
+
+  if (!g_file_get_contents (path, &contents, NULL, &error)) {
+    GST_WARNING_OBJECT (src, "Failed to read stream keys from %s: %s", path,
+        error->message);
+    g_clear_error (&error);
+    g_free (path);
+    return FALSE;
+  }
+
+  lines = g_strsplit (contents, "\n", -1);
+  keys = rtmp2_stream_keys_new ((const gchar * const *) lines, TRUE);
+  g_strfreev (lines);
+  g_free (contents);
+
+  GST_INFO_OBJECT (src, "Loaded %u stream keys from %s",
+      g_hash_table_size (keys), path);
+  g_free (path);
+
+  gst_rtmp2_server_src_set_keys (src, keys);
+
+  return TRUE;
+}
+
+static gboolean
+gst_rtmp2_server_src_reload_stream_keys (GstRtmp2ServerSrc *src)
+{
+  return gst_rtmp2_server_src_load_keys (src);
+}
+
+/* Multi-stream mode: route a publisher to the output of its application
+ * and stream key, creating the output and its pad on first use. With loop
+ * the publisher may wait for the current one of its stream key, otherwise
+ * it is refused while that stream is live. Returns FALSE if refused. */
+static gboolean
+gst_rtmp2_server_src_route_session (GstRtmp2ServerSrc *src,
+    ServerSession *session)
+{
+  Rtmp2ServerSrcOutput *output;
+  gchar *name;
+
+  name = g_strdup_printf ("%s/%s", session->app_name ? session->app_name : "",
+      session->stream_key ? session->stream_key : "");
+
+  /* Publishers on different event loop threads may race for the same
+   * stream key, only one of them creates its output */
+  g_mutex_lock (&src->route_lock);
+
+  g_rw_lock_writer_lock (&src->sessions_lock);
+  output = g_hash_table_lookup (src->outputs, name);
+  if (output) {
+    if (output->session && !src->loop) {
+      g_rw_lock_writer_unlock (&src->sessions_lock);
+      g_mutex_unlock (&src->route_lock);
+      GST_WARNING_OBJECT (src, "Stream %s is already being published, "
+          "refusing the new publisher", name);
+      g_free (name);
+      return FALSE;
+    }
+
+    server_registry_publish_locked (src, session, output);
+    g_rw_lock_writer_unlock (&src->sessions_lock);
+    g_mutex_unlock (&src->route_lock);
+
+    GST_INFO_OBJECT (src, "Routed publisher to existing stream %s", name);
+    g_free (name);
+    gst_rtmp2_server_src_wakeup_full (output, FALSE);
+    return TRUE;
+  }
+  g_rw_lock_writer_unlock (&src->sessions_lock);
+
+  {
+    gchar *base_name = g_strdup_printf ("src_%s", name);
+    gchar *pad_name;
+    GstPad *existing;
+
+    g_strcanon (base_name + 4, G_CSET_A_2_Z G_CSET_a_2_z G_CSET_DIGITS "_-",
+        '_');
+    pad_name = g_strdup (base_name);
+
+    /* Keys mapping to the same pad name, or to the name with a suffix
+     * another one got */
+    while ((existing = gst_element_get_static_pad (GST_ELEMENT (src),
+                pad_name))) {
+      gst_object_unref (existing);
+      g_free (pad_name);
+      pad_name = g_strdup_printf ("%s_%u", base_name, src->stream_pad_count++);
+    }
+    g_free (base_name);
+
+    output = server_output_new (src, name, pad_name);
+    g_free (pad_name);
+  }
+
+  /* Only FLV, the elementary pads are named per element, not per stream */
+  output->mode = GST_RTMP2_SERVER_SRC_OUTPUT_FLV;
+
+  gst_pad_set_active (output->srcpad, TRUE);
+  if (!gst_element_add_pad (GST_ELEMENT (src), output->srcpad)) {
+    g_mutex_unlock (&src->route_lock);
+    GST_WARNING_OBJECT (src, "Could not add pad %s for stream %s, refusing "
+        "the publisher", GST_PAD_NAME (output->srcpad), name);
+    gst_pad_set_active (output->srcpad, FALSE);
+    server_output_free (output);
+    g_free (name);
+    return FALSE;
+  }
+
+  gst_element_post_message (GST_ELEMENT (src),
+      gst_message_new_element (GST_OBJECT (src),
+          gst_structure_new ("rtmp2server-stream-added",
+              "pad-name", G_TYPE_STRING, GST_PAD_NAME (output->srcpad),
+              "application", G_TYPE_STRING, session->app_name,
+              "stream-key", G_TYPE_STRING, session->stream_key, NULL)));
+
+  g_rw_lock_writer_lock (&src->sessions_lock);
+  g_hash_table_insert (src->outputs, output->name, output);
+  server_registry_publish_locked (src, session, output);
+  if (src->playing)
+    server_output_start (output);
+  g_rw_lock_writer_unlock (&src->sessions_lock);
+  g_mutex_unlock (&src->route_lock);
+
+  GST_INFO_OBJECT (src, "New stream %s on pad %s", name,
+      GST_PAD_NAME (output->srcpad));
+  g_free (name);
+
+  return TRUE;
+}
+
+/* Move a session that did not publish yet over to another element */
+static void
+server_session_move (ServerSession *session, GstRtmp2ServerSrc *to)
+{
+  GstRtmp2ServerSrc *from = session->src;
+
+  g_rw_lock_writer_lock (&from->sessions_lock);
+  server_registry_remove_locked (from, session);
+  g_rw_lock_writer_unlock (&from->sessions_lock);
+
+  /* Its queue is allocated by the new element once it publishes */
+  session->src = to;
+
+  /* Still shaking hands, the new element counts it from now on */
+  if (!session->connection) {
+    g_atomic_int_add (&from->n_handshakes, -1);
+    g_atomic_int_inc (&to->n_handshakes);
+  }
+
+  g_rw_lock_writer_lock (&to->sessions_lock);
+  server_registry_add_locked (to, session);
+  g_rw_lock_writer_unlock (&to->sessions_lock);
+}
+
+/* How well the application and stream-key of an element match a
+ * publisher, -1 if they don't. An explicit stream key beats a wildcard. */
+static gint
+gst_rtmp2_server_src_match (GstRtmp2ServerSrc *src, const gchar *app,
+    const gchar *stream_key)
+{
+  gint score = 0;
+
+  if (src->application && *src->application) {
+    if (g_strcmp0 (src->application, app) != 0)
+      return -1;
+    score += 1;
+  }
+
+  if (src->stream_key && *src->stream_key) {
+    if (g_strcmp0 (src->stream_key, stream_key) != 0)
+      return -1;
+    score += 2;
+  }
+
+  return score;
+}
+
+/* Element of the listener to hand a publisher to, NULL if none matches.
+ * An element alone on its port is no exception. */
+static GstRtmp2ServerSrc *
+rtmp2_server_listener_find_consumer (Rtmp2ServerListener *listener,
+    const gchar *app, const gchar *stream_key)
+{
+  GstRtmp2ServerSrc *best = NULL;
+  gint best_score = -1;
+  GList *l;
+
+  g_mutex_lock (&listeners_lock);
+  for (l = listener->consumers; l; l = l->next) {
+    gint score = gst_rtmp2_server_src_match (l->data, app, stream_key);
+
+    if (score > best_score) {
+      best = l->data;
+      best_score = score;
+    }
+  }
+  g_mutex_unlock (&listeners_lock);
+
+  return best;
+}
+
+/* On publish, hand the session over to the element consuming its
+ * application and stream key, then make it publish to that element's
+ * output. Returns FALSE with the onStatus code and description to send
+ * if the session is refused. */
+static gboolean
+gst_rtmp2_server_src_dispatch_session (ServerSession *session,
+    const gchar **code, const gchar **description)
+{
+  GstRtmp2ServerSrc *src = session->src;
+  GstRtmp2ServerSrc *target;
+
+  /* Elements leave the listener on every event loop thread in turn, so
+   * target stays valid during this callback */
+  target = rtmp2_server_listener_find_consumer (src->listener,
+      session->app_name, session->stream_key);
+  if (!target) {
+    GST_WARNING_OBJECT (src, "No element consumes app=%s stream=%s, "
+        "refusing the publisher", GST_STR_NULL (session->app_name),
+        GST_STR_NULL (session->stream_key));
+    *code = "NetStream.Publish.BadName";
+    *description = "No such stream.";
+    return FALSE;
+  }
+
+  if (!gst_rtmp2_server_src_authorize (target, session->stream_key)) {
+    GST_WARNING_OBJECT (target, "Stream key of app=%s is not authorized, "
+        "refusing the publisher", GST_STR_NULL (session->app_name));
+    g_atomic_int_inc (&target->auth_rejected);
+    *code = "NetStream.Publish.BadName";
+    *description = "Stream key not authorized.";
+    return FALSE;
+  }
+
+  if (target != src) {
+    GST_INFO_OBJECT (src, "Handing stream %s/%s over to %" GST_PTR_FORMAT,
+        GST_STR_NULL (session->app_name), GST_STR_NULL (session->stream_key),
+        target);
+    server_session_move (session, target);
+    src = target;
+  }
+
+  if (src->multi_stream) {
+    if (!gst_rtmp2_server_src_route_session (src, session)) {
+      *code = "NetStream.Publish.BadName";
+      *description = "Stream already publishing.";
+      return FALSE;
+    }
+    return TRUE;
+  }
+
+  g_rw_lock_writer_lock (&src->sessions_lock);
+  server_registry_publish_locked (src, session, src->output);
+  g_rw_lock_writer_unlock (&src->sessions_lock);
+
+  /* A direct-push output starts pushing with the first tag */
+  gst_rtmp2_server_src_wakeup_full (src->output, FALSE);
+
+  return TRUE;
+}
+
+/* Transaction ID of the command being handled, approximated.
+ * GstRtmpConnection doesn't hand it to expected command callbacks, so
+ * follow the counter of the client: connect is 1 and each further command
+ * takes the next one, whether or not the client waits for the results.
+ * This only holds as long as every command a client sends is registered
+ * and counted, see server_session_counted_commands. */
+static gdouble
+server_session_next_transaction (ServerSession *session)
+{
+  return ++session->transactions;
+}
+
+/* Expected commands are called once, register the handler again so that
+ * a command sent a second time is still answered and counted */
+static void
+server_session_expect_again (ServerSession *session,
+    GstRtmpCommandCallback callback, guint32 stream_id,
+    const gchar *command_name)
+{
+  gst_rtmp_connection_expect_command (session->connection, callback, session,
+      stream_id, command_name);
+}
+
+/* Command handlers */
+static void
+on_connect_command (const gchar *command_name, GPtrArray *args, gpointer user_data)
+{
+  ServerSession *session = user_data;
+  const GstAmfNode *command_obj;
+  gdouble transaction_id = server_session_next_transaction (session);
+
+  GST_DEBUG ("Received connect command");
+
+  if (args && args->len > 0) {
+    command_obj = g_ptr_array_index (args, 0);
+    gst_rtmp_enhanced_caps_parse (command_obj, &session->enhanced_caps);
+
+    /* Extract app name */
+    const GstAmfNode *app_node = gst_amf_node_get_field (command_obj, "app");
+    if (app_node && gst_amf_node_get_type (app_node) == GST_AMF_TYPE_STRING) {
+      g_free (session->app_name);
+      session->app_name = gst_amf_node_get_string (app_node, NULL);
+    }
+  }
+
+  /* Connection parameters, then the connect result */
+  gst_rtmp_server_send_connect_setup (session->connection,
+      session->src->window_ack_size, session->src->peer_bandwidth,
+      session->src->chunk_size);
+  gst_rtmp_server_send_connect_result (session->connection, transaction_id,
+      &session->enhanced_caps);
+
+  session->state = SERVER_SESSION_STATE_CONNECTED;
+  GST_INFO ("Client connected, app=%s", session->app_name ? session->app_name : "");
+}
+
+static void
+on_create_stream_command (const gchar *command_name, GPtrArray *args, gpointer user_data)
+{
+  ServerSession *session = user_data;
+  gdouble transaction_id = server_session_next_transaction (session);
+  
+  GST_DEBUG ("Received createStream command");
+
+  /* Send createStream result with stream ID 1 */
+  gst_rtmp_server_send_create_stream_result (session->connection, transaction_id, session->stream_id);
+  GST_INFO ("Sent createStream result with stream_id=%u", session->stream_id);
+
+  server_session_expect_again (session, on_create_stream_command, 0,
+      command_name);
+}
+
+static void
+on_release_stream_command (const gchar *command_name, GPtrArray *args, gpointer user_data)
+{
+  ServerSession *session = user_data;
+  gdouble transaction_id = server_session_next_transaction (session);
+
+  GST_INFO ("Received releaseStream command");
+
+  /* Send _result response to acknowledge */
+  gst_rtmp_server_send_release_stream_result (session->connection, transaction_id);
+  GST_INFO ("Sent releaseStream result");
+
+  server_session_expect_again (session, on_release_stream_command, 0,
+      command_name);
+}
+
+static void
+on_fcpublish_command (const gchar *command_name, GPtrArray *args, gpointer user_data)
+{
+  ServerSession *session = user_data;
+  gdouble transaction_id = server_session_next_transaction (session);
+
+  GST_INFO ("Received FCPublish command");
+
+  /* Send _result to acknowledge - some clients wait for this */
+  gst_rtmp_server_send_fcpublish_result (session->connection, transaction_id);
+  GST_INFO ("Sent FCPublish result");
+
+  server_session_expect_again (session, on_fcpublish_command, 0,
+      command_name);
+}
+
+/* Stream 0 commands publishers send around the ones the server acts on.
+ * They are only counted, those the client may wait for get an empty
+ * _result. */
+static const struct {
+  const gchar *name;
+  gboolean answer;
+} server_session_counted_commands[] = {
+  {"_checkbw", TRUE},
+  {"getStreamLength", TRUE},
+  {"FCUnpublish", TRUE},
+  {"deleteStream", FALSE},
+  {"closeStream", FALSE},
+};
+
+static void
+on_counted_command (const gchar *command_name, GPtrArray *args,
+    gpointer user_data)
+{
+  ServerSession *session = user_data;
+  gdouble transaction_id = server_session_next_transaction (session);
+  guint i;
+
+  GST_DEBUG ("Received %s command", command_name);
+
+  for (i = 0; i < G_N_ELEMENTS (server_session_counted_commands); i++) {
+    if (g_str_equal (command_name, server_session_counted_commands[i].name)) {
+      if (server_session_counted_commands[i].answer)
+        gst_rtmp_server_send_result (session->connection, command_name,
+            transaction_id);
+      break;
+    }
+  }
+
+  server_session_expect_again (session, on_counted_command, 0, command_name);
+}
+
+static void
+on_publish_command (const gchar *command_name, GPtrArray *args, gpointer user_data)
+{
+  ServerSession *session = user_data;
+  const gchar *code, *description;
+
+  /* Answered by onStatus, but clients count it like any other command */
+  server_session_next_transaction (session);
+
+  GST_DEBUG ("Received publish command");
+
+  /* Refused already, waiting to be closed */
+  if (session->state == SERVER_SESSION_STATE_DISCONNECTED)
+    return;
+
+  if (args && args->len > 0) {
+    const GstAmfNode *stream_name = g_ptr_array_index (args, 0);
+    if (stream_name && gst_amf_node_get_type (stream_name) == GST_AMF_TYPE_STRING) {
+      g_free (session->stream_key);
+      session->stream_key = gst_amf_node_get_string (stream_name, NULL);
+    }
+  }
+
+  if (!gst_rtmp2_server_src_dispatch_session (session, &code,
+          &description)) {
+    server_session_reject (session, code, description);
+    return;
+  }
+
+  /* Send publish start */
+  gst_rtmp_server_send_publish_start (session->connection, session->stream_id);
+
+  session->state = SERVER_SESSION_STATE_PUBLISHING;
+
+  /* From now on it has to keep sending media, to the element it went to */
+  session->last_activity = g_get_monotonic_time ();
+  server_session_arm_timeout (session, session->src->timeout);
+  GST_INFO ("Client publishing, stream=%s", session->stream_key ? session->stream_key : "");
+}
+
+/* The client is gone or dropped, on the event loop thread */
+static void
+server_session_disconnect (ServerSession *session)
+{
+  server_session_cancel_timeout (session);
+  session->state = SERVER_SESSION_STATE_DISCONNECTED;
+  server_session_leave_loop (session);
+
+  /* Nothing to drain for a client that never published */
+  if (!session->output) {
+    server_session_discard (session);
+    return;
+  }
+
+  /* Let the streaming task drain the queue and handle EOS */
+  gst_rtmp2_server_src_wakeup (session->output);
+}
+
+/* Drop the client ourselves */
+static void
+server_session_close (ServerSession *session)
+{
+  /* Closing may report an error on the connection already */
+  gst_rtmp_connection_close (session->connection);
+  if (session->state != SERVER_SESSION_STATE_DISCONNECTED)
+    server_session_disconnect (session);
+}
+
+/* Whether the queue and GOP cache of a session exceed max-session-bytes,
+ * on the event loop thread that fills them */
+static gboolean
+server_session_over_budget (ServerSession *session)
+{
+  ServerSessionMedia *media = session->media;
+  guint max = session->src->max_session_bytes;
+
+  return max > 0 && rtmp2_flv_tag_ring_get_bytes (&media->tag_ring) +
+      media->gop_bytes > max;
+}
+
+/* Media message handler */
+static void
+on_media_message (GstRtmpConnection *connection, GstBuffer *buffer, gpointer user_data)
+{
+  ServerSession *session = user_data;
+  GstRtmpMeta *meta;
+  Rtmp2FlvTag tag = { 0, };
+  GstMapInfo map;
+  GstClockTime dts;
+  guint32 timestamp_ms;
+
+  /* Not publishing to any output yet, or dropped */
+  if (!session->output ||
+      session->state == SERVER_SESSION_STATE_DISCONNECTED)
+    return;
+
+  session->last_activity = g_get_monotonic_time ();
+
+  meta = gst_buffer_get_rtmp_meta (buffer);
+  if (!meta) {
+    GST_DEBUG ("Media message without RTMP meta");
+    return;
+  }
+
+  /* Each message of an aggregate comes back here as a sub-buffer */
+  if (meta->type == GST_RTMP_MESSAGE_TYPE_AGGREGATE) {
+    gst_rtmp_server_foreach_aggregate (connection, buffer, on_media_message,
+        session);
+    return;
+  }
+
+  /* The absolute timestamp is the buffer DTS, set by rtmpchunkstream.
+   * ts_delta is only the delta to the previous message. */
+  dts = GST_BUFFER_DTS (buffer);
+  if (!GST_CLOCK_TIME_IS_VALID (dts)) {
+    GST_WARNING ("Media message without timestamp, dropping it");
+    return;
+  }
+  timestamp_ms = (guint32) (dts / GST_MSECOND);
+
+  GST_LOG ("Received media message type=%d dts=%" GST_TIME_FORMAT " timestamp_ms=%u size=%" G_GSIZE_FORMAT,
+      meta->type, GST_TIME_ARGS(dts), timestamp_ms, gst_buffer_get_size (buffer));
+
+  /* Only process video, audio and data messages */
+  if (meta->type != GST_RTMP_MESSAGE_TYPE_VIDEO &&
+      meta->type != GST_RTMP_MESSAGE_TYPE_AUDIO &&
+      meta->type != GST_RTMP_MESSAGE_TYPE_DATA_AMF0) {
+    return;
+  }
+
+  /* Create FLV tag from RTMP message */
+  if (meta->type == GST_RTMP_MESSAGE_TYPE_VIDEO) {
+    tag.tag_type = RTMP2_FLV_TAG_VIDEO;
+  } else if (meta->type == GST_RTMP_MESSAGE_TYPE_AUDIO) {
+    tag.tag_type = RTMP2_FLV_TAG_AUDIO;
+  } else {
+    tag.tag_type = RTMP2_FLV_TAG_SCRIPT;
+  }
+
+  /* Use absolute timestamp from buffer DTS */
+  tag.timestamp = timestamp_ms;
+  tag.arrival_time = g_get_monotonic_time ();
+  tag.data_size = gst_buffer_get_size (buffer);
+
+  /* Parse video/audio codec info from the tag body header */
+  if (gst_buffer_map (buffer, &map, GST_MAP_READ)) {
+    rtmp2_flv_tag_parse_header (&tag, map.data, map.size);
+    gst_buffer_unmap (buffer, &map);
+  }
+
+  GST_LOG ("Queueing %s tag, timestamp=%u, size=%u",
+      tag.tag_type == RTMP2_FLV_TAG_VIDEO ? "video" :
+      tag.tag_type == RTMP2_FLV_TAG_AUDIO ? "audio" : "data",
+      tag.timestamp, tag.data_size);
+
+  tag.data = gst_buffer_ref (buffer);
+  tag.seqnum = ++session->media->next_seqnum;
+  server_session_gop_cache_add (session, &tag);
+
+  if (gst_rtmp2_server_src_direct_push (session, &tag))
+    return;
+
+  /* Queue the tag */
+  server_session_enqueue (session, &tag);
+
+  if (server_session_over_budget (session)) {
+    GST_WARNING_OBJECT (session->src, "Session exceeds max-session-bytes "
+        "(%u bytes), disconnecting it", session->src->max_session_bytes);
+    g_atomic_int_inc (&session->src->over_budget);
+    server_session_close (session);
+    return;
+  }
+
+  /* Stop reading while the streaming task catches up */
+  server_session_throttle (session);
+
+  gst_rtmp2_server_src_wakeup (session->output);
+}
+
+/* Connection error handler */
+static void
+on_connection_error (GstRtmpConnection *connection, GError *error, gpointer user_data)
+{
+  ServerSession *session = user_data;
+
+  if (session->state == SERVER_SESSION_STATE_DISCONNECTED)
+    return;
+  
+  GST_WARNING ("Connection error: %s", error->message);
+  server_session_disconnect (session);
+}
+
+/* Timer wheel expiry: the handshake, the wait for publish or the media
+ * took too long */
+static void
+server_session_expire (ServerSession *session)
+{
+  GstRtmp2ServerSrc *src = session->src;
+
+  /* Handshaking, on_handshake_done() frees it once cancelled */
+  if (!session->connection) {
+    GST_WARNING_OBJECT (src, "Handshake timed out");
+    g_atomic_int_inc (&src->timed_out);
+    g_cancellable_cancel (session->cancellable);
+    return;
+  }
+
+  if (session->state == SERVER_SESSION_STATE_DISCONNECTED)
+    return;
+
+  if (session->state == SERVER_SESSION_STATE_PUBLISHING) {
+    gint64 idle = g_get_monotonic_time () - session->last_activity;
+
+    /* Nothing is read while throttled, that's not the publisher's fault */
+    if (g_atomic_int_get (&session->media->throttled)) {
+      server_session_arm_timeout (session, src->timeout);
+      return;
+    }
+
+    /* Media arrived since it was armed, wait for the rest of the timeout */
+    if (idle < (gint64) src->timeout * G_TIME_SPAN_SECOND) {
+      server_session_arm_timeout (session,
+          src->timeout - idle / G_TIME_SPAN_SECOND);
+      return;
+    }
+
+    GST_WARNING_OBJECT (src, "No media from the publisher for %u s, "
+        "disconnecting it", src->timeout);
+  } else {
+    GST_WARNING_OBJECT (src, "Client didn't publish within %u s, "
+        "disconnecting it", src->publish_timeout);
+  }
+
+  g_atomic_int_inc (&src->timed_out);
+  server_session_close (session);
+}
+
+/* Handshake complete callback */
+static void
+on_handshake_done (GObject *source, GAsyncResult *result, gpointer user_data)
+{
+  GIOStream *stream = G_IO_STREAM (source);
+  ServerSession *session = user_data;
+  GstRtmp2ServerSrc *src = session->src;
+  GError *error = NULL;
+  gboolean success;
+  guint i;
+
+  success = gst_rtmp_server_handshake_finish (stream, result, &error);
+  if (!success) {
+    GST_WARNING_OBJECT (src, "Handshake failed: %s", error->message);
+    g_error_free (error);
+    
+    g_rw_lock_writer_lock (&src->sessions_lock);
+    server_registry_remove_locked (src, session);
+    g_rw_lock_writer_unlock (&src->sessions_lock);
+    
+    server_session_free (session);
+    return;
+  }
+
+  GST_INFO_OBJECT (src, "Handshake completed");
+  g_atomic_int_add (&src->n_handshakes, -1);
+  g_clear_object (&session->cancellable);
+
+  /* Now it has to publish in time */
+  server_session_arm_timeout (session, src->publish_timeout);
+
+  /* Create GstRtmpConnection from socket connection we stored earlier. In
+   * lossless mode it reads through a stream that can pause. */
+  if (src->high_watermark > 0) {
+    session->pausable =
+        rtmp2_pausable_connection_new (session->socket_connection);
+    session->connection =
+        gst_rtmp_connection_new (G_SOCKET_CONNECTION (session->pausable),
+        NULL);
+  } else {
+    session->connection =
+        gst_rtmp_connection_new (session->socket_connection, NULL);
+  }
+
+  /* Set up message handlers */
+  gst_rtmp_connection_set_input_handler (session->connection,
+      on_media_message, session, NULL);
+
+  g_signal_connect (session->connection, "error",
+      G_CALLBACK (on_connection_error), session);
+
+  GST_INFO ("Setting up expected commands");
+
+  /* Expect connect command */
+  gst_rtmp_connection_expect_command (session->connection,
+      on_connect_command, session, 0, "connect");
+
+  /* Also expect releaseStream, FCPublish, createStream and publish 
+   * Note: These all come on stream 0, and publish comes on stream 1 */
+  gst_rtmp_connection_expect_command (session->connection,
+      on_release_stream_command, session, 0, "releaseStream");
+  gst_rtmp_connection_expect_command (session->connection,
+      on_fcpublish_command, session, 0, "FCPublish");
+  gst_rtmp_connection_expect_command (session->connection,
+      on_create_stream_command, session, 0, "createStream");
+  gst_rtmp_connection_expect_command (session->connection,
+      on_publish_command, session, 1, "publish");
+
+  /* The rest only keeps the transaction IDs in step */
+  for (i = 0; i < G_N_ELEMENTS (server_session_counted_commands); i++)
+    gst_rtmp_connection_expect_command (session->connection,
+        on_counted_command, session, 0,
+        server_session_counted_commands[i].name);
+
+  GST_INFO ("All expected commands registered");
+
+  /* The session becomes active once it publishes */
+}
+
+/* Incoming connection handler */
+static gboolean
+on_incoming_connection (GSocketService *service, GSocketConnection *connection,
+    GObject *source_object, gpointer user_data)
+{
+  Rtmp2ServerLoop *loop = user_data;
+  Rtmp2ServerListener *listener = loop->listener;
+  GstRtmp2ServerSrc *src = NULL;
+  ServerSession *session;
+  GIOStream *stream;
+  guint connections = 0, handshakes = 0;
+  GList *l;
+
+  /* The first element owns the session until its publish command tells
+   * which element it is for. Its limits apply to the whole port. */
+  g_mutex_lock (&listeners_lock);
+  if (listener->consumers)
+    src = listener->consumers->data;
+  for (l = listener->consumers; l; l = l->next) {
+    GstRtmp2ServerSrc *consumer = l->data;
+
+    connections += g_atomic_int_get (&consumer->n_sessions);
+    handshakes += g_atomic_int_get (&consumer->n_handshakes);
+  }
+  g_mutex_unlock (&listeners_lock);
+
+  if (!src)
+    return FALSE;
+
+  if ((src->max_connections > 0 && connections >= src->max_connections) ||
+      (src->max_pending_handshakes > 0 &&
+          handshakes >= src->max_pending_handshakes)) {
+    GST_WARNING_OBJECT (src, "Refusing connection, %u connected and %u "
+        "shaking hands", connections, handshakes);
+    g_atomic_int_inc (&src->refused_connections);
+    g_io_stream_close (G_IO_STREAM (connection), NULL, NULL);
+    return TRUE;
+  }
+
+  GST_INFO_OBJECT (src, "New incoming connection on event loop %u",
+      loop->index);
+
+  session = server_session_new (src, connection);
+  session->loop = loop;
+  g_atomic_int_inc (&loop->n_sessions);
+  session->context = loop->context;
+  session->wheel = &loop->wheel;
+  g_atomic_int_inc (&src->n_handshakes);
+  server_session_arm_timeout (session, src->handshake_timeout);
+  
+  g_rw_lock_writer_lock (&src->sessions_lock);
+  server_registry_add_locked (src, session);
+  g_rw_lock_writer_unlock (&src->sessions_lock);
+
+  /* Start server handshake */
+  stream = G_IO_STREAM (connection);
+  gst_rtmp_server_handshake (stream, FALSE, session->cancellable,
+      on_handshake_done, session);
+
+  return TRUE;
+}
+
+/* Running time of the pipeline clock when a tag arrived, or
+ * GST_CLOCK_TIME_NONE without a clock */
+static GstClockTime
+gst_rtmp2_server_src_get_arrival_running_time (GstRtmp2ServerSrc *src,
+    gint64 arrival_time)
+{
+  GstClock *clock;
+  GstClockTime base_time, now, waited;
+
+  clock = gst_element_get_clock (GST_ELEMENT (src));
+  if (!clock)
+    return GST_CLOCK_TIME_NONE;
+
+  base_time = gst_element_get_base_time (GST_ELEMENT (src));
+  now = gst_clock_get_time (clock);
+  gst_object_unref (clock);
+
+  /* Go back from the current clock time by the time the tag waited, the
+   * pipeline clock need not be the monotonic clock */
+  waited = MAX (g_get_monotonic_time () - arrival_time, 0) * GST_USECOND;
+  if (now < base_time + waited)
+    return 0;
+
+  return now - base_time - waited;
+}
+
+/* Output timeline in milliseconds, continuing across seamless session
+ * switches. FLV tags are rewritten onto it, elementary pads get a segment
+ * mapping onto it instead. */
+static guint32
+gst_rtmp2_server_src_get_output_time (Rtmp2ServerSrcOutput *output,
+    guint32 timestamp)
+{
+  if ((gint32) (timestamp - output->out_start_ms) < 0)
+    return output->out_base_ms;
+
+  return timestamp - output->out_start_ms + output->out_base_ms;
+}
+
+/* Remember how far output got and the video frame duration, to continue
+ * the timeline after a switch. Called with the push lock held. */
+static void
+gst_rtmp2_server_src_track_position (Rtmp2ServerSrcOutput *output,
+    const Rtmp2FlvTag *tag)
+{
+  guint32 position = tag->timestamp;
+
+  if (output->mode == GST_RTMP2_SERVER_SRC_OUTPUT_ELEMENTARY)
+    position = gst_rtmp2_server_src_get_output_time (output, tag->timestamp);
+
+  if (tag->tag_type == RTMP2_FLV_TAG_VIDEO && !tag->sequence_header) {
+    output->have_video = TRUE;
+    if (output->out_last_video_ms &&
+        (gint32) (position - output->out_last_video_ms) > 0)
+      output->out_frame_ms = MIN (position - output->out_last_video_ms, 1000);
+    output->out_last_video_ms = position;
+  } else if (tag->tag_type == RTMP2_FLV_TAG_AUDIO) {
+    output->have_audio = TRUE;
+  }
+
+  if ((gint32) (position - output->out_position_ms) > 0)
+    output->out_position_ms = position;
+}
+
+/* Timestamps and flags of an output buffer. The RTMP timestamp is the
+ * decoding time, refined by an E-RTMP nanosecond offset, and AVC/HEVC
+ * frames add their composition time offset. With do-timestamp the arrival
+ * time on the pipeline clock replaces it. */
+static void
+gst_rtmp2_server_src_set_buffer_info (Rtmp2ServerSrcOutput *output,
+    GstBuffer *buffer, const Rtmp2FlvTag *tag)
+{
+  GstRtmp2ServerSrc *src = output->src;
+  GstClockTime dts = tag->timestamp * GST_MSECOND + tag->timestamp_offset_ns;
+  GstClockTimeDiff cts = tag->composition_time * GST_MSECOND;
+
+  if (src->do_timestamp && tag->arrival_time > 0) {
+    GstClockTime running_time =
+        gst_rtmp2_server_src_get_arrival_running_time (src, tag->arrival_time);
+
+    if (GST_CLOCK_TIME_IS_VALID (running_time))
+      dts = running_time;
+  }
+
+  GST_BUFFER_DTS (buffer) = dts;
+  GST_BUFFER_PTS (buffer) = cts < 0 && (GstClockTime) -cts > dts ? 0 :
+      dts + cts;
+
+  gst_rtmp2_server_src_track_position (output, tag);
+
+  if (rtmp2_flv_tag_is_header (tag))
+    GST_BUFFER_FLAG_SET (buffer, GST_BUFFER_FLAG_HEADER);
+  else if (tag->tag_type == RTMP2_FLV_TAG_VIDEO && !tag->video_keyframe)
+    GST_BUFFER_FLAG_SET (buffer, GST_BUFFER_FLAG_DELTA_UNIT);
+}
+
+/* Wrap a tag into an output buffer */
+static GstBuffer *
+gst_rtmp2_server_src_tag_to_buffer (Rtmp2ServerSrcOutput *output,
+    Rtmp2FlvTag *tag)
+{
+  GstBuffer *buffer;
+  Rtmp2FlvTag out = *tag;
+
+  /* Keep FLV timestamps continuous across seamless switches */
+  out.timestamp = gst_rtmp2_server_src_get_output_time (output, tag->timestamp);
+
+  /* Build FLV tag buffer around the payload, without copying it */
+  buffer = rtmp2_flv_tag_to_buffer (&out);
+  if (!buffer)
+    return NULL;
+
+  gst_rtmp2_server_src_set_buffer_info (output, buffer, &out);
+
+  return buffer;
+}
+
+/* Whether the session queue exceeds any of the configured limits */
+static gboolean
+gst_rtmp2_server_src_queue_over_limits (GstRtmp2ServerSrc *src,
+    ServerSession *session)
+{
+  Rtmp2FlvTagRing *ring = &session->media->tag_ring;
+  const Rtmp2FlvTag *first, *last;
+
+  if (src->max_queue_bytes > 0 &&
+      rtmp2_flv_tag_ring_get_bytes (ring) > src->max_queue_bytes)
+    return TRUE;
+
+  if (src->max_queue_time == 0 && src->max_latency == 0)
+    return FALSE;
+
+  first = rtmp2_flv_tag_ring_peek (ring, 0);
+  if (!first)
+    return FALSE;
+
+  if (src->max_latency > 0 && first->arrival_time > 0 &&
+      (g_get_monotonic_time () - first->arrival_time) * GST_USECOND >
+      src->max_latency)
+    return TRUE;
+
+  if (src->max_queue_time > 0) {
+    last = rtmp2_flv_tag_ring_peek (ring, rtmp2_flv_tag_ring_get_level (ring) - 1);
+    if (last && (gint32) (last->timestamp - first->timestamp) > 0 &&
+        (last->timestamp - first->timestamp) * GST_MSECOND >
+        src->max_queue_time)
+      return TRUE;
+  }
+
+  return FALSE;
+}
+
+/* Index of the newest queued video keyframe, or -1 */
+static gint
+server_session_find_last_keyframe (ServerSession *session)
+{
+  ServerSessionMedia *media = session->media;
+  const Rtmp2FlvTag *queued;
+  gint i;
+
+  for (i = rtmp2_flv_tag_ring_get_level (&media->tag_ring) - 1; i >= 0; i--) {
+    queued = rtmp2_flv_tag_ring_peek (&media->tag_ring, i);
+    if (queued->tag_type == RTMP2_FLV_TAG_VIDEO && queued->video_keyframe &&
+        !queued->sequence_header)
+      return i;
+  }
+
+  return -1;
+}
+
+static void
+gst_rtmp2_server_src_post_dropped (GstRtmp2ServerSrc *src,
+    ServerSession *session)
+{
+  ServerSessionMedia *media = session->media;
+  GstStructure *s = gst_structure_new ("rtmp2server-dropped",
+      "policy", GST_TYPE_RTMP2_SERVER_SRC_LEAKY, src->leaky,
+      "dropped-tags", G_TYPE_UINT, media->episode_drops,
+      "dropped-bytes", G_TYPE_UINT64, media->episode_drop_bytes,
+      "total-dropped", G_TYPE_UINT, media->leaky_drops,
+      NULL);
+
+  GST_INFO_OBJECT (src, "Dropped %u tags (%" G_GUINT64_FORMAT " bytes) to "
+      "honor the queue limits", media->episode_drops,
+      media->episode_drop_bytes);
+
+  gst_element_post_message (GST_ELEMENT (src),
+      gst_message_new_element (GST_OBJECT (src), s));
+
+  media->episode_drops = 0;
+  media->episode_drop_bytes = 0;
+}
+
+/* Pop the next tag to output, dropping queued tags on the way as the
+ * leaky policy asks for. Only called from the streaming task. */
+static gboolean
+gst_rtmp2_server_src_pop_tag (Rtmp2ServerSrcOutput *output,
+    ServerSession *session, Rtmp2FlvTag *tag)
+{
+  ServerSessionMedia *media = session->media;
+  GstRtmp2ServerSrc *src = output->src;
+  /* Lossless sessions are never dropped from */
+  GstRtmp2ServerSrcLeaky leaky = session->pausable ?
+      GST_RTMP2_SERVER_SRC_LEAKY_NONE : src->leaky;
+
+  while (TRUE) {
+    gboolean over = FALSE;
+    gboolean drop = FALSE;
+
+    if (leaky != GST_RTMP2_SERVER_SRC_LEAKY_NONE &&
+        (leaky == GST_RTMP2_SERVER_SRC_LEAKY_OLDEST ||
+            (!media->leaky_need_keyframe && media->leaky_skip == 0))) {
+      over = gst_rtmp2_server_src_queue_over_limits (src, session);
+
+      if (over && leaky == GST_RTMP2_SERVER_SRC_LEAKY_UNTIL_KEYFRAME) {
+        media->leaky_need_keyframe = TRUE;
+      } else if (over && leaky == GST_RTMP2_SERVER_SRC_LEAKY_GOP) {
+        gint keyframe = server_session_find_last_keyframe (session);
+
+        if (keyframe >= 0)
+          media->leaky_skip = keyframe;
+        else
+          media->leaky_need_keyframe = TRUE;
+      }
+    }
+
+    if (!rtmp2_flv_tag_ring_pop (&media->tag_ring, tag))
+      return FALSE;
+
+    /* Already pushed when replaying the GOP cache, or before the first
+     * keyframe after a switch */
+    if ((media->replay_seqnum &&
+            (gint32) (tag->seqnum - media->replay_seqnum) <= 0) ||
+        !gst_rtmp2_server_src_switch_resume (output, tag)) {
+      server_session_release_throttle (session);
+      rtmp2_flv_tag_clear (tag);
+      continue;
+    }
+
+    if (!rtmp2_flv_tag_is_header (tag)) {
+      if (over && leaky == GST_RTMP2_SERVER_SRC_LEAKY_OLDEST) {
+        drop = TRUE;
+      } else if (tag->tag_type == RTMP2_FLV_TAG_VIDEO) {
+        if (media->leaky_skip > 0) {
+          drop = TRUE;
+        } else if (media->leaky_need_keyframe) {
+          drop = !tag->video_keyframe;
+          media->leaky_need_keyframe = drop;
+        }
+      }
+    }
+
+    if (media->leaky_skip > 0)
+      media->leaky_skip--;
+
+    server_session_release_throttle (session);
+
+    if (!drop) {
+      if (media->episode_drops > 0 && media->leaky_skip == 0 &&
+          !media->leaky_need_keyframe)
+        gst_rtmp2_server_src_post_dropped (src, session);
+      return TRUE;
+    }
+
+    GST_LOG_OBJECT (src, "Leaky queue dropping %s tag, timestamp=%u",
+        tag->tag_type == RTMP2_FLV_TAG_VIDEO ? "video" : "audio",
+        tag->timestamp);
+
+    g_atomic_int_inc (&media->leaky_drops);
+    media->episode_drops++;
+    media->episode_drop_bytes += tag->data_size;
+    rtmp2_flv_tag_clear (tag);
+  }
+}
+
+/* Latency the queueing policy allows between the arrival of a tag and its
+ * push. Unbounded unless a leaky policy enforces a time limit. */
+static GstClockTime
+gst_rtmp2_server_src_get_queue_latency (GstRtmp2ServerSrc *src)
+{
+  if (src->leaky == GST_RTMP2_SERVER_SRC_LEAKY_NONE)
+    return 0;
+  if (src->max_latency > 0)
+    return src->max_latency;
+  return src->max_queue_time;
+}
+
+/* A new consumer needs the GOP cache to start decoding right away */
+static void
+gst_rtmp2_server_src_pad_linked (GstPad *pad, GstPad *peer,
+    Rtmp2ServerSrcOutput *output)
+{
+  GstRtmp2ServerSrc *src = output->src;
+  guint mask = REPLAY_ALL;
+
+  if (src->gop_cache_max_bytes == 0 ||
+      (pad == output->srcpad &&
+          output->mode != GST_RTMP2_SERVER_SRC_OUTPUT_FLV))
+    return;
+
+  if (output->video_pad.pad == pad)
+    mask = REPLAY_VIDEO;
+  else if (output->audio_pad.pad == pad)
+    mask = REPLAY_AUDIO;
+
+  GST_DEBUG_OBJECT (src, "%s:%s linked, replaying the GOP cache",
+      GST_DEBUG_PAD_NAME (pad));
+  g_atomic_int_or (&output->replay_pending, mask);
+  gst_rtmp2_server_src_wakeup (output);
+}
+
+static gboolean
+gst_rtmp2_server_src_query (GstPad *pad, GstObject *parent, GstQuery *query)
+{
+  GstRtmp2ServerSrc *src = GST_RTMP2_SERVER_SRC (parent);
+
+  switch (GST_QUERY_TYPE (query)) {
+    case GST_QUERY_LATENCY:{
+      GstClockTime min_latency = gst_rtmp2_server_src_get_queue_latency (src);
+
+      GST_DEBUG_OBJECT (src, "Reporting latency min %" GST_TIME_FORMAT,
+          GST_TIME_ARGS (min_latency));
+      gst_query_set_latency (query, TRUE, min_latency, GST_CLOCK_TIME_NONE);
+      return TRUE;
+    }
+    default:
+      return gst_pad_query_default (pad, parent, query);
+  }
+}
+
+/* Caps for the codec of a tag, with the configuration record of sequence
+ * headers as codec_data */
+static GstCaps *
+gst_rtmp2_server_src_tag_caps (Rtmp2FlvTag *tag)
+{
+  GstCaps *caps = rtmp2_flv_tag_get_caps (tag);
+  GstBuffer *codec_data;
+
+  if (!caps || !tag->sequence_header)
+    return caps;
+
+  codec_data = rtmp2_flv_tag_get_payload (tag);
+  if (codec_data) {
+    gst_caps_set_simple (caps, "codec_data", GST_TYPE_BUFFER, codec_data, NULL);
+    gst_buffer_unref (codec_data);
+  }
+
+  return caps;
+}
+
+/* Offset from the output timeline to the running time at which the
+ * stream started, so its first media tag is not late: running time now
+ * minus the timestamp of that tag. 0 when arrival times replace the
+ * timestamps, on byte segments or without a clock. */
+static GstClockTimeDiff
+gst_rtmp2_server_src_get_rebase (Rtmp2ServerSrcOutput *output,
+    guint32 first_timestamp)
+{
+  GstRtmp2ServerSrc *src = output->src;
+  GstClockTime now;
+
+  if (src->do_timestamp || (output->mode == GST_RTMP2_SERVER_SRC_OUTPUT_FLV &&
+          src->segment_format != GST_FORMAT_TIME))
+    return 0;
+
+  now = gst_rtmp2_server_src_get_arrival_running_time (src,
+      g_get_monotonic_time ());
+  if (!GST_CLOCK_TIME_IS_VALID (now))
+    return 0;
+
+  return GST_CLOCK_DIFF (first_timestamp * GST_MSECOND, now);
+}
+
+/* Shift a TIME segment by the rebase offset. Running time can't go below
+ * 0, so a negative offset moves the segment start instead. */
+static void
+gst_rtmp2_server_src_apply_rebase (Rtmp2ServerSrcOutput *output,
+    GstSegment *segment)
+{
+  GstClockTimeDiff base = (GstClockTimeDiff) segment->base + output->rebase;
+
+  if (base < 0) {
+    segment->start += -base;
+    segment->time = segment->start;
+    base = 0;
+  }
+  segment->base = base;
+}
+
+/* Segment of the elementary pads, mapping the publisher's timestamps onto
+ * the output timeline */
+static void
+gst_rtmp2_server_src_init_es_segment (Rtmp2ServerSrcOutput *output,
+    GstSegment *segment)
+{
+  gst_segment_init (segment, GST_FORMAT_TIME);
+  segment->start = output->out_start_ms * GST_MSECOND;
+  segment->time = segment->start;
+  segment->base = output->out_base_ms * GST_MSECOND;
+  gst_rtmp2_server_src_apply_rebase (output, segment);
+}
+
+#define RTMP2_TRACK_VIDEO (1 << 0)
+#define RTMP2_TRACK_AUDIO (1 << 1)
+
+/* Whether an onMetaData object announces a track, from its has* flag or
+ * else the presence of its codec ID. Sets known if it tells at all. */
+static gboolean
+gst_rtmp2_server_src_meta_has_track (const GstAmfNode *meta,
+    const gchar *flag, const gchar *codec_id, gboolean *known)
+{
+  const GstAmfNode *node = gst_amf_node_get_field (meta, flag);
+
+  if (node && gst_amf_node_get_type (node) == GST_AMF_TYPE_BOOLEAN) {
+    *known = TRUE;
+    return gst_amf_node_get_boolean (node);
+  }
+
+  node = gst_amf_node_get_field (meta, codec_id);
+  if (node && gst_amf_node_get_type (node) != GST_AMF_TYPE_NULL &&
+      gst_amf_node_get_type (node) != GST_AMF_TYPE_UNDEFINED) {
+    *known = TRUE;
+    return TRUE;
+  }
+
+  return FALSE;
+}
+
+/* RTMP2_TRACK_* flags of the tracks an onMetaData script tag announces,
+ * 0 for other script tags and metadata that doesn't tell. Publishers send
+ * it as "onMetaData" or "@setDataFrame", "onMetaData", then the object. */
+static guint
+gst_rtmp2_server_src_parse_meta_tracks (const Rtmp2FlvTag *tag)
+{
+  GstMapInfo map;
+  const guint8 *ptr;
+  gsize remaining;
+  gboolean on_meta_data = FALSE, known = FALSE;
+  guint tracks = 0, i;
+
+  if (!tag->data || !gst_buffer_map (tag->data, &map, GST_MAP_READ))
+    return 0;
+
+  ptr = map.data;
+  remaining = map.size;
+  for (i = 0; i < 3 && remaining > 0; i++) {
+    guint8 *end = NULL;
+    GstAmfNode *node = gst_amf_node_parse (ptr, remaining, &end);
+    GstAmfType type;
+
+    if (!node)
+      break;
+    remaining -= end - ptr;
+    ptr = end;
+
+    type = gst_amf_node_get_type (node);
+    if (type == GST_AMF_TYPE_STRING) {
+      gchar *name = gst_amf_node_get_string (node, NULL);
+
+      on_meta_data = g_str_equal (name, "onMetaData");
+      g_free (name);
+    } else if (on_meta_data && (type == GST_AMF_TYPE_OBJECT ||
+            type == GST_AMF_TYPE_ECMA_ARRAY)) {
+      if (gst_rtmp2_server_src_meta_has_track (node, "hasVideo",
+              "videocodecid", &known))
+        tracks |= RTMP2_TRACK_VIDEO;
+      if (gst_rtmp2_server_src_meta_has_track (node, "hasAudio",
+              "audiocodecid", &known))
+        tracks |= RTMP2_TRACK_AUDIO;
+      gst_amf_node_free (node);
+      break;
+    }
+    gst_amf_node_free (node);
+  }
+
+  gst_buffer_unmap (tag->data, &map);
+
+  return known ? tracks : 0;
+}
+
+/* Signal no-more-pads once the stream's track set is known and all its
+ * pads exist: the tracks onMetaData announced, or without metadata both
+ * pads or the first video keyframe, which publishers send after all their
+ * sequence headers. An audio-only stream without metadata never signals.
+ * Called with the push lock held. */
+static void
+gst_rtmp2_server_src_check_no_more_pads (Rtmp2ServerSrcOutput *output,
+    const Rtmp2FlvTag *tag)
+{
+  guint tracks = 0;
+
+  if (output->no_more_pads)
+    return;
+
+  if (output->video_pad.pad)
+    tracks |= RTMP2_TRACK_VIDEO;
+  if (output->audio_pad.pad)
+    tracks |= RTMP2_TRACK_AUDIO;
+
+  if (output->meta_tracks) {
+    if ((tracks & output->meta_tracks) != output->meta_tracks)
+      return;
+  } else if (tracks != (RTMP2_TRACK_VIDEO | RTMP2_TRACK_AUDIO) &&
+      !(tag && tag->tag_type == RTMP2_FLV_TAG_VIDEO && tag->video_keyframe &&
+          output->video_pad.started)) {
+    return;
+  }
+
+  GST_DEBUG_OBJECT (output->src, "All pads of the stream added");
+  output->no_more_pads = TRUE;
+  gst_element_no_more_pads (GST_ELEMENT (output->src));
+}
+
+/* Set the caps of an elementary stream pad, creating the pad and starting
+ * its stream first if needed. Takes ownership of caps. */
+static void
+gst_rtmp2_server_src_es_set_caps (Rtmp2ServerSrcOutput *output,
+    Rtmp2ServerSrcEsPad *es, GstCaps *caps)
+{
+  GstRtmp2ServerSrc *src = output->src;
+  gboolean video = es == &output->video_pad;
+  gboolean new_pad = FALSE;
+
+  if (!es->pad) {
+    gchar *name;
+
+    if (video) {
+      name = g_strdup_printf ("video_%u", src->video_pad_count++);
+      es->pad = gst_pad_new_from_static_template (&video_template, name);
+    } else {
+      name = g_strdup_printf ("audio_%u", src->audio_pad_count++);
+      es->pad = gst_pad_new_from_static_template (&audio_template, name);
+    }
+    g_free (name);
+
+    gst_pad_use_fixed_caps (es->pad);
+    gst_pad_set_query_function (es->pad, gst_rtmp2_server_src_query);
+    gst_pad_set_active (es->pad, TRUE);
+    new_pad = TRUE;
+  } else if (es->started && es->caps && gst_caps_is_equal (es->caps, caps)) {
+    gst_caps_unref (caps);
+    return;
+  }
+
+  if (!es->started) {
+    GstSegment segment;
+    GstEvent *event;
+    gchar *stream_id;
+
+    stream_id = gst_pad_create_stream_id (es->pad, GST_ELEMENT (src),
+        video ? "video" : "audio");
+    event = gst_event_new_stream_start (stream_id);
+    gst_event_set_group_id (event, output->group_id);
+    gst_pad_push_event (es->pad, event);
+    g_free (stream_id);
+
+    gst_pad_push_event (es->pad, gst_event_new_caps (caps));
+
+    gst_rtmp2_server_src_init_es_segment (output, &segment);
+    gst_pad_push_event (es->pad, gst_event_new_segment (&segment));
+  } else {
+    gst_pad_push_event (es->pad, gst_event_new_caps (caps));
+  }
+
+  GST_DEBUG_OBJECT (src, "%s caps %" GST_PTR_FORMAT,
+      video ? "Video" : "Audio", caps);
+
+  gst_caps_replace (&es->caps, caps);
+  gst_caps_unref (caps);
+
+  es->started = TRUE;
+
+  if (new_pad) {
+    gst_element_add_pad (GST_ELEMENT (src), es->pad);
+    gst_flow_combiner_add_pad (output->flow_combiner, es->pad);
+
+    /* Only later links get a replay, this one is already being served */
+    g_signal_connect (es->pad, "linked",
+        G_CALLBACK (gst_rtmp2_server_src_pad_linked), output);
+
+    gst_rtmp2_server_src_check_no_more_pads (output, NULL);
+  }
+}
+
+/* Elementary output: push the codec payload of a tag on its video or
+ * audio pad. Sequence headers only update the caps. Called with the push
+ * lock held. */
+static GstFlowReturn
+gst_rtmp2_server_src_push_es (Rtmp2ServerSrcOutput *output, Rtmp2FlvTag *tag)
+{
+  GstRtmp2ServerSrc *src = output->src;
+  Rtmp2ServerSrcEsPad *es;
+  GstBuffer *payload;
+  GstFlowReturn ret;
+
+  if (tag->tag_type == RTMP2_FLV_TAG_VIDEO) {
+    es = &output->video_pad;
+  } else if (tag->tag_type == RTMP2_FLV_TAG_AUDIO) {
+    es = &output->audio_pad;
+  } else {
+    guint tracks;
+
+    if (!output->no_more_pads &&
+        (tracks = gst_rtmp2_server_src_parse_meta_tracks (tag))) {
+      output->meta_tracks = tracks;
+      gst_rtmp2_server_src_check_no_more_pads (output, NULL);
+    }
+    return GST_FLOW_OK;
   }
 
-  /* Push FLV file header on first data */
-  if (!src->srcpad_started) {
-    guint8 flv_header[13] = {
-      'F', 'L', 'V',              /* Signature */
-      0x01,                       /* Version */
-      0x05,                       /* Flags: audio + video */
-      0x00, 0x00, 0x00, 0x09,     /* Header size */
-      0x00, 0x00, 0x00, 0x00      /* Previous tag size */
-    };
-    gchar *stream_id;
+  if (tag->sequence_header) {
+    GstCaps *caps = gst_rtmp2_server_src_tag_caps (tag);
 
-    src->stream_count++;
-    stream_id = g_strdup_printf ("rtmp-stream-%u", src->stream_count);
-    
-    GST_INFO_OBJECT (src, "Starting new stream: %s", stream_id);
-    
-    gst_pad_push_event (src->srcpad, gst_event_new_stream_start (stream_id));
-    gst_pad_push_event (src->srcpad, gst_event_new_caps (
-        gst_caps_new_empty_simple ("video/x-flv")));
+    if (caps) {
+      es->need_codec_data = FALSE;
+      gst_rtmp2_server_src_es_set_caps (output, es, caps);
+    }
+    return GST_FLOW_OK;
+  }
 
-    {
-      GstSegment segment;
-      gst_segment_init (&segment, GST_FORMAT_BYTES);
-      gst_pad_push_event (src->srcpad, gst_event_new_segment (&segment));
+  if (!es->started) {
+    GstCaps *caps;
+
+    /* AVC, HEVC and AAC can't be decoded before their sequence header */
+    if ((tag->tag_type == RTMP2_FLV_TAG_VIDEO &&
+            (tag->video_codec == RTMP2_FLV_VIDEO_CODEC_H264 ||
+                tag->video_codec == RTMP2_FLV_VIDEO_CODEC_H265)) ||
+        (tag->tag_type == RTMP2_FLV_TAG_AUDIO &&
+            tag->audio_codec == RTMP2_FLV_AUDIO_CODEC_AAC)) {
+      if (!es->need_codec_data)
+        GST_WARNING_OBJECT (src, "No sequence header before the first %s "
+            "frame, dropping", tag->tag_type == RTMP2_FLV_TAG_VIDEO ?
+            "video" : "audio");
+      es->need_codec_data = TRUE;
+      return GST_FLOW_OK;
     }
 
-    buffer = gst_buffer_new_allocate (NULL, 13, NULL);
-    gst_buffer_fill (buffer, 0, flv_header, 13);
-    gst_pad_push (src->srcpad, buffer);
-    
-    src->srcpad_started = TRUE;
-    g_free (stream_id);
-    GST_DEBUG_OBJECT (src, "Pushed FLV header");
+    caps = gst_rtmp2_server_src_tag_caps (tag);
+    if (!caps) {
+      GST_LOG_OBJECT (src, "Unsupported codec, dropping tag");
+      return GST_FLOW_OK;
+    }
+    gst_rtmp2_server_src_es_set_caps (output, es, caps);
+  }
+
+  payload = rtmp2_flv_tag_get_payload (tag);
+  if (!payload)
+    return GST_FLOW_OK;
+
+  gst_rtmp2_server_src_set_buffer_info (output, payload, tag);
+  gst_rtmp2_server_src_check_no_more_pads (output, tag);
+
+  ret = gst_pad_push (es->pad, payload);
+  return gst_flow_combiner_update_pad_flow (output->flow_combiner, es->pad,
+      ret);
+}
+
+/* Push an event on all output pads of the current output mode */
+static void
+gst_rtmp2_server_src_push_event (Rtmp2ServerSrcOutput *output,
+    GstEvent *event)
+{
+  if (output->mode == GST_RTMP2_SERVER_SRC_OUTPUT_FLV) {
+    gst_pad_push_event (output->srcpad, event);
+    return;
+  }
+
+  if (output->video_pad.started)
+    gst_pad_push_event (output->video_pad.pad, gst_event_ref (event));
+  if (output->audio_pad.started)
+    gst_pad_push_event (output->audio_pad.pad, gst_event_ref (event));
+  gst_event_unref (event);
+}
+
+/* After a seamless switch, drop the new publisher's tags up to its first
+ * keyframe, then continue the output timeline from there. Returns FALSE
+ * for tags to drop. Called with the push lock held. */
+static gboolean
+gst_rtmp2_server_src_switch_resume (Rtmp2ServerSrcOutput *output,
+    const Rtmp2FlvTag *tag)
+{
+  GstRtmp2ServerSrc *src = output->src;
+
+  if (!output->switch_pending || rtmp2_flv_tag_is_header (tag))
+    return TRUE;
+
+  if (output->have_video && !(tag->tag_type == RTMP2_FLV_TAG_VIDEO &&
+          tag->video_keyframe))
+    return FALSE;
+
+  output->switch_pending = FALSE;
+  output->out_start_ms = tag->timestamp;
+
+  GST_INFO_OBJECT (src, "Resuming output at timestamp %u, output time %u",
+      tag->timestamp, output->out_base_ms);
+
+  if (output->mode == GST_RTMP2_SERVER_SRC_OUTPUT_ELEMENTARY) {
+    GstSegment segment;
+
+    gst_rtmp2_server_src_init_es_segment (output, &segment);
+    gst_rtmp2_server_src_push_event (output, gst_event_new_segment (&segment));
+  }
+
+  return TRUE;
+}
+
+/* Forget the streams of the elementary pads, keeping the pads themselves
+ * so they stay linked across sessions */
+static void
+gst_rtmp2_server_src_reset_es_pads (Rtmp2ServerSrcOutput *output)
+{
+  output->video_pad.started = FALSE;
+  output->video_pad.need_codec_data = FALSE;
+  gst_clear_caps (&output->video_pad.caps);
+  output->audio_pad.started = FALSE;
+  output->audio_pad.need_codec_data = FALSE;
+  gst_clear_caps (&output->audio_pad.caps);
+  output->meta_tracks = 0;
+  gst_flow_combiner_reset (output->flow_combiner);
+}
+
+static void
+gst_rtmp2_server_src_remove_es_pads (Rtmp2ServerSrcOutput *output)
+{
+  GstRtmp2ServerSrc *src = output->src;
+  Rtmp2ServerSrcEsPad *pads[] = { &output->video_pad, &output->audio_pad };
+  guint i;
+
+  gst_rtmp2_server_src_reset_es_pads (output);
+
+  for (i = 0; i < G_N_ELEMENTS (pads); i++) {
+    GstPad *pad = pads[i]->pad;
+
+    if (!pad)
+      continue;
+
+    pads[i]->pad = NULL;
+    gst_flow_combiner_remove_pad (output->flow_combiner, pad);
+    gst_element_remove_pad (GST_ELEMENT (src), pad);
+  }
+
+  /* Pads added later are a new set */
+  output->no_more_pads = FALSE;
+}
+
+/* Fold the reception-to-push delay of a tag into the running average.
+ * Called with the push lock held. */
+static void
+gst_rtmp2_server_src_update_latency (Rtmp2ServerSrcOutput *output,
+    gint64 arrival_time)
+{
+  guint latency, avg;
+
+  if (arrival_time <= 0)
+    return;
+
+  latency = MIN (g_get_monotonic_time () - arrival_time, G_MAXUINT);
+  avg = g_atomic_int_get (&output->delivery_latency);
+  avg = avg ? avg - avg / 8 + latency / 8 : latency;
+  g_atomic_int_set (&output->delivery_latency, avg);
+}
+
+/* Push tag, plus as many of the following queued tags as the batch
+ * limits allow, downstream as a single buffer or as one buffer list.
+ * Only tags already queued are considered. Takes ownership of
+ * tag->data. */
+static GstFlowReturn
+gst_rtmp2_server_src_push_tags (Rtmp2ServerSrcOutput *output,
+    ServerSession *session, Rtmp2FlvTag *tag)
+{
+  ServerSessionMedia *media = session->media;
+  GstRtmp2ServerSrc *src = output->src;
+  GstBufferList *list;
+  GstBuffer *buffer;
+  const Rtmp2FlvTag *next;
+  guint32 first_timestamp = tag->timestamp;
+  gint64 arrival_time = tag->arrival_time;
+  gsize batch_bytes = tag->data_size;
+  GstFlowReturn ret;
+
+  /* Tags alternate between pads in elementary mode, push them one by one */
+  if (output->mode == GST_RTMP2_SERVER_SRC_OUTPUT_ELEMENTARY) {
+    ret = gst_rtmp2_server_src_push_es (output, tag);
+    gst_rtmp2_server_src_update_latency (output, arrival_time);
+    rtmp2_flv_tag_clear (tag);
+    return ret;
+  }
+
+  buffer = gst_rtmp2_server_src_tag_to_buffer (output, tag);
+  rtmp2_flv_tag_clear (tag);
+  if (!buffer)
+    return GST_FLOW_OK;
+
+  next = rtmp2_flv_tag_ring_peek (&media->tag_ring, 0);
+  if (src->max_batch_tags == 1 || !next) {
+    ret = gst_pad_push (output->srcpad, buffer);
+    gst_rtmp2_server_src_update_latency (output, arrival_time);
+    return ret;
+  }
+
+  list = gst_buffer_list_new ();
+  gst_buffer_list_add (list, buffer);
+
+  for (; next; next = rtmp2_flv_tag_ring_peek (&media->tag_ring, 0)) {
+    Rtmp2FlvTag queued;
+
+    if (src->max_batch_tags > 0 &&
+        gst_buffer_list_length (list) >= src->max_batch_tags)
+      break;
+    if (src->max_batch_bytes > 0 &&
+        batch_bytes + next->data_size > src->max_batch_bytes)
+      break;
+    if (src->max_batch_time > 0 &&
+        (gint32) (next->timestamp - first_timestamp) > 0 &&
+        (next->timestamp - first_timestamp) * GST_MSECOND >=
+        src->max_batch_time)
+      break;
+
+    if (!gst_rtmp2_server_src_pop_tag (output, session, &queued))
+      break;
+    batch_bytes += queued.data_size;
+
+    buffer = gst_rtmp2_server_src_tag_to_buffer (output, &queued);
+    if (buffer)
+      gst_buffer_list_add (list, buffer);
+    rtmp2_flv_tag_clear (&queued);
+  }
+
+  GST_LOG_OBJECT (src, "Pushing batch of %u buffers",
+      gst_buffer_list_length (list));
+  ret = gst_pad_push_list (output->srcpad, list);
+  gst_rtmp2_server_src_update_latency (output, arrival_time);
+  return ret;
+}
+
+static void
+gst_rtmp2_server_src_push_flv_header (Rtmp2ServerSrcOutput *output,
+    gboolean discont)
+{
+  GstRtmp2ServerSrc *src = output->src;
+  GstBuffer *buffer;
+  guint8 flv_header[13] = {
+    'F', 'L', 'V',              /* Signature */
+    0x01,                       /* Version */
+    0x05,                       /* Flags: audio + video */
+    0x00, 0x00, 0x00, 0x09,     /* Header size */
+    0x00, 0x00, 0x00, 0x00      /* Previous tag size */
+  };
+
+  buffer = gst_buffer_new_allocate (NULL, 13, NULL);
+  gst_buffer_fill (buffer, 0, flv_header, 13);
+  GST_BUFFER_FLAG_SET (buffer, GST_BUFFER_FLAG_HEADER);
+  if (discont)
+    GST_BUFFER_FLAG_SET (buffer, GST_BUFFER_FLAG_DISCONT);
+  gst_pad_push (output->srcpad, buffer);
+
+  GST_DEBUG_OBJECT (src, "Pushed FLV header");
+}
+
+/* Push stream-start, caps, segment and the FLV file header ahead of the
+ * first tag, or prepare the elementary pads. Called with the push lock
+ * held. */
+static void
+gst_rtmp2_server_src_start_stream (Rtmp2ServerSrcOutput *output)
+{
+  GstRtmp2ServerSrc *src = output->src;
+  gchar *stream_id;
+
+  output->stream_count++;
+
+  /* A new stream starts a new timeline */
+  output->switch_pending = FALSE;
+  output->out_start_ms = 0;
+  output->out_base_ms = 0;
+  output->out_position_ms = 0;
+  output->out_last_video_ms = 0;
+  output->out_frame_ms = 0;
+
+  /* Elementary pads start their own streams on their first tag */
+  if (output->mode == GST_RTMP2_SERVER_SRC_OUTPUT_ELEMENTARY) {
+    output->group_id = gst_util_group_id_next ();
+    output->started = TRUE;
+    return;
+  }
+
+  if (output->name)
+    stream_id = g_strdup_printf ("rtmp-stream-%s-%u", output->name,
+        output->stream_count);
+  else
+    stream_id = g_strdup_printf ("rtmp-stream-%u", output->stream_count);
+  
+  GST_INFO_OBJECT (src, "Starting new stream: %s", stream_id);
+  
+  gst_pad_push_event (output->srcpad, gst_event_new_stream_start (stream_id));
+  gst_pad_push_event (output->srcpad, gst_event_new_caps (
+      gst_caps_new_empty_simple ("video/x-flv")));
+
+  {
+    GstSegment segment;
+    gst_segment_init (&segment, src->segment_format);
+    if (src->segment_format == GST_FORMAT_TIME)
+      gst_rtmp2_server_src_apply_rebase (output, &segment);
+    gst_pad_push_event (output->srcpad, gst_event_new_segment (&segment));
+  }
+
+  gst_rtmp2_server_src_push_flv_header (output, FALSE);
+  
+  output->started = TRUE;
+  g_free (stream_id);
+}
+
+/* Push a single tag in the current output mode, without taking ownership.
+ * Called with the push lock held. */
+static GstFlowReturn
+gst_rtmp2_server_src_push_tag (Rtmp2ServerSrcOutput *output, Rtmp2FlvTag *tag)
+{
+  GstBuffer *buffer;
+
+  if (output->mode == GST_RTMP2_SERVER_SRC_OUTPUT_ELEMENTARY)
+    return gst_rtmp2_server_src_push_es (output, tag);
+
+  buffer = gst_rtmp2_server_src_tag_to_buffer (output, tag);
+  if (!buffer)
+    return GST_FLOW_OK;
+
+  return gst_pad_push (output->srcpad, buffer);
+}
+
+/* Push tags, the GOP cache of session, on the streams in mask. Queued
+ * tags that were part of it are skipped afterwards. Takes ownership of
+ * tags. Called with the push lock held. */
+static void
+gst_rtmp2_server_src_replay_gop_cache (Rtmp2ServerSrcOutput *output,
+    ServerSession *session, GPtrArray *tags, guint mask)
+{
+  ServerSessionMedia *media = session->media;
+  GstRtmp2ServerSrc *src = output->src;
+  guint i;
+
+  GST_DEBUG_OBJECT (src, "Replaying %u cached tags", tags->len);
+
+  for (i = 0; i < tags->len; i++) {
+    Rtmp2FlvTag *tag = g_ptr_array_index (tags, i);
+
+    if (output->mode == GST_RTMP2_SERVER_SRC_OUTPUT_ELEMENTARY &&
+        ((tag->tag_type == RTMP2_FLV_TAG_VIDEO && !(mask & REPLAY_VIDEO)) ||
+            (tag->tag_type == RTMP2_FLV_TAG_AUDIO && !(mask & REPLAY_AUDIO))))
+      continue;
+
+    gst_rtmp2_server_src_push_tag (output, tag);
+
+    if (!media->replay_seqnum ||
+        (gint32) (tag->seqnum - media->replay_seqnum) > 0)
+      media->replay_seqnum = tag->seqnum;
+  }
+
+  g_ptr_array_unref (tags);
+}
+
+/* First media tag the output would push: from the GOP cache replay, the
+ * queue, or next if that is pushed directly. Headers often carry 0
+ * whatever the media timestamps, so they don't count. */
+static const Rtmp2FlvTag *
+gst_rtmp2_server_src_find_first_tag (ServerSession *session,
+    GPtrArray *replay, const Rtmp2FlvTag *next)
+{
+  ServerSessionMedia *media = session->media;
+  guint i, level;
+
+  for (i = 0; replay && i < replay->len; i++) {
+    const Rtmp2FlvTag *tag = g_ptr_array_index (replay, i);
+
+    if (!rtmp2_flv_tag_is_header (tag))
+      return tag;
+  }
+
+  level = rtmp2_flv_tag_ring_get_level (&media->tag_ring);
+  for (i = 0; i < level; i++) {
+    const Rtmp2FlvTag *tag = rtmp2_flv_tag_ring_peek (&media->tag_ring, i);
+
+    if (!rtmp2_flv_tag_is_header (tag))
+      return tag;
+  }
+
+  if (next && !rtmp2_flv_tag_is_header (next))
+    return next;
+
+  return NULL;
+}
+
+/* Start the output stream if needed, then replay the GOP cache of session
+ * on new output. next is the tag about to be pushed directly, if any.
+ *
+ * A new stream waits for its first media tag, which is placed on the
+ * current running time. Returns FALSE while it waits. Called with the push
+ * lock held. */
+static gboolean
+gst_rtmp2_server_src_ensure_started (Rtmp2ServerSrcOutput *output,
+    ServerSession *session, const Rtmp2FlvTag *next)
+{
+  GstRtmp2ServerSrc *src = output->src;
+  GPtrArray *replay = NULL;
+  guint mask;
+
+  if (!output->started) {
+    const Rtmp2FlvTag *first;
+
+    if (src->gop_cache_max_bytes > 0)
+      replay = server_session_gop_cache_get (session);
+
+    /* Unless it will never come */
+    first = gst_rtmp2_server_src_find_first_tag (session, replay, next);
+    if (!first && session->state != SERVER_SESSION_STATE_DISCONNECTED) {
+      if (replay)
+        g_ptr_array_unref (replay);
+      return FALSE;
+    }
+
+    output->rebase = first ?
+        gst_rtmp2_server_src_get_rebase (output, first->timestamp) : 0;
+    GST_DEBUG_OBJECT (src, "Starting at running time %" GST_STIME_FORMAT
+        " minus the first timestamp", GST_STIME_ARGS (output->rebase));
+
+    gst_rtmp2_server_src_start_stream (output);
+    g_atomic_int_set (&output->replay_pending, 0);
+    if (replay)
+      gst_rtmp2_server_src_replay_gop_cache (output, session, replay,
+          REPLAY_ALL);
+    return TRUE;
+  }
+
+  mask = g_atomic_int_and (&output->replay_pending, 0);
+  if (mask == 0 || src->gop_cache_max_bytes == 0)
+    return TRUE;
+
+  /* A new consumer on the FLV pad needs the file header again */
+  if (output->mode == GST_RTMP2_SERVER_SRC_OUTPUT_FLV)
+    gst_rtmp2_server_src_push_flv_header (output, TRUE);
+
+  gst_rtmp2_server_src_replay_gop_cache (output, session,
+      server_session_gop_cache_get (session), mask);
+  return TRUE;
+}
+
+/* Direct-push mode: push the tag downstream from the event loop thread
+ * when nothing is queued ahead of it and the streaming task is idle.
+ * gst_pad_push() blocks that thread, so this is only done while the event
+ * loop serves no other connection: on a thread of our own, not on the
+ * shared pool. A push blocking downstream then only holds back this
+ * publisher, as a blocked streaming task would.
+ * Returns FALSE if the tag has to go through the queue instead, otherwise
+ * takes ownership of tag->data. */
+static gboolean
+gst_rtmp2_server_src_direct_push (ServerSession *session, Rtmp2FlvTag *tag)
+{
+  ServerSessionMedia *media = session->media;
+  GstRtmp2ServerSrc *src = session->src;
+  Rtmp2ServerSrcOutput *output = session->output;
+  GstFlowReturn ret = GST_FLOW_OK;
+  gint64 arrival_time = tag->arrival_time;
+  gboolean active;
+  guint i;
+
+  if (!src->direct_push || output->pooled || !session->loop ||
+      g_atomic_int_get (&session->loop->n_sessions) != 1 ||
+      !server_output_is_running (output))
+    return FALSE;
+
+  active = g_atomic_pointer_get (&output->session) == session;
+  if (!active)
+    return FALSE;
+
+  /* The streaming task holds the lock while pushing, don't wait for it */
+  if (!g_mutex_trylock (&output->push_lock))
+    return FALSE;
+
+  if (rtmp2_flv_tag_ring_get_level (&media->tag_ring) > 0 ||
+      !g_queue_is_empty (&media->backlog)) {
+    g_mutex_unlock (&output->push_lock);
+    return FALSE;
+  }
+  for (i = 0; i < G_N_ELEMENTS (media->held_headers); i++) {
+    if (media->held_headers[i].data) {
+      g_mutex_unlock (&output->push_lock);
+      return FALSE;
+    }
+  }
+
+  /* A header ahead of the first media tag waits for it in the queue */
+  if (!gst_rtmp2_server_src_ensure_started (output, session, tag)) {
+    g_mutex_unlock (&output->push_lock);
+    return FALSE;
+  }
+
+  if ((!media->replay_seqnum ||
+          (gint32) (tag->seqnum - media->replay_seqnum) > 0) &&
+      gst_rtmp2_server_src_switch_resume (output, tag)) {
+    ret = gst_rtmp2_server_src_push_tag (output, tag);
+    gst_rtmp2_server_src_update_latency (output, arrival_time);
+  }
+  rtmp2_flv_tag_clear (tag);
+  g_mutex_unlock (&output->push_lock);
+
+  g_atomic_int_inc (&media->direct_pushes);
+
+  if (ret != GST_FLOW_OK) {
+    GST_WARNING_OBJECT (src, "Pad push returned %s", gst_flow_get_name (ret));
+  }
+
+  return TRUE;
+}
+
+/* Stop the task of a retired output, then free it together with its pad
+ * and finished session */
+static void
+server_output_release (gpointer user_data)
+{
+  Rtmp2ServerSrcOutput *output = user_data;
+  GstRtmp2ServerSrc *src = output->src;
+
+  server_output_stop (output);
+  server_output_set_flushing (output, TRUE);
+  server_output_join (output);
+
+  g_rw_lock_writer_lock (&src->sessions_lock);
+  if (output->session) {
+    server_registry_remove_locked (src, output->session);
+    server_session_free (output->session);
+  }
+  g_rw_lock_writer_unlock (&src->sessions_lock);
+
+  server_output_free (output);
+}
+
+/* Multi-stream mode without loop: once its publisher is gone and EOS was
+ * sent, the stream key is free for a new publisher and pad. The output is
+ * released from the event loop thread, its task can't join itself. */
+static void
+gst_rtmp2_server_src_retire_output (Rtmp2ServerSrcOutput *output)
+{
+  GstRtmp2ServerSrc *src = output->src;
+  GMainContext *context;
+  gboolean removed;
+
+  g_rw_lock_writer_lock (&src->sessions_lock);
+  removed = g_hash_table_remove (src->outputs, output->name);
+  /* Release on the thread of the publisher, it frees the session */
+  context = output->session ? output->session->context :
+      src->listener->loops[0].context;
+  g_rw_lock_writer_unlock (&src->sessions_lock);
+
+  /* Otherwise stop() took over all outputs already */
+  if (removed)
+    gst_rtmp2_server_src_defer_release (context, server_output_release,
+        output);
+}
+
+/* Seamless switchover: keep the stream, caps and pads of the output and
+ * continue its timeline with the next publisher, from its first keyframe */
+static void
+gst_rtmp2_server_src_switch_session (Rtmp2ServerSrcOutput *output,
+    ServerSession *session)
+{
+  GstRtmp2ServerSrc *src = output->src;
+  ServerSession *next;
+
+  g_mutex_lock (&output->push_lock);
+  if (output->started) {
+    output->out_base_ms = output->out_position_ms + output->out_frame_ms;
+    output->switch_pending = TRUE;
+  }
+  g_mutex_unlock (&output->push_lock);
+
+  g_rw_lock_writer_lock (&src->sessions_lock);
+  server_registry_remove_locked (src, session);
+  next = server_registry_next_locked (src, output);
+  g_atomic_pointer_set (&output->session, next);
+  g_rw_lock_writer_unlock (&src->sessions_lock);
+
+  server_session_free (session);
+  output->eos_wait_start = 0;
+
+  GST_INFO_OBJECT (src, "Client disconnected, switching to %s",
+      next ? "the next waiting client" : "the next client to connect");
+}
+
+/* Task loop - pushes FLV data to srcpad */
+static void
+gst_rtmp2_server_src_loop (gpointer user_data)
+{
+  Rtmp2ServerSrcOutput *output = user_data;
+  GstRtmp2ServerSrc *src = output->src;
+  ServerSession *session;
+  Rtmp2FlvTag tag;
+  GstFlowReturn ret;
+
+  /* Only this task replaces a session that is being output */
+  session = g_atomic_pointer_get (&output->session);
+
+  if (!session) {
+    /* Idle until a client completes the handshake */
+    gst_rtmp2_server_src_wait (output, -1);
+    return;
   }
 
-  /* Get next tag from queue */
-  g_mutex_lock (&session->queue_lock);
-  tag = g_queue_pop_head (session->tag_queue);
-  g_mutex_unlock (&session->queue_lock);
+  /* Get next tag from queue. The push lock is held from the pop until the
+   * push completed so direct pushes cannot overtake queued tags. */
+  g_mutex_lock (&output->push_lock);
+  if (!gst_rtmp2_server_src_ensure_started (output, session, NULL) ||
+      !gst_rtmp2_server_src_pop_tag (output, session, &tag)) {
+    g_mutex_unlock (&output->push_lock);
 
-  if (!tag) {
     /* Check for EOS */
     if (session->state == SERVER_SESSION_STATE_DISCONNECTED) {
       gint64 now = g_get_monotonic_time ();
-      
-      if (src->eos_wait_start == 0) {
-        src->eos_wait_start = now;
-        g_usleep (10000);
+
+      /* The connection's error signal woke us up and the queue is drained,
+       * no need to wait any longer */
+      if (src->loop && src->seamless_switch) {
+        gst_rtmp2_server_src_switch_session (output, session);
         return;
       }
       
-      if ((now - src->eos_wait_start) < 100000) {  /* 100ms grace */
-        g_usleep (10000);
+      if (output->eos_wait_start == 0) {
+        output->eos_wait_start = now;
+      }
+
+      if ((now - output->eos_wait_start) < 100000) {  /* 100ms grace */
+        gst_rtmp2_server_src_wait (output, output->eos_wait_start + 100000);
         return;
       }
 
@@ -481,227 +3406,670 @@ gst_rtmp2_server_src_loop (gpointer user_data)
         GST_INFO_OBJECT (src, "Client disconnected, waiting for new connection (loop=true)");
         
         /* Send flush events to reset downstream state */
-        gst_pad_push_event (src->srcpad, gst_event_new_flush_start ());
-        gst_pad_push_event (src->srcpad, gst_event_new_flush_stop (TRUE));
+        gst_rtmp2_server_src_push_event (output, gst_event_new_flush_start ());
+        gst_rtmp2_server_src_push_event (output, gst_event_new_flush_stop (TRUE));
         
-        /* Clean up old session */
-        g_mutex_lock (&src->sessions_lock);
-        if (src->active_session) {
-          src->sessions = g_list_remove (src->sessions, src->active_session);
-          server_session_free (src->active_session);
-          src->active_session = NULL;
-        }
-        g_mutex_unlock (&src->sessions_lock);
+        /* Clean up old session, a publisher waiting behind it is next */
+        g_rw_lock_writer_lock (&src->sessions_lock);
+        server_registry_remove_locked (src, session);
+        g_atomic_pointer_set (&output->session,
+            server_registry_next_locked (src, output));
+        g_rw_lock_writer_unlock (&src->sessions_lock);
+        server_session_free (session);
         
         /* Reset state for next connection */
-        src->srcpad_started = FALSE;
-        src->eos_wait_start = 0;
-        src->have_video = FALSE;
-        src->have_audio = FALSE;
-        
-        g_usleep (50000);  /* 50ms before checking for new connections */
+        g_mutex_lock (&output->push_lock);
+        output->started = FALSE;
+        if (output->mode == GST_RTMP2_SERVER_SRC_OUTPUT_ELEMENTARY)
+          gst_rtmp2_server_src_reset_es_pads (output);
+        g_mutex_unlock (&output->push_lock);
+        output->eos_wait_start = 0;
+        output->have_video = FALSE;
+        output->have_audio = FALSE;
+
+        /* Next iteration blocks until a new client shows up */
         return;
       }
 
       /* Post pre-EOS message first to allow consumers to prepare for shutdown.
        * This is critical for applications that need to stop accessing the
        * element before destruction. */
-      {
+      if (output->pre_eos_end == 0) {
         GstStructure *s = gst_structure_new ("rtmp2server-pre-eos",
             "reason", G_TYPE_STRING, "client-disconnected", NULL);
+        if (output->name)
+          gst_structure_set (s, "pad-name", G_TYPE_STRING,
+              GST_PAD_NAME (output->srcpad), NULL);
         gst_element_post_message (GST_ELEMENT (src),
             gst_message_new_element (GST_OBJECT (src), s));
         GST_INFO_OBJECT (src, "Posted pre-EOS message to bus");
+        output->pre_eos_end = g_get_monotonic_time () + 100000;  /* 100ms */
       }
       
-      /* Allow time for consumers to process pre-EOS */
-      g_usleep (100000);  /* 100ms */
+      /* Allow time for consumers to process pre-EOS, in later iterations
+       * so that waiting never blocks a push worker */
+      if (g_get_monotonic_time () < output->pre_eos_end &&
+          gst_rtmp2_server_src_wait (output, output->pre_eos_end))
+        return;
+      output->pre_eos_end = 0;
 
       GST_INFO_OBJECT (src, "Client disconnected, sending EOS");
-      gst_pad_push_event (src->srcpad, gst_event_new_eos ());
-      gst_task_pause (src->task);
+      if (output->mode == GST_RTMP2_SERVER_SRC_OUTPUT_ELEMENTARY &&
+          !output->video_pad.started && !output->audio_pad.started) {
+        GST_ELEMENT_ERROR (src, STREAM, CODEC_NOT_FOUND, (NULL),
+            ("No supported audio or video stream received"));
+      }
+      gst_rtmp2_server_src_push_event (output, gst_event_new_eos ());
+      server_output_pause (output);
+      if (output->name)
+        gst_rtmp2_server_src_retire_output (output);
       return;
     }
     
-    src->eos_wait_start = 0;
-    g_usleep (5000);  /* 5ms */
+    output->eos_wait_start = 0;
+
+    /* Block until on_media_message queues the next tag */
+    gst_rtmp2_server_src_wait (output, -1);
     return;
   }
 
-  src->eos_wait_start = 0;
+  output->eos_wait_start = 0;
+
+  ret = gst_rtmp2_server_src_push_tags (output, session, &tag);
+  g_mutex_unlock (&output->push_lock);
+  if (ret != GST_FLOW_OK) {
+    GST_WARNING_OBJECT (src, "Pad push returned %s", gst_flow_get_name (ret));
+  }
+}
+
+/* Queue figures of one multi-stream output. Called with the element's
+ * sessions_lock held. */
+static GstStructure *
+gst_rtmp2_server_src_get_output_stats (Rtmp2ServerSrcOutput *output)
+{
+  ServerSession *session = output->session;
+  guint level = 0, bytes = 0, capacity = 0, dropped = 0, leaky_dropped = 0;
+  guint throttle_count = 0;
+
+  if (session) {
+    ServerSessionMedia *media = session->media;
+
+    level = rtmp2_flv_tag_ring_get_level (&media->tag_ring);
+    bytes = rtmp2_flv_tag_ring_get_bytes (&media->tag_ring);
+    capacity = media->tag_ring.capacity;
+    dropped = g_atomic_int_get (&media->overflow_drops);
+    leaky_dropped = g_atomic_int_get (&media->leaky_drops);
+
+    g_mutex_lock (&throttle_lock);
+    throttle_count = media->throttle_count;
+    g_mutex_unlock (&throttle_lock);
+  }
+
+  return gst_structure_new ("GstRtmp2ServerSrcOutputStats",
+      "name", G_TYPE_STRING, output->name,
+      "application", G_TYPE_STRING, session ? session->app_name : NULL,
+      "stream-key", G_TYPE_STRING, session ? session->stream_key : NULL,
+      "queue-level", G_TYPE_UINT, level,
+      "queue-bytes", G_TYPE_UINT, bytes,
+      "queue-capacity", G_TYPE_UINT, capacity,
+      "overflow-dropped", G_TYPE_UINT, dropped,
+      "leaky-dropped", G_TYPE_UINT, leaky_dropped,
+      "throttle-count", G_TYPE_UINT, throttle_count,
+      NULL);
+}
+
+/* Figures of the default output and the element, with those of each
+ * multi-stream output in "outputs" */
+static GstStructure *
+gst_rtmp2_server_src_get_stats (GstRtmp2ServerSrc *src)
+{
+  ServerSession *session;
+  guint level = 0, bytes = 0, capacity = 0, dropped = 0, leaky_dropped = 0;
+  guint throttle_count = 0, direct_pushes = 0, gop_cache_bytes = 0;
+  GstClockTime throttled_time = 0;
+  Rtmp2ServerSrcOutput *output = src->output;
+  GValue outputs = G_VALUE_INIT;
+  GHashTableIter iter;
+  gpointer value;
+  GstStructure *stats;
+  guint streams, sessions;
+
+  g_value_init (&outputs, GST_TYPE_ARRAY);
+
+  g_rw_lock_reader_lock (&src->sessions_lock);
+  streams = g_hash_table_size (src->outputs);
+  sessions = g_hash_table_size (src->sessions);
+
+  g_hash_table_iter_init (&iter, src->outputs);
+  while (g_hash_table_iter_next (&iter, NULL, &value)) {
+    GValue entry = G_VALUE_INIT;
+
+    g_value_init (&entry, GST_TYPE_STRUCTURE);
+    g_value_take_boxed (&entry, gst_rtmp2_server_src_get_output_stats (value));
+    gst_value_array_append_and_take_value (&outputs, &entry);
+  }
+
+  session = output->session;
+  if (session) {
+    ServerSessionMedia *media = session->media;
+
+    level = rtmp2_flv_tag_ring_get_level (&media->tag_ring);
+    bytes = rtmp2_flv_tag_ring_get_bytes (&media->tag_ring);
+    capacity = media->tag_ring.capacity;
+    dropped = g_atomic_int_get (&media->overflow_drops);
+    leaky_dropped = g_atomic_int_get (&media->leaky_drops);
+    direct_pushes = g_atomic_int_get (&media->direct_pushes);
+
+    g_mutex_lock (&media->gop_lock);
+    gop_cache_bytes = media->gop_bytes;
+    g_mutex_unlock (&media->gop_lock);
+
+    g_mutex_lock (&throttle_lock);
+    throttle_count = media->throttle_count;
+    throttled_time = media->throttled_time;
+    if (media->throttled)
+      throttled_time += (g_get_monotonic_time () - media->throttle_start) *
+          GST_USECOND;
+    g_mutex_unlock (&throttle_lock);
+  }
+  g_rw_lock_reader_unlock (&src->sessions_lock);
+
+  stats = gst_structure_new ("GstRtmp2ServerSrcStats",
+      "queue-level", G_TYPE_UINT, level,
+      "queue-bytes", G_TYPE_UINT, bytes,
+      "queue-capacity", G_TYPE_UINT, capacity,
+      "overflow-dropped", G_TYPE_UINT, dropped,
+      "leaky-dropped", G_TYPE_UINT, leaky_dropped,
+      "throttle-count", G_TYPE_UINT, throttle_count,
+      "throttled-time", G_TYPE_UINT64, throttled_time,
+      "direct-pushed", G_TYPE_UINT, direct_pushes,
+      "gop-cache-bytes", G_TYPE_UINT, gop_cache_bytes,
+      "delivery-latency", G_TYPE_UINT64,
+      (guint64) g_atomic_int_get (&output->delivery_latency) * GST_USECOND,
+      "streams", G_TYPE_UINT, streams,
+      "sessions", G_TYPE_UINT, sessions,
+      "auth-rejected", G_TYPE_UINT, g_atomic_int_get (&src->auth_rejected),
+      "timed-out", G_TYPE_UINT, g_atomic_int_get (&src->timed_out),
+      "handshakes", G_TYPE_UINT, g_atomic_int_get (&src->n_handshakes),
+      "refused-connections", G_TYPE_UINT,
+      g_atomic_int_get (&src->refused_connections),
+      "over-budget", G_TYPE_UINT, g_atomic_int_get (&src->over_budget),
+      "total-queued-bytes", G_TYPE_UINT,
+      g_atomic_int_get (&total_queued_bytes),
+      NULL);
+  gst_structure_take_value (stats, "outputs", &outputs);
+
+  return stats;
+}
+
+/* Bind the listening socket of an event loop. With several loops, each
+ * binds its own socket with SO_REUSEPORT. */
+static gboolean
+rtmp2_server_loop_bind (Rtmp2ServerLoop *loop, GError **error)
+{
+  Rtmp2ServerListener *listener = loop->listener;
+  GInetAddress *addr;
+  GSocketAddress *saddr;
+  gboolean ret;
+
+  addr = g_inet_address_new_from_string (listener->host);
+  if (!addr) {
+    addr = g_inet_address_new_any (G_SOCKET_FAMILY_IPV4);
+  }
+
+  saddr = g_inet_socket_address_new (addr, listener->port);
+  g_object_unref (addr);
 
-  /* Build FLV tag buffer */
+#ifdef SO_REUSEPORT
+  if (listener->n_loops > 1) {
+    GSocket *socket;
+
+    socket = g_socket_new (g_socket_address_get_family (saddr),
+        G_SOCKET_TYPE_STREAM, G_SOCKET_PROTOCOL_TCP, error);
+    ret = socket != NULL &&
+        g_socket_set_option (socket, SOL_SOCKET, SO_REUSEPORT, 1, error) &&
+        g_socket_bind (socket, saddr, TRUE, error) &&
+        g_socket_listen (socket, error) &&
+        g_socket_listener_add_socket (G_SOCKET_LISTENER (loop->service),
+        socket, NULL, error);
+    g_clear_object (&socket);
+  } else
+#endif
   {
-  GstMapInfo map;
-    guint8 tag_header[11];
-    guint32 prev_tag_size;
-    GstBuffer *flv_buffer;
-    gsize data_size;
+    ret = g_socket_listener_add_address (G_SOCKET_LISTENER (loop->service),
+        saddr, G_SOCKET_TYPE_STREAM, G_SOCKET_PROTOCOL_TCP, NULL, NULL,
+        error);
+  }
 
-    if (!gst_buffer_map (tag->data, &map, GST_MAP_READ)) {
-      rtmp2_flv_tag_free (tag);
-      return;
-    }
+  g_object_unref (saddr);
+
+  return ret;
+}
+
+/* Create the socket service of an event loop, on its thread */
+static gboolean
+rtmp2_server_loop_start (Rtmp2ServerLoop *loop)
+{
+  Rtmp2ServerListener *listener = loop->listener;
+  GError *error = NULL;
+
+  loop->service = g_socket_service_new ();
+
+  if (!rtmp2_server_loop_bind (loop, &error)) {
+    GST_ERROR ("Failed to bind %s: %s", listener->key, error->message);
+    g_clear_error (&error);
+    g_clear_object (&loop->service);
+    return FALSE;
+  }
+
+  g_signal_connect (loop->service, "incoming",
+      G_CALLBACK (on_incoming_connection), loop);
+
+  rtmp2_timer_wheel_start (&loop->wheel, loop->context);
 
-    data_size = map.size;
-    
-    /* FLV tag header */
-    tag_header[0] = tag->tag_type;
-    tag_header[1] = (data_size >> 16) & 0xFF;
-    tag_header[2] = (data_size >> 8) & 0xFF;
-    tag_header[3] = data_size & 0xFF;
-    tag_header[4] = (tag->timestamp >> 16) & 0xFF;
-    tag_header[5] = (tag->timestamp >> 8) & 0xFF;
-    tag_header[6] = tag->timestamp & 0xFF;
-    tag_header[7] = (tag->timestamp >> 24) & 0xFF;  /* Extended timestamp */
-    tag_header[8] = 0;  /* Stream ID (always 0) */
-    tag_header[9] = 0;
-    tag_header[10] = 0;
-
-    prev_tag_size = 11 + data_size;
-
-    /* Create buffer: header + data + prev_tag_size */
-    flv_buffer = gst_buffer_new_allocate (NULL, 11 + data_size + 4, NULL);
-    gst_buffer_fill (flv_buffer, 0, tag_header, 11);
-    gst_buffer_fill (flv_buffer, 11, map.data, data_size);
-    
-    /* Previous tag size (big endian) */
-    guint8 pts_bytes[4] = {
-      (prev_tag_size >> 24) & 0xFF,
-      (prev_tag_size >> 16) & 0xFF,
-      (prev_tag_size >> 8) & 0xFF,
-      prev_tag_size & 0xFF
-    };
-    gst_buffer_fill (flv_buffer, 11 + data_size, pts_bytes, 4);
+  /* Start the service - signals will be delivered on this thread */
+  g_socket_service_start (loop->service);
 
-    gst_buffer_unmap (tag->data, &map);
+  GST_INFO ("Server listening on %s", listener->key);
 
-    /* Set buffer timestamp */
-    GST_BUFFER_PTS (flv_buffer) = tag->timestamp * GST_MSECOND;
+  return TRUE;
+}
 
-    ret = gst_pad_push (src->srcpad, flv_buffer);
-  if (ret != GST_FLOW_OK) {
-      GST_WARNING_OBJECT (src, "Pad push returned %s", gst_flow_get_name (ret));
-    }
+static void
+rtmp2_server_loop_stop (Rtmp2ServerLoop *loop)
+{
+  if (loop->service) {
+    g_socket_service_stop (loop->service);
+    g_clear_object (&loop->service);
   }
-  
-  rtmp2_flv_tag_free (tag);
+
+  rtmp2_timer_wheel_stop (&loop->wheel);
 }
 
 /* Event loop thread function - creates and runs the socket service */
 static gpointer
 event_loop_thread_func (gpointer user_data)
 {
-  GstRtmp2ServerSrc *src = GST_RTMP2_SERVER_SRC (user_data);
-  GError *error = NULL;
-  GInetAddress *addr;
-  GSocketAddress *saddr;
+  Rtmp2ServerLoop *loop = user_data;
+  Rtmp2ServerListener *listener = loop->listener;
   
-  GST_INFO_OBJECT (src, "Event loop thread started");
+  GST_INFO ("Event loop thread %u for %s started", loop->index,
+      listener->key);
   
   /* Push our context as thread default - socket service will use this */
-  g_main_context_push_thread_default (src->context);
+  g_main_context_push_thread_default (loop->context);
 
   /* Create socket service in THIS thread */
-  src->service = g_socket_service_new ();
+  if (!rtmp2_server_loop_start (loop)) {
+    g_mutex_lock (&listener->start_lock);
+    listener->start_error = TRUE;
+    g_cond_signal (&listener->start_cond);
+    g_mutex_unlock (&listener->start_lock);
+    g_main_context_pop_thread_default (loop->context);
+    return NULL;
+  }
 
-  addr = g_inet_address_new_from_string (src->host);
-  if (!addr) {
-    addr = g_inet_address_new_any (G_SOCKET_FAMILY_IPV4);
+  /* Signal that startup is complete */
+  g_mutex_lock (&listener->start_lock);
+  listener->n_started++;
+  g_cond_signal (&listener->start_cond);
+  g_mutex_unlock (&listener->start_lock);
+
+  /* Run the event loop */
+  while (listener->running) {
+    g_main_context_iteration (loop->context, TRUE);
   }
 
-  saddr = g_inet_socket_address_new (addr, src->port);
-  g_object_unref (addr);
+  /* Cleanup */
+  rtmp2_server_loop_stop (loop);
 
-  if (!g_socket_listener_add_address (G_SOCKET_LISTENER (src->service),
-          saddr, G_SOCKET_TYPE_STREAM, G_SOCKET_PROTOCOL_TCP, NULL, NULL, &error)) {
-    GST_ERROR_OBJECT (src, "Failed to bind: %s", error->message);
-    g_clear_error (&error);
-    g_object_unref (saddr);
-    g_clear_object (&src->service);
-    src->start_error = TRUE;
-    g_cond_signal (&src->start_cond);
-    g_main_context_pop_thread_default (src->context);
-    return NULL;
+  g_main_context_pop_thread_default (loop->context);
+
+  GST_INFO ("Event loop thread %u for %s stopping", loop->index,
+      listener->key);
+  return NULL;
+}
+
+typedef struct {
+  GFunc func;
+  gpointer data;
+  GMutex lock;
+  GCond cond;
+  guint pending;               /* event loops that did not run it yet */
+} Rtmp2ServerListenerCall;
+
+typedef struct {
+  Rtmp2ServerListenerCall *call;
+  Rtmp2ServerLoop *loop;
+} Rtmp2ServerListenerCallItem;
+
+static void
+rtmp2_server_listener_call_cb (gpointer user_data)
+{
+  Rtmp2ServerListenerCallItem *item = user_data;
+  Rtmp2ServerListenerCall *call = item->call;
+
+  call->func (item->loop, call->data);
+
+  g_mutex_lock (&call->lock);
+  if (--call->pending == 0)
+    g_cond_signal (&call->cond);
+  g_mutex_unlock (&call->lock);
+}
+
+/* Run func (loop, data) on the thread of every event loop of the listener,
+ * after the releases pending there, and wait until all of them did */
+static void
+rtmp2_server_listener_call (Rtmp2ServerListener *listener, GFunc func,
+    gpointer data)
+{
+  Rtmp2ServerListenerCall call = { func, data, };
+  Rtmp2ServerListenerCallItem *items;
+  guint i;
+
+  g_mutex_init (&call.lock);
+  g_cond_init (&call.cond);
+  call.pending = listener->n_loops;
+
+  items = g_new (Rtmp2ServerListenerCallItem, listener->n_loops);
+  for (i = 0; i < listener->n_loops; i++) {
+    items[i].call = &call;
+    items[i].loop = &listener->loops[i];
+    gst_rtmp2_server_src_defer_release (listener->loops[i].context,
+        rtmp2_server_listener_call_cb, &items[i]);
   }
-  g_object_unref (saddr);
 
-  g_signal_connect (src->service, "incoming",
-      G_CALLBACK (on_incoming_connection), src);
+  g_mutex_lock (&call.lock);
+  while (call.pending > 0)
+    g_cond_wait (&call.cond, &call.lock);
+  g_mutex_unlock (&call.lock);
 
-  /* Start the service - signals will be delivered on this thread */
-  g_socket_service_start (src->service);
+  g_free (items);
+  g_mutex_clear (&call.lock);
+  g_cond_clear (&call.cond);
+}
 
-  GST_INFO_OBJECT (src, "Server listening on %s:%u", src->host, src->port);
+static void
+rtmp2_server_listener_start_cb (gpointer loop, gpointer user_data)
+{
+  Rtmp2ServerListener *listener = user_data;
 
-  /* Signal that startup is complete */
-  g_mutex_lock (&src->start_lock);
-  src->start_complete = TRUE;
-  g_cond_signal (&src->start_cond);
-  g_mutex_unlock (&src->start_lock);
+  if (!listener->start_error && !rtmp2_server_loop_start (loop))
+    listener->start_error = TRUE;
+}
 
-  /* Run the event loop */
-  while (src->running) {
-    g_main_context_iteration (src->context, TRUE);
+static void
+rtmp2_server_listener_stop_cb (gpointer loop, gpointer user_data)
+{
+  rtmp2_server_loop_stop (loop);
+}
+
+/* Start the event loops: on their own threads, or on the workers of the
+ * shared pool. Returns FALSE if binding failed. */
+static gboolean
+rtmp2_server_listener_start (Rtmp2ServerListener *listener)
+{
+  guint i;
+
+  listener->running = TRUE;
+
+  if (listener->pooled) {
+    rtmp2_server_listener_call (listener, rtmp2_server_listener_start_cb,
+        listener);
+    return !listener->start_error;
   }
 
-  /* Cleanup */
-  if (src->service) {
-    g_socket_service_stop (src->service);
-    g_clear_object (&src->service);
+  /* Start the event loop threads one by one - each creates its socket
+   * service and binds */
+  for (i = 0; i < listener->n_loops && !listener->start_error; i++) {
+    Rtmp2ServerLoop *loop = &listener->loops[i];
+
+    loop->thread = g_thread_new ("rtmp-event-loop", event_loop_thread_func,
+        loop);
+
+    /* Wait for the thread to finish startup */
+    g_mutex_lock (&listener->start_lock);
+    while (listener->n_started <= i && !listener->start_error) {
+      g_cond_wait (&listener->start_cond, &listener->start_lock);
+    }
+    g_mutex_unlock (&listener->start_lock);
   }
 
-  g_main_context_pop_thread_default (src->context);
+  return !listener->start_error;
+}
+
+/* Close the listening sockets. Event loops of their own are woken up and
+ * their threads joined. */
+static void
+rtmp2_server_listener_stop (Rtmp2ServerListener *listener)
+{
+  guint i;
 
-  GST_INFO_OBJECT (src, "Event loop thread stopping");
-  return NULL;
+  listener->running = FALSE;
+
+  if (listener->pooled) {
+    rtmp2_server_listener_call (listener, rtmp2_server_listener_stop_cb,
+        NULL);
+    return;
+  }
+
+  for (i = 0; i < listener->n_loops; i++) {
+    Rtmp2ServerLoop *loop = &listener->loops[i];
+
+    if (loop->thread) {
+      g_main_context_wakeup (loop->context);
+      g_thread_join (loop->thread);
+      loop->thread = NULL;
+    }
+  }
 }
 
-/* State change */
-static gboolean
-gst_rtmp2_server_src_start (GstRtmp2ServerSrc *src)
+static void
+rtmp2_server_listener_free (Rtmp2ServerListener *listener)
 {
-  GST_DEBUG_OBJECT (src, "Starting server on %s:%u", src->host, src->port);
+  guint i;
+
+  /* Runs the releases still pending on contexts of our own */
+  for (i = 0; i < listener->n_loops; i++)
+    g_main_context_unref (listener->loops[i].context);
+  for (i = 0; i < listener->n_loops; i++)
+    rtmp2_timer_wheel_clear (&listener->loops[i].wheel);
+
+  g_mutex_clear (&listener->start_lock);
+  g_cond_clear (&listener->start_cond);
+  if (listener->pooled)
+    rtmp2_server_pool_release ();
+  g_free (listener->loops);
+  g_free (listener->host);
+  g_free (listener->key);
+  g_free (listener);
+}
+
+/* Add the element to the listener on its address and port, creating it
+ * and binding the port if it is the first one there. The first element
+ * also decides the number of event loops and whether they run on the
+ * shared pool. Returns NULL if binding failed. */
+static Rtmp2ServerListener *
+rtmp2_server_listener_acquire (GstRtmp2ServerSrc *src)
+{
+  Rtmp2ServerListener *listener;
+  Rtmp2ServerPool *pool = NULL;
+  gchar *key = g_strdup_printf ("%s:%u", src->host, src->port);
+  guint i;
+
+  g_mutex_lock (&listeners_acquire_lock);
+
+  g_mutex_lock (&listeners_lock);
+  if (!listeners)
+    listeners = g_hash_table_new (g_str_hash, g_str_equal);
+
+  listener = g_hash_table_lookup (listeners, key);
+  if (listener) {
+    GST_INFO_OBJECT (src, "Sharing the listener on %s", key);
+    if (src->io_threads != listener->n_loops)
+      GST_INFO_OBJECT (src, "Using the %u event loop threads of the "
+          "listener instead of %u", listener->n_loops, src->io_threads);
+    g_free (key);
+    goto done;
+  }
+  g_mutex_unlock (&listeners_lock);
+
+  listener = g_new0 (Rtmp2ServerListener, 1);
+  listener->key = key;
+  listener->host = g_strdup (src->host);
+  listener->port = src->port;
+  listener->n_loops = src->io_threads;
+  listener->pooled = src->shared_pool;
+#ifndef SO_REUSEPORT
+  if (listener->n_loops > 1) {
+    GST_WARNING_OBJECT (src, "SO_REUSEPORT is not supported on this "
+        "platform, using a single event loop thread");
+    listener->n_loops = 1;
+  }
+#endif
+  /* The listener may outlive the element that made it pooled */
+  if (listener->pooled)
+    pool = rtmp2_server_pool_acquire ();
+  listener->loops = g_new0 (Rtmp2ServerLoop, listener->n_loops);
+  for (i = 0; i < listener->n_loops; i++) {
+    Rtmp2ServerLoop *loop = &listener->loops[i];
+
+    loop->listener = listener;
+    loop->index = i;
+    rtmp2_timer_wheel_init (&loop->wheel,
+        (Rtmp2TimerFunc) server_session_expire);
+    if (listener->pooled) {
+      /* Spread the listeners over the workers */
+      loop->context = g_main_context_ref (
+          pool->workers[pool->next_worker++ % pool->n_workers].context);
+    } else {
+      loop->context = g_main_context_new ();
+    }
+  }
+  g_mutex_init (&listener->start_lock);
+  g_cond_init (&listener->start_cond);
+
+  /* Without holding listeners_lock, pool workers may need it meanwhile */
+  if (!rtmp2_server_listener_start (listener)) {
+    g_mutex_unlock (&listeners_acquire_lock);
+    rtmp2_server_listener_stop (listener);
+    rtmp2_server_listener_free (listener);
+    return NULL;
+  }
 
-  /* Create main context for socket service */
-  src->context = g_main_context_new ();
+  g_mutex_lock (&listeners_lock);
+  g_hash_table_insert (listeners, listener->key, listener);
 
-  /* Initialize startup synchronization */
-  src->start_complete = FALSE;
-  src->start_error = FALSE;
+done:
+  listener->consumers = g_list_append (listener->consumers, src);
+  g_mutex_unlock (&listeners_lock);
+  g_mutex_unlock (&listeners_acquire_lock);
 
-  src->running = TRUE;
+  return listener;
+}
 
-  /* Start event loop thread - it will create the socket service */
-  src->thread = g_thread_new ("rtmp-event-loop", event_loop_thread_func, src);
-  if (!src->thread) {
-    GST_ERROR_OBJECT (src, "Failed to create event loop thread");
-    g_main_context_unref (src->context);
-    src->context = NULL;
-    return FALSE;
+/* Runs on each event loop thread, which owns the sessions of the leaving
+ * element (user_data) that it accepted. Sessions that did not publish yet,
+ * possibly still shaking hands, go to another element, the others are
+ * closed. */
+static void
+rtmp2_server_listener_detach (gpointer data, gpointer user_data)
+{
+  Rtmp2ServerLoop *loop = data;
+  GstRtmp2ServerSrc *src = user_data;
+  GstRtmp2ServerSrc *heir = NULL;
+  GHashTableIter iter;
+  gpointer value;
+  GList *sessions = NULL, *l;
+
+  g_mutex_lock (&listeners_lock);
+  if (src->listener->consumers)
+    heir = src->listener->consumers->data;
+  g_mutex_unlock (&listeners_lock);
+
+  g_rw_lock_writer_lock (&src->sessions_lock);
+  g_hash_table_iter_init (&iter, src->sessions);
+  while (g_hash_table_iter_next (&iter, NULL, &value)) {
+    ServerSession *session = value;
+
+    if (session->context == loop->context)
+      sessions = g_list_prepend (sessions, session);
+  }
+  for (l = sessions; l; l = l->next) {
+    server_registry_remove_locked (src, l->data);
+    if (src->output->session == l->data)
+      src->output->session = NULL;
+  }
+  g_rw_lock_writer_unlock (&src->sessions_lock);
+
+  for (l = sessions; l; l = l->next) {
+    ServerSession *session = l->data;
+
+    if (heir && !session->output &&
+        session->state != SERVER_SESSION_STATE_DISCONNECTED)
+      server_session_move (session, heir);
+    else
+      server_session_free (session);
   }
+  g_list_free (sessions);
+}
 
-  /* Wait for the thread to finish startup */
-  g_mutex_lock (&src->start_lock);
-  while (!src->start_complete && !src->start_error) {
-    g_cond_wait (&src->start_cond, &src->start_lock);
+/* Remove the element from its listener. The last element stops the event
+ * loops and closes the port. */
+static void
+rtmp2_server_listener_release (GstRtmp2ServerSrc *src)
+{
+  Rtmp2ServerListener *listener = src->listener;
+  gboolean last;
+
+  g_mutex_lock (&listeners_lock);
+  listener->consumers = g_list_remove (listener->consumers, src);
+  last = listener->consumers == NULL;
+  if (last)
+    g_hash_table_remove (listeners, listener->key);
+  g_mutex_unlock (&listeners_lock);
+
+  /* Once threads of our own stopped, the sessions are left over. Shared
+   * workers keep running, so the sessions are closed on them. */
+  if (!last || listener->pooled)
+    rtmp2_server_listener_call (listener, rtmp2_server_listener_detach, src);
+
+  if (last) {
+    rtmp2_server_listener_stop (listener);
+    rtmp2_server_listener_free (listener);
   }
-  g_mutex_unlock (&src->start_lock);
+}
+
+/* State change */
+static gboolean
+gst_rtmp2_server_src_start (GstRtmp2ServerSrc *src)
+{
+  GST_DEBUG_OBJECT (src, "Starting server on %s:%u", src->host, src->port);
 
-  if (src->start_error) {
+  if (src->shared_pool)
+    rtmp2_server_pool_acquire ();
+  src->output->pooled = src->shared_pool;
+  server_output_set_flushing (src->output, FALSE);
+
+  if (src->multi_stream &&
+      src->output_mode == GST_RTMP2_SERVER_SRC_OUTPUT_ELEMENTARY)
+    GST_ELEMENT_WARNING (src, CORE, NOT_IMPLEMENTED,
+        ("Multi-stream pads only output FLV"),
+        ("output-mode=elementary does not apply with multi-stream"));
+
+  src->listener = rtmp2_server_listener_acquire (src);
+  if (!src->listener) {
     GST_ERROR_OBJECT (src, "Failed to start server");
-    src->running = FALSE;
-    g_thread_join (src->thread);
-    src->thread = NULL;
-    g_main_context_unref (src->context);
-    src->context = NULL;
+    server_output_set_flushing (src->output, TRUE);
+    if (src->output->pooled)
+      rtmp2_server_pool_release ();
     return FALSE;
   }
 
   GST_INFO_OBJECT (src, "Server started successfully");
 
-  /* Start task */
-  gst_task_start (src->task);
+  /* As a live source, the task only runs in PLAYING. Tags queue up
+   * until then. */
 
   return TRUE;
 }
@@ -709,43 +4077,92 @@ gst_rtmp2_server_src_start (GstRtmp2ServerSrc *src)
 static gboolean
 gst_rtmp2_server_src_stop (GstRtmp2ServerSrc *src)
 {
-  GST_DEBUG_OBJECT (src, "Stopping server");
+  GList *outputs, *sessions, *l;
 
-  src->running = FALSE;
+  GST_DEBUG_OBJECT (src, "Stopping server");
 
-  /* Stop task */
-  gst_task_stop (src->task);
-  gst_task_join (src->task);
+  /* Take over the multi-stream outputs, a retiring output finds itself
+   * gone and leaves its release to us */
+  g_rw_lock_writer_lock (&src->sessions_lock);
+  outputs = g_hash_table_get_values (src->outputs);
+  g_hash_table_remove_all (src->outputs);
+  g_rw_lock_writer_unlock (&src->sessions_lock);
+
+  /* Unblock the tasks if they are waiting for data */
+  server_output_set_flushing (src->output, TRUE);
+  for (l = outputs; l; l = l->next)
+    server_output_set_flushing (l->data, TRUE);
+
+  /* Stop tasks */
+  server_output_stop (src->output);
+  server_output_join (src->output);
+  for (l = outputs; l; l = l->next) {
+    Rtmp2ServerSrcOutput *output = l->data;
+
+    server_output_stop (output);
+    server_output_join (output);
+  }
 
-  /* Wake up event loop and wait for thread to finish */
-  if (src->context)
-    g_main_context_wakeup (src->context);
-  if (src->thread) {
-    g_thread_join (src->thread);
-    src->thread = NULL;
+  /* Leave the listener, the sessions are left over once it stopped */
+  if (src->listener) {
+    rtmp2_server_listener_release (src);
+    src->listener = NULL;
   }
 
-  /* Service is cleaned up by the event loop thread */
-  src->service = NULL;
+  /* Free sessions, their event loops are gone */
+  g_rw_lock_writer_lock (&src->sessions_lock);
+  sessions = g_hash_table_get_values (src->sessions);
+  for (l = sessions; l; l = l->next) {
+    ServerSession *session = l->data;
 
-  /* Free context */
-  if (src->context) {
-    g_main_context_unref (src->context);
-    src->context = NULL;
+    session->loop = NULL;
+    session->wheel = NULL;
   }
+  g_hash_table_remove_all (src->sessions);
+  g_atomic_int_set (&src->n_sessions, 0);
+  g_hash_table_remove_all (src->streams);
+  src->output->session = NULL;
+  g_rw_lock_writer_unlock (&src->sessions_lock);
+  g_list_free_full (sessions, (GDestroyNotify) server_session_free);
+
+  g_list_free_full (outputs, (GDestroyNotify) server_output_free);
 
-  /* Free sessions */
-  g_mutex_lock (&src->sessions_lock);
-  g_list_free_full (src->sessions, (GDestroyNotify) server_session_free);
-  src->sessions = NULL;
-  src->active_session = NULL;
-  g_mutex_unlock (&src->sessions_lock);
+  src->output->started = FALSE;
+  gst_rtmp2_server_src_remove_es_pads (src->output);
 
-  src->srcpad_started = FALSE;
+  if (src->output->pooled)
+    rtmp2_server_pool_release ();
 
   return TRUE;
 }
 
+static void
+server_output_set_running (Rtmp2ServerSrcOutput *output, gboolean running)
+{
+  if (running) {
+    server_output_start (output);
+  } else {
+    server_output_pause (output);
+    gst_rtmp2_server_src_wakeup_full (output, FALSE);
+  }
+}
+
+/* As a live source, the tasks only run in PLAYING */
+static void
+gst_rtmp2_server_src_set_playing (GstRtmp2ServerSrc *src, gboolean playing)
+{
+  GHashTableIter iter;
+  gpointer value;
+
+  g_rw_lock_writer_lock (&src->sessions_lock);
+  src->playing = playing;
+  server_output_set_running (src->output, playing);
+  g_hash_table_iter_init (&iter, src->outputs);
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    server_output_set_running (value, playing);
+  g_rw_lock_writer_unlock (&src->sessions_lock);
+}
+
 static GstStateChangeReturn
 gst_rtmp2_server_src_change_state (GstElement *element, GstStateChange transition)
 {
@@ -759,13 +4176,25 @@ gst_rtmp2_server_src_change_state (GstElement *element, GstStateChange transitio
       if (!gst_rtmp2_server_src_start (src))
         return GST_STATE_CHANGE_FAILURE;
       break;
+    case GST_STATE_CHANGE_PAUSED_TO_PLAYING:
+      gst_rtmp2_server_src_set_playing (src, TRUE);
+      break;
+    case GST_STATE_CHANGE_PLAYING_TO_PAUSED:
+      gst_rtmp2_server_src_set_playing (src, FALSE);
+      break;
     default:
       break;
   }
 
   ret = GST_ELEMENT_CLASS (parent_class)->change_state (element, transition);
+  if (ret == GST_STATE_CHANGE_FAILURE)
+    return ret;
 
   switch (transition) {
+    case GST_STATE_CHANGE_READY_TO_PAUSED:
+    case GST_STATE_CHANGE_PLAYING_TO_PAUSED:
+      ret = GST_STATE_CHANGE_NO_PREROLL;
+      break;
     case GST_STATE_CHANGE_PAUSED_TO_READY:
       gst_rtmp2_server_src_stop (src);
       break;
@@ -789,6 +4218,23 @@ gst_rtmp2_server_src_class_init (GstRtmp2ServerSrcClass *klass)
 
   gstelement_class->change_state = GST_DEBUG_FUNCPTR (gst_rtmp2_server_src_change_state);
 
+  klass->reload_stream_keys = gst_rtmp2_server_src_reload_stream_keys;
+
+  /**
+   * GstRtmp2ServerSrc::reload-stream-keys:
+   * @src: the #GstRtmp2ServerSrc
+   *
+   * Read #GstRtmp2ServerSrc:stream-keys-file again and swap in its keys.
+   * Publishing sessions are not affected.
+   *
+   * Returns: %FALSE if the file could not be read, the keys stay unchanged
+   */
+  signals[SIGNAL_RELOAD_STREAM_KEYS] =
+      g_signal_new ("reload-stream-keys", G_TYPE_FROM_CLASS (klass),
+      G_SIGNAL_RUN_LAST | G_SIGNAL_ACTION,
+      G_STRUCT_OFFSET (GstRtmp2ServerSrcClass, reload_stream_keys), NULL, NULL,
+      NULL, G_TYPE_BOOLEAN, 0);
+
   g_object_class_install_property (gobject_class, PROP_HOST,
       g_param_spec_string ("host", "Host",
           "Address to bind to", "0.0.0.0",
@@ -801,7 +4247,7 @@ gst_rtmp2_server_src_class_init (GstRtmp2ServerSrcClass *klass)
 
   g_object_class_install_property (gobject_class, PROP_APPLICATION,
       g_param_spec_string ("application", "Application",
-          "RTMP application name", "live",
+          "If set, only consume publishers of this RTMP application", NULL,
           G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 
   g_object_class_install_property (gobject_class, PROP_STREAM_KEY,
@@ -809,16 +4255,218 @@ gst_rtmp2_server_src_class_init (GstRtmp2ServerSrcClass *klass)
           "If set, only accept this stream key", NULL,
           G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 
+  g_object_class_install_property (gobject_class, PROP_STREAM_KEYS,
+      g_param_spec_boxed ("stream-keys", "Stream Keys",
+          "Stream keys allowed to publish, NULL allows any. Can be replaced "
+          "at any time without affecting live sessions.", G_TYPE_STRV,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_STREAM_KEYS_FILE,
+      g_param_spec_string ("stream-keys-file", "Stream Keys File",
+          "File with the stream keys allowed to publish, one per line. "
+          "Loaded when set and on the reload-stream-keys action.", NULL,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
   g_object_class_install_property (gobject_class, PROP_TIMEOUT,
       g_param_spec_uint ("timeout", "Timeout",
-          "Client timeout in seconds", 1, 3600, 30,
+          "Seconds without media after which a publisher is disconnected",
+          1, 3600, 30,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_HANDSHAKE_TIMEOUT,
+      g_param_spec_uint ("handshake-timeout", "Handshake Timeout",
+          "Seconds a new connection has to complete the RTMP handshake "
+          "(0 = unlimited)", 0, 3600, 10,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_PUBLISH_TIMEOUT,
+      g_param_spec_uint ("publish-timeout", "Publish Timeout",
+          "Seconds a client has from the handshake to publishing "
+          "(0 = unlimited)", 0, 3600, 30,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_CHUNK_SIZE,
+      g_param_spec_uint ("chunk-size", "Chunk Size",
+          "Chunk size announced with Set Chunk Size on connect "
+          "(0 = keep the default of 128)", 0, GST_RTMP_MAXIMUM_CHUNK_SIZE,
+          4096, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_WINDOW_ACK_SIZE,
+      g_param_spec_uint ("window-ack-size", "Window Acknowledgement Size",
+          "Bytes the client may send between acknowledgements, announced on "
+          "connect (0 = don't send)", 0, G_MAXUINT32, 2500000,
           G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 
+  g_object_class_install_property (gobject_class, PROP_PEER_BANDWIDTH,
+      g_param_spec_uint ("peer-bandwidth", "Peer Bandwidth",
+          "Output window requested from the client with a dynamic Set Peer "
+          "Bandwidth on connect (0 = don't send)", 0, G_MAXUINT32, 2500000,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_IO_THREADS,
+      g_param_spec_uint ("io-threads", "I/O Threads",
+          "Number of event loop threads accepting and serving connections, "
+          "each with its own SO_REUSEPORT listening socket. Taken from the "
+          "first element on a shared port.", 1, 64, 1,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+
+  g_object_class_install_property (gobject_class, PROP_SHARED_POOL,
+      g_param_spec_boolean ("shared-pool", "Shared Pool",
+          "Serve connections and push output on process-wide workers, one "
+          "per core, instead of threads of this element. The event loops "
+          "of a shared port follow its first element.", FALSE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+
   g_object_class_install_property (gobject_class, PROP_LOOP,
       g_param_spec_boolean ("loop", "Loop",
           "Keep listening for new connections after client disconnects", FALSE,
           G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 
+  g_object_class_install_property (gobject_class, PROP_SEAMLESS_SWITCH,
+      g_param_spec_boolean ("seamless-switch", "Seamless Switch",
+          "In loop mode, keep the output stream when a client disconnects "
+          "and continue its timeline with the next client's first keyframe",
+          FALSE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_DIRECT_PUSH,
+      g_param_spec_boolean ("direct-push", "Direct Push",
+          "Push tags downstream straight from the connection's input handler "
+          "while nothing is queued and its event loop serves no other "
+          "connection, bypassing the streaming task. Not done with "
+          "shared-pool", FALSE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_MULTI_STREAM,
+      g_param_spec_boolean ("multi-stream", "Multi Stream",
+          "Accept any number of concurrent publishers and output each "
+          "application/stream key on its own src_%s sometimes pad, with its "
+          "own queue and streaming task", FALSE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+
+  g_object_class_install_property (gobject_class, PROP_OUTPUT_MODE,
+      g_param_spec_enum ("output-mode", "Output Mode",
+          "Output an FLV stream or elementary streams on sometimes pads",
+          GST_TYPE_RTMP2_SERVER_SRC_OUTPUT_MODE,
+          GST_RTMP2_SERVER_SRC_OUTPUT_FLV,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+
+  g_object_class_install_property (gobject_class, PROP_DO_TIMESTAMP,
+      g_param_spec_boolean ("do-timestamp", "Do timestamp",
+          "Timestamp buffers with the running time at which they arrived "
+          "instead of the publisher's timestamps", FALSE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_SEGMENT_FORMAT,
+      g_param_spec_enum ("segment-format", "Segment Format",
+          "Format of the segment on the FLV src pad (bytes or time)",
+          GST_TYPE_FORMAT, GST_FORMAT_BYTES,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+
+  g_object_class_install_property (gobject_class, PROP_GOP_CACHE_MAX_BYTES,
+      g_param_spec_uint ("gop-cache-max-bytes", "GOP Cache Max Bytes",
+          "Cache the sequence headers, metadata and current GOP of each "
+          "client up to this many bytes, and replay them when output starts "
+          "or a pad gets linked (0 = disabled)", 0, G_MAXUINT, 0,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_MAX_QUEUE_TAGS,
+      g_param_spec_uint ("max-queue-tags", "Max Queue Tags",
+          "Capacity of the per-client tag queue, rounded up to a power of two. "
+          "When full, new frames are dropped and video resumes on the next "
+          "keyframe", 16, 1 << 20, 1024,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_MAX_QUEUE_BYTES,
+      g_param_spec_uint ("max-queue-bytes", "Max Queue Bytes",
+          "Maximum payload bytes queued per client, enforced by the leaky "
+          "policy (0 = unlimited)",
+          0, G_MAXUINT, 0,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_MAX_QUEUE_TIME,
+      g_param_spec_uint64 ("max-queue-time", "Max Queue Time",
+          "Maximum timestamp span of the queued tags in nanoseconds, "
+          "enforced by the leaky policy (0 = unlimited)", 0, G_MAXUINT64, 0,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_MAX_LATENCY,
+      g_param_spec_uint64 ("max-latency", "Max Latency",
+          "Maximum time a tag may wait in the queue in nanoseconds, "
+          "enforced by the leaky policy (0 = unlimited)", 0, G_MAXUINT64, 0,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_LEAKY,
+      g_param_spec_enum ("leaky", "Leaky",
+          "What to drop when the queue exceeds its limits",
+          GST_TYPE_RTMP2_SERVER_SRC_LEAKY, GST_RTMP2_SERVER_SRC_LEAKY_NONE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_HIGH_WATERMARK,
+      g_param_spec_uint ("high-watermark", "High Watermark",
+          "Queued bytes at which reading from the publisher pauses for "
+          "lossless flow control (0 = disabled)", 0, G_MAXUINT, 0,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_LOW_WATERMARK,
+      g_param_spec_uint ("low-watermark", "Low Watermark",
+          "Queued bytes at which reading from the publisher resumes",
+          0, G_MAXUINT, 0,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_MAX_BATCH_TAGS,
+      g_param_spec_uint ("max-batch-tags", "Max Batch Tags",
+          "Maximum number of queued tags pushed as one buffer list "
+          "(1 = push every tag on its own, 0 = unlimited)", 0, G_MAXUINT, 1,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_MAX_BATCH_BYTES,
+      g_param_spec_uint ("max-batch-bytes", "Max Batch Bytes",
+          "Maximum payload size of a batch in bytes (0 = unlimited)",
+          0, G_MAXUINT, 0,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_MAX_BATCH_TIME,
+      g_param_spec_uint64 ("max-batch-time", "Max Batch Time",
+          "Maximum timestamp span of a batch in nanoseconds (0 = unlimited)",
+          0, G_MAXUINT64, 0,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_MAX_CONNECTIONS,
+      g_param_spec_uint ("max-connections", "Max Connections",
+          "Maximum clients connected to the port, more are refused when "
+          "accepted (0 = unlimited)", 0, G_MAXUINT, 0,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_MAX_PENDING_HANDSHAKES,
+      g_param_spec_uint ("max-pending-handshakes", "Max Pending Handshakes",
+          "Maximum connections on the port still in the RTMP handshake, more "
+          "are refused when accepted (0 = unlimited)", 0, G_MAXUINT, 0,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_MAX_SESSION_BYTES,
+      g_param_spec_uint ("max-session-bytes", "Max Session Bytes",
+          "Maximum bytes a client may hold in its queue and GOP cache, a "
+          "client above it is disconnected (0 = unlimited)", 0, G_MAXUINT, 0,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_MAX_TOTAL_BYTES,
+      g_param_spec_uint ("max-total-bytes", "Max Total Bytes",
+          "Maximum payload bytes queued by the clients of all elements in "
+          "the process, above it this element drops tags as on a full queue "
+          "(0 = unlimited)", 0, G_MAXUINT, 0,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_STATS,
+      g_param_spec_boxed ("stats", "Stats",
+          "Statistics of the active client's tag queue", GST_TYPE_STRUCTURE,
+          G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
   gst_element_class_set_static_metadata (gstelement_class,
       "RTMP2 Server Source",
       "Source/Network",
@@ -826,9 +4474,16 @@ gst_rtmp2_server_src_class_init (GstRtmp2ServerSrcClass *klass)
       "Yaron Torbaty <yarontorbaty@gmail.com>");
 
   gst_element_class_add_static_pad_template (gstelement_class, &src_template);
+  gst_element_class_add_static_pad_template (gstelement_class,
+      &stream_template);
+  gst_element_class_add_static_pad_template (gstelement_class, &video_template);
+  gst_element_class_add_static_pad_template (gstelement_class, &audio_template);
 
   GST_DEBUG_CATEGORY_INIT (gst_rtmp2_server_src_debug, "rtmp2serversrc", 0,
       "RTMP2 Server Source");
+
+  gst_type_mark_as_plugin_api (GST_TYPE_RTMP2_SERVER_SRC_LEAKY, 0);
+  gst_type_mark_as_plugin_api (GST_TYPE_RTMP2_SERVER_SRC_OUTPUT_MODE, 0);
 }
 
 static void
@@ -836,37 +4491,50 @@ gst_rtmp2_server_src_init (GstRtmp2ServerSrc *src)
 {
   src->host = g_strdup ("0.0.0.0");
   src->port = 1935;
-  src->application = g_strdup ("live");
+  src->application = NULL;
   src->stream_key = NULL;
+  src->stream_keys_file = NULL;
   src->timeout = 30;
-
-  src->service = NULL;
-  src->context = NULL;
-  src->thread = NULL;
-    src->running = FALSE;
-
-  /* Startup synchronization */
-  g_mutex_init (&src->start_lock);
-  g_cond_init (&src->start_cond);
-  src->start_complete = FALSE;
-  src->start_error = FALSE;
-
-  src->sessions = NULL;
-  g_mutex_init (&src->sessions_lock);
-  src->active_session = NULL;
-
-  src->srcpad = gst_pad_new_from_static_template (&src_template, "src");
-  gst_pad_use_fixed_caps (src->srcpad);
-  gst_element_add_pad (GST_ELEMENT (src), src->srcpad);
-  src->srcpad_started = FALSE;
-  src->eos_wait_start = 0;
-
-  g_rec_mutex_init (&src->task_lock);
-  src->task = gst_task_new ((GstTaskFunction) gst_rtmp2_server_src_loop, src, NULL);
-  gst_task_set_lock (src->task, &src->task_lock);
-
-  src->have_video = FALSE;
-  src->have_audio = FALSE;
+  src->handshake_timeout = 10;
+  src->publish_timeout = 30;
+  src->chunk_size = 4096;
+  src->window_ack_size = 2500000;
+  src->peer_bandwidth = 2500000;
+  src->io_threads = 1;
+  src->shared_pool = FALSE;
+  src->max_queue_tags = 1024;
+  src->max_queue_bytes = 0;
+  src->max_queue_time = 0;
+  src->max_latency = 0;
+  src->leaky = GST_RTMP2_SERVER_SRC_LEAKY_NONE;
+  src->high_watermark = 0;
+  src->low_watermark = 0;
+  src->max_batch_tags = 1;
+  src->max_batch_bytes = 0;
+  src->max_batch_time = 0;
+  src->max_connections = 0;
+  src->max_pending_handshakes = 0;
+  src->max_session_bytes = 0;
+  src->max_total_bytes = 0;
+
+  src->listener = NULL;
+
+  src->sessions = g_hash_table_new (g_direct_hash, g_direct_equal);
+  src->streams = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+      (GDestroyNotify) g_queue_free);
+  g_rw_lock_init (&src->sessions_lock);
+  g_mutex_init (&src->route_lock);
+  g_mutex_init (&src->keys_lock);
+  src->outputs = g_hash_table_new (g_str_hash, g_str_equal);
+  src->playing = FALSE;
+
+  src->output = server_output_new (src, NULL, NULL);
+  gst_element_add_pad (GST_ELEMENT (src), src->output->srcpad);
+  src->multi_stream = FALSE;
+  src->output_mode = GST_RTMP2_SERVER_SRC_OUTPUT_FLV;
+  src->do_timestamp = FALSE;
+  src->segment_format = GST_FORMAT_BYTES;
+  src->gop_cache_max_bytes = 0;
 }
 
 static void
@@ -877,18 +4545,33 @@ gst_rtmp2_server_src_finalize (GObject *object)
   g_free (src->host);
   g_free (src->application);
   g_free (src->stream_key);
+  g_free (src->stream_keys_file);
+
+  g_rw_lock_clear (&src->sessions_lock);
+  g_mutex_clear (&src->route_lock);
+  g_mutex_clear (&src->keys_lock);
+  if (src->keys)
+    g_hash_table_unref (src->keys);
+  g_hash_table_unref (src->sessions);
+  g_hash_table_unref (src->streams);
+  g_hash_table_unref (src->outputs);
+  server_output_free (src->output);
 
-  g_mutex_clear (&src->sessions_lock);
-  g_mutex_clear (&src->start_lock);
-  g_cond_clear (&src->start_cond);
-  g_rec_mutex_clear (&src->task_lock);
+  G_OBJECT_CLASS (parent_class)->finalize (object);
+}
 
-  if (src->task) {
-    gst_object_unref (src->task);
-    src->task = NULL;
-  }
+/* The always "src" pad only exists in FLV output mode, elementary streams
+ * go out on their sometimes pads alone */
+static void
+gst_rtmp2_server_src_update_src_pad (GstRtmp2ServerSrc *src)
+{
+  GstPad *pad = src->output->srcpad;
+  gboolean added = GST_OBJECT_PARENT (pad) == GST_OBJECT_CAST (src);
 
-  G_OBJECT_CLASS (parent_class)->finalize (object);
+  if (src->output_mode == GST_RTMP2_SERVER_SRC_OUTPUT_FLV && !added)
+    gst_element_add_pad (GST_ELEMENT (src), pad);
+  else if (src->output_mode != GST_RTMP2_SERVER_SRC_OUTPUT_FLV && added)
+    gst_element_remove_pad (GST_ELEMENT (src), pad);
 }
 
 static void
@@ -913,12 +4596,118 @@ gst_rtmp2_server_src_set_property (GObject *object, guint prop_id,
       g_free (src->stream_key);
       src->stream_key = g_value_dup_string (value);
       break;
+    case PROP_STREAM_KEYS:{
+      const gchar *const *keys = g_value_get_boxed (value);
+
+      gst_rtmp2_server_src_set_keys (src,
+          keys ? rtmp2_stream_keys_new (keys, FALSE) : NULL);
+      break;
+    }
+    case PROP_STREAM_KEYS_FILE:
+      GST_OBJECT_LOCK (src);
+      g_free (src->stream_keys_file);
+      src->stream_keys_file = g_value_dup_string (value);
+      GST_OBJECT_UNLOCK (src);
+      gst_rtmp2_server_src_load_keys (src);
+      break;
     case PROP_TIMEOUT:
       src->timeout = g_value_get_uint (value);
       break;
+    case PROP_HANDSHAKE_TIMEOUT:
+      src->handshake_timeout = g_value_get_uint (value);
+      break;
+    case PROP_PUBLISH_TIMEOUT:
+      src->publish_timeout = g_value_get_uint (value);
+      break;
+    case PROP_CHUNK_SIZE:
+      src->chunk_size = g_value_get_uint (value);
+      break;
+    case PROP_WINDOW_ACK_SIZE:
+      src->window_ack_size = g_value_get_uint (value);
+      break;
+    case PROP_PEER_BANDWIDTH:
+      src->peer_bandwidth = g_value_get_uint (value);
+      break;
+    case PROP_IO_THREADS:
+      src->io_threads = g_value_get_uint (value);
+      break;
+    case PROP_SHARED_POOL:
+      src->shared_pool = g_value_get_boolean (value);
+      break;
     case PROP_LOOP:
       src->loop = g_value_get_boolean (value);
       break;
+    case PROP_SEAMLESS_SWITCH:
+      src->seamless_switch = g_value_get_boolean (value);
+      break;
+    case PROP_DIRECT_PUSH:
+      src->direct_push = g_value_get_boolean (value);
+      break;
+    case PROP_MULTI_STREAM:
+      src->multi_stream = g_value_get_boolean (value);
+      break;
+    case PROP_OUTPUT_MODE:
+      src->output_mode = g_value_get_enum (value);
+      src->output->mode = src->output_mode;
+      gst_rtmp2_server_src_update_src_pad (src);
+      break;
+    case PROP_DO_TIMESTAMP:
+      src->do_timestamp = g_value_get_boolean (value);
+      break;
+    case PROP_GOP_CACHE_MAX_BYTES:
+      src->gop_cache_max_bytes = g_value_get_uint (value);
+      break;
+    case PROP_SEGMENT_FORMAT:{
+      GstFormat format = g_value_get_enum (value);
+
+      if (format == GST_FORMAT_BYTES || format == GST_FORMAT_TIME)
+        src->segment_format = format;
+      else
+        GST_WARNING_OBJECT (src, "Unsupported segment format %d", format);
+      break;
+    }
+    case PROP_MAX_QUEUE_TAGS:
+      src->max_queue_tags = g_value_get_uint (value);
+      break;
+    case PROP_MAX_QUEUE_BYTES:
+      src->max_queue_bytes = g_value_get_uint (value);
+      break;
+    case PROP_MAX_QUEUE_TIME:
+      src->max_queue_time = g_value_get_uint64 (value);
+      break;
+    case PROP_MAX_LATENCY:
+      src->max_latency = g_value_get_uint64 (value);
+      break;
+    case PROP_LEAKY:
+      src->leaky = g_value_get_enum (value);
+      break;
+    case PROP_HIGH_WATERMARK:
+      src->high_watermark = g_value_get_uint (value);
+      break;
+    case PROP_LOW_WATERMARK:
+      src->low_watermark = g_value_get_uint (value);
+      break;
+    case PROP_MAX_BATCH_TAGS:
+      src->max_batch_tags = g_value_get_uint (value);
+      break;
+    case PROP_MAX_BATCH_BYTES:
+      src->max_batch_bytes = g_value_get_uint (value);
+      break;
+    case PROP_MAX_BATCH_TIME:
+      src->max_batch_time = g_value_get_uint64 (value);
+      break;
+    case PROP_MAX_CONNECTIONS:
+      src->max_connections = g_value_get_uint (value);
+      break;
+    case PROP_MAX_PENDING_HANDSHAKES:
+      src->max_pending_handshakes = g_value_get_uint (value);
+      break;
+    case PROP_MAX_SESSION_BYTES:
+      src->max_session_bytes = g_value_get_uint (value);
+      break;
+    case PROP_MAX_TOTAL_BYTES:
+      src->max_total_bytes = g_value_get_uint (value);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -944,12 +4733,123 @@ gst_rtmp2_server_src_get_property (GObject *object, guint prop_id,
     case PROP_STREAM_KEY:
       g_value_set_string (value, src->stream_key);
       break;
+    case PROP_STREAM_KEYS:{
+      gchar **keys = NULL;
+
+      g_mutex_lock (&src->keys_lock);
+      if (src->keys) {
+        GHashTableIter iter;
+        gpointer key;
+        guint i = 0;
+
+        keys = g_new0 (gchar *, g_hash_table_size (src->keys) + 1);
+        g_hash_table_iter_init (&iter, src->keys);
+        while (g_hash_table_iter_next (&iter, &key, NULL))
+          keys[i++] = g_strdup (key);
+      }
+      g_mutex_unlock (&src->keys_lock);
+
+      g_value_take_boxed (value, keys);
+      break;
+    }
+    case PROP_STREAM_KEYS_FILE:
+      GST_OBJECT_LOCK (src);
+      g_value_set_string (value, src->stream_keys_file);
+      GST_OBJECT_UNLOCK (src);
+      break;
     case PROP_TIMEOUT:
       g_value_set_uint (value, src->timeout);
       break;
+    case PROP_HANDSHAKE_TIMEOUT:
+      g_value_set_uint (value, src->handshake_timeout);
+      break;
+    case PROP_PUBLISH_TIMEOUT:
+      g_value_set_uint (value, src->publish_timeout);
+      break;
+    case PROP_CHUNK_SIZE:
+      g_value_set_uint (value, src->chunk_size);
+      break;
+    case PROP_WINDOW_ACK_SIZE:
+      g_value_set_uint (value, src->window_ack_size);
+      break;
+    case PROP_PEER_BANDWIDTH:
+      g_value_set_uint (value, src->peer_bandwidth);
+      break;
+    case PROP_IO_THREADS:
+      g_value_set_uint (value, src->io_threads);
+      break;
+    case PROP_SHARED_POOL:
+      g_value_set_boolean (value, src->shared_pool);
+      break;
     case PROP_LOOP:
       g_value_set_boolean (value, src->loop);
       break;
+    case PROP_SEAMLESS_SWITCH:
+      g_value_set_boolean (value, src->seamless_switch);
+      break;
+    case PROP_DIRECT_PUSH:
+      g_value_set_boolean (value, src->direct_push);
+      break;
+    case PROP_MULTI_STREAM:
+      g_value_set_boolean (value, src->multi_stream);
+      break;
+    case PROP_OUTPUT_MODE:
+      g_value_set_enum (value, src->output_mode);
+      break;
+    case PROP_DO_TIMESTAMP:
+      g_value_set_boolean (value, src->do_timestamp);
+      break;
+    case PROP_SEGMENT_FORMAT:
+      g_value_set_enum (value, src->segment_format);
+      break;
+    case PROP_GOP_CACHE_MAX_BYTES:
+      g_value_set_uint (value, src->gop_cache_max_bytes);
+      break;
+    case PROP_MAX_QUEUE_TAGS:
+      g_value_set_uint (value, src->max_queue_tags);
+      break;
+    case PROP_MAX_QUEUE_BYTES:
+      g_value_set_uint (value, src->max_queue_bytes);
+      break;
+    case PROP_MAX_QUEUE_TIME:
+      g_value_set_uint64 (value, src->max_queue_time);
+      break;
+    case PROP_MAX_LATENCY:
+      g_value_set_uint64 (value, src->max_latency);
+      break;
+    case PROP_LEAKY:
+      g_value_set_enum (value, src->leaky);
+      break;
+    case PROP_HIGH_WATERMARK:
+      g_value_set_uint (value, src->high_watermark);
+      break;
+    case PROP_LOW_WATERMARK:
+      g_value_set_uint (value, src->low_watermark);
+      break;
+    case PROP_MAX_BATCH_TAGS:
+      g_value_set_uint (value, src->max_batch_tags);
+      break;
+    case PROP_MAX_BATCH_BYTES:
+      g_value_set_uint (value, src->max_batch_bytes);
+      break;
+    case PROP_MAX_BATCH_TIME:
+      g_value_set_uint64 (value, src->max_batch_time);
+      break;
+    case PROP_MAX_CONNECTIONS:
+      g_value_set_uint (value, src->max_connections);
+      break;
+    case PROP_MAX_PENDING_HANDSHAKES:
+      g_value_set_uint (value, src->max_pending_handshakes);
+      break;
+    case PROP_MAX_SESSION_BYTES:
+      g_value_set_uint (value, src->max_session_bytes);
+      break;
+    case PROP_MAX_TOTAL_BYTES:
+      g_value_set_uint (value, src->max_total_bytes);
+      break;
+    case PROP_STATS:
+      g_value_take_boxed (value, gst_rtmp2_server_src_get_stats (src));
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
             break;
@@ -22,10 +22,13 @@
 
 #include <gst/gst.h>
 #include <gio/gio.h>
+#include <gst/base/gstflowcombiner.h>
 #include "gstrtmp2elements.h"
 #include "rtmp/rtmpconnection.h"
 #include "rtmp/rtmpserver.h"
 #include "rtmp/rtmpflv.h"
+#include "rtmp/rtmppausable.h"
+#include "rtmp/rtmptimerwheel.h"
 
 G_BEGIN_DECLS
 
@@ -42,6 +45,9 @@ G_BEGIN_DECLS
 
 typedef struct _GstRtmp2ServerSrc GstRtmp2ServerSrc;
 typedef struct _GstRtmp2ServerSrcClass GstRtmp2ServerSrcClass;
+typedef struct _Rtmp2ServerSrcOutput Rtmp2ServerSrcOutput;
+typedef struct _Rtmp2ServerListener Rtmp2ServerListener;
+typedef struct _Rtmp2ServerLoop Rtmp2ServerLoop;
 
 /* Server session state */
 typedef enum {
@@ -52,29 +58,216 @@ typedef enum {
   SERVER_SESSION_STATE_ERROR,
 } ServerSessionState;
 
+/**
+ * GstRtmp2ServerSrcLeaky:
+ * @GST_RTMP2_SERVER_SRC_LEAKY_NONE: never drop to honor the queue limits
+ * @GST_RTMP2_SERVER_SRC_LEAKY_OLDEST: drop the oldest queued tags
+ * @GST_RTMP2_SERVER_SRC_LEAKY_UNTIL_KEYFRAME: drop video up to the next
+ *   keyframe
+ * @GST_RTMP2_SERVER_SRC_LEAKY_GOP: drop whole GOPs, up to the newest queued
+ *   keyframe
+ *
+ * How the tag queue recovers once it exceeds its size, time or latency
+ * limits. Sequence headers and metadata are never dropped, and only
+ * "oldest" drops audio.
+ *
+ * Since: 1.26
+ */
+typedef enum {
+  GST_RTMP2_SERVER_SRC_LEAKY_NONE,
+  GST_RTMP2_SERVER_SRC_LEAKY_OLDEST,
+  GST_RTMP2_SERVER_SRC_LEAKY_UNTIL_KEYFRAME,
+  GST_RTMP2_SERVER_SRC_LEAKY_GOP,
+} GstRtmp2ServerSrcLeaky;
+
+/**
+ * GstRtmp2ServerSrcOutputMode:
+ * @GST_RTMP2_SERVER_SRC_OUTPUT_FLV: FLV stream on the always "src" pad
+ * @GST_RTMP2_SERVER_SRC_OUTPUT_ELEMENTARY: codec payloads on "video_%u" and
+ *   "audio_%u" sometimes pads
+ *
+ * Since: 1.26
+ */
+typedef enum {
+  GST_RTMP2_SERVER_SRC_OUTPUT_FLV,
+  GST_RTMP2_SERVER_SRC_OUTPUT_ELEMENTARY,
+} GstRtmp2ServerSrcOutputMode;
+
+/* Elementary stream source pad, created on the first tag of its kind */
+typedef struct {
+  GstPad *pad;
+  GstCaps *caps;
+  gboolean started;            /* stream-start and segment pushed */
+  gboolean need_codec_data;    /* waiting for a sequence header */
+} Rtmp2ServerSrcEsPad;
+
+/* Queue and media state of a session, allocated once it publishes */
+typedef struct {
+  /* FLV tag queue, filled by the event loop thread and drained by the
+   * streaming task without locking */
+  Rtmp2FlvTagRing tag_ring;
+
+  /* Overflow handling, only touched by the event loop thread. Headers that
+   * did not fit in the full ring wait here (video, audio, script). */
+  Rtmp2FlvTag held_headers[3];
+  gboolean need_keyframe;
+  guint overflow_drops;
+
+  /* Lossless mode never drops. Tags that did not fit in the ring wait
+   * here in order while reading is paused, only touched by the event loop
+   * thread. */
+  GQueue backlog;
+
+  /* Leaky policy state, only touched by the streaming task */
+  guint leaky_skip;            /* queued tags whose video is skipped */
+  gboolean leaky_need_keyframe;
+  guint leaky_drops;
+  guint episode_drops;
+  guint64 episode_drop_bytes;
+
+  /* Lossless mode: reads from the connection are paused while throttled.
+   * Protected by the process wide throttle_lock, throttled is also read
+   * atomically. resume_source is pending on the session's context once
+   * the queue drained. */
+  gint throttled;
+  gint64 throttle_start;
+  GstClockTime throttled_time;
+  guint throttle_count;
+  GSource *resume_source;
+
+  /* Tags pushed straight from the event loop in direct-push mode */
+  guint direct_pushes;
+
+  /* GOP cache, filled by the event loop thread. The latest header of each
+   * kind (video, audio, script) and the tags since the last keyframe. */
+  GMutex gop_lock;
+  Rtmp2FlvTag gop_headers[3];
+  GQueue gop_tags;
+  guint gop_bytes;
+  gboolean gop_has_keyframe;
+  guint32 next_seqnum;
+
+  /* Newest tag pushed by a GOP cache replay, 0 if none. Protected by the
+   * element's push_lock. */
+  guint32 replay_seqnum;
+} ServerSessionMedia;
+
 /* Server session - represents one connected RTMP client */
 typedef struct {
   GSocketConnection *socket_connection;  /* Keep original socket connection */
   GstRtmpConnection *connection;
+  Rtmp2PausableConnection *pausable;     /* lossless mode, the connection
+                                          * reads through it */
   ServerSessionState state;
   GstRtmpEnhancedCaps enhanced_caps;
   gchar *app_name;
   gchar *stream_key;
   guint32 stream_id;
+  guint32 transactions;        /* client commands on stream 0 so far */
   
-  /* FLV tag queue */
-  GQueue *tag_queue;
-  GMutex queue_lock;
-  
-  /* Timestamp tracking - ts_delta needs to be accumulated per-stream */
-  guint32 video_timestamp;
-  guint32 audio_timestamp;
-  guint32 data_timestamp;
+  /* Queue and media state, NULL until it publishes */
+  ServerSessionMedia *media;
+
+  /* Output the session publishes to, NULL until it publishes */
+  Rtmp2ServerSrcOutput *output;
+
+  /* Key of the session in the element's stream index, "app/stream_key",
+   * and its place in publish order. Set once it publishes. */
+  gchar *stream_name;
+  guint64 publish_seq;
+
+  /* Event loop the connection is pinned to and its main context. loop is
+   * only touched on that thread and cleared once the session left it. */
+  Rtmp2ServerLoop *loop;
+  GMainContext *context;
+
+  /* Timeout of the current state in the timer wheel of that event loop,
+   * its armed state is protected by the wheel's lock */
+  Rtmp2TimerWheel *wheel;
+  Rtmp2Timer timer;
+  gint64 last_activity;        /* monotonic time of the last media message */
+  GCancellable *cancellable;   /* cancels the handshake on timeout, NULL
+                                * once it completed */
   
   /* Back pointer to element */
   GstRtmp2ServerSrc *src;
 } ServerSession;
 
+/* One output stream with its own pads, streaming task and timeline. The
+ * element always has the default output on the "src" pad, multi-stream
+ * mode adds one per application and stream key. */
+struct _Rtmp2ServerSrcOutput {
+  gchar *name;                 /* "app/stream_key", NULL for the default */
+  GstRtmp2ServerSrcOutputMode mode;
+
+  /* Publisher being output. Written with the element's sessions_lock
+   * held for writing, the streaming task reads it atomically. */
+  ServerSession *session;
+
+  /* FLV source pad */
+  GstPad *srcpad;
+  gboolean started;
+
+  /* Elementary stream pads, only used in elementary output mode */
+  Rtmp2ServerSrcEsPad video_pad;
+  Rtmp2ServerSrcEsPad audio_pad;
+  guint group_id;
+  GstFlowCombiner *flow_combiner;
+  gint64 eos_wait_start;
+  gint64 pre_eos_end;
+
+  /* Task for pushing data. In direct-push mode it is only started once
+   * a tag had to be queued. The flags are protected by wakeup_lock. */
+  GstTask *task;
+  GRecMutex task_lock;
+  gboolean task_needed;        /* has to run while the output runs */
+  gboolean task_started;       /* started or paused */
+
+  /* Whether the output may push, protected by wakeup_lock */
+  gboolean running;
+
+  /* With the shared pool, push workers drain the output instead of its
+   * task. Protected by wakeup_lock, the timer by the pool's timer_lock. */
+  gboolean pooled;
+  gboolean pool_scheduled;     /* queued or running on a worker */
+  gboolean pool_parked;        /* waiting for a wakeup */
+  GSource *pool_timer;
+  GMainContext *pool_context;  /* event loop worker running pool_timer */
+
+  /* Streaming task wakeup, signalled by the event loop thread */
+  GMutex wakeup_lock;
+  GCond wakeup_cond;
+  gboolean wakeup_pending;
+  gboolean flushing;
+
+  /* Serializes pushes from the streaming task and, in direct-push mode,
+   * from the event loop thread. Also protects started. */
+  GMutex push_lock;
+  guint delivery_latency;      /* running average in microseconds */
+  guint replay_pending;        /* REPLAY_* streams that got a new consumer */
+
+  /* Output timeline in milliseconds, protected by push_lock */
+  gboolean switch_pending;     /* waiting for the next client's keyframe */
+  guint32 out_start_ms;        /* first timestamp of the current client */
+  guint32 out_base_ms;         /* output time of that timestamp */
+  guint32 out_position_ms;
+  guint32 out_last_video_ms;
+  guint32 out_frame_ms;
+  GstClockTimeDiff rebase;     /* running time of output time 0, in ns */
+
+  /* Stream info */
+  gboolean have_video;
+  gboolean have_audio;
+  guint stream_count;
+
+  /* Elementary pads, protected by push_lock */
+  guint meta_tracks;           /* RTMP2_TRACK_* announced by onMetaData */
+  gboolean no_more_pads;       /* signalled for the current pads */
+
+  /* Back pointer to element */
+  GstRtmp2ServerSrc *src;
+};
+
 /**
  * GstRtmp2ServerSrc:
  *
@@ -91,43 +284,90 @@ struct _GstRtmp2ServerSrc {
   guint port;
   gchar *application;
   gchar *stream_key;
+  gchar *stream_keys_file;
   guint timeout;
+  guint handshake_timeout;
+  guint publish_timeout;
+  guint chunk_size;
+  guint window_ack_size;
+  guint peer_bandwidth;
+  guint io_threads;
+  gboolean shared_pool;
   gboolean loop;
+  gboolean seamless_switch;
+  gboolean direct_push;
+  gboolean multi_stream;
+  GstRtmp2ServerSrcOutputMode output_mode;
+  gboolean do_timestamp;
+  GstFormat segment_format;
+  guint gop_cache_max_bytes;
+  guint max_queue_tags;
+  guint max_queue_bytes;
+  GstClockTime max_queue_time;
+  GstClockTime max_latency;
+  GstRtmp2ServerSrcLeaky leaky;
+  guint high_watermark;
+  guint low_watermark;
+  guint max_batch_tags;
+  guint max_batch_bytes;
+  GstClockTime max_batch_time;
+  guint max_connections;
+  guint max_pending_handshakes;
+  guint max_session_bytes;
+  guint max_total_bytes;
 
-  /* Server state */
-  GSocketService *service;
-  GMainContext *context;
-  GThread *thread;
-  gboolean running;
-
-  /* Startup synchronization */
-  GMutex start_lock;
-  GCond start_cond;
-  gboolean start_complete;
-  gboolean start_error;
+  /* Listener shared with the other elements on the same address and
+   * port */
+  Rtmp2ServerListener *listener;
   
-  /* Sessions */
-  GList *sessions;
-  GMutex sessions_lock;
-  ServerSession *active_session;
-  
-  /* Source pad (always present - outputs raw FLV data) */
-  GstPad *srcpad;
-  gboolean srcpad_started;
-  gint64 eos_wait_start;
-  
-  /* Task for pushing data */
-  GstTask *task;
-  GRecMutex task_lock;
-  
-  /* Stream info */
-  gboolean have_video;
-  gboolean have_audio;
-  guint stream_count;
+  /* Session registry: every session by its socket connection, and the
+   * published ones by "app/stream_key" in publish order (GQueue). Accept,
+   * publish and teardown take the lock for writing. */
+  GHashTable *sessions;
+  GHashTable *streams;
+  guint64 publish_count;
+  GRWLock sessions_lock;
+
+  /* Default output on the always "src" pad */
+  Rtmp2ServerSrcOutput *output;
+
+  /* Stream keys allowed to publish, NULL allows any. A table is never
+   * modified once set, reloading swaps in a new one under keys_lock. */
+  GHashTable *keys;
+  GMutex keys_lock;
+  guint auth_rejected;
+
+  /* Sessions torn down by a timeout */
+  guint timed_out;
+
+  /* Admission control: sessions in the registry and those of them still
+   * shaking hands, connections refused at accept time and sessions closed
+   * for exceeding max-session-bytes */
+  gint n_sessions;
+  gint n_handshakes;
+  guint refused_connections;
+  guint over_budget;
+
+  /* Multi-stream outputs by "app/stream_key" and whether their tasks
+   * should run, protected by sessions_lock */
+  GHashTable *outputs;
+  gboolean playing;
+
+  /* Serializes creating multi-stream outputs, and numbers the pads of
+   * stream keys whose names collide */
+  GMutex route_lock;
+  guint stream_pad_count;
+
+  /* Elementary stream pad numbering */
+  guint video_pad_count;
+  guint audio_pad_count;
 };
 
 struct _GstRtmp2ServerSrcClass {
   GstElementClass parent_class;
+
+  /* Actions */
+  gboolean (*reload_stream_keys) (GstRtmp2ServerSrc *src);
 };
 
 GType gst_rtmp2_server_src_get_type (void);
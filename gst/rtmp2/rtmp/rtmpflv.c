@@ -91,7 +91,6 @@ rtmp2_flv_parser_process (Rtmp2FlvParser * parser, const guint8 * data,
   gsize remaining = size;
   Rtmp2FlvTag *tag;
   guint8 tag_type_byte;
-  guint8 codec_info;
   guint32 data_size;
   guint32 timestamp;
   guint32 stream_id;
@@ -118,78 +117,23 @@ rtmp2_flv_parser_process (Rtmp2FlvParser * parser, const guint8 * data,
       return FALSE;
     }
 
-    if (tag->tag_type == RTMP2_FLV_TAG_VIDEO) {
-      if (data_size < 1) {
-        rtmp2_flv_tag_free (tag);
-        ptr += data_size;
-        remaining -= data_size;
-        continue;
-      }
-
-      codec_info = read_uint8 (&ptr, &remaining);
-      tag->video_codec = (Rtmp2FlvVideoCodec) (codec_info & 0x0f);
-      tag->video_keyframe = ((codec_info >> 4) & 0x0f) == 1;
-
-      /* Enhanced RTMP: Check for extended codec ID (12-15) */
-      if (tag->video_codec == 12) {
-        if (remaining >= 1) {
-          guint8 ext_codec = read_uint8 (&ptr, &remaining);
-          if (ext_codec == 0) {
-            tag->video_codec = RTMP2_FLV_VIDEO_CODEC_H265;
-          } else if (ext_codec == 1) {
-            tag->video_codec = RTMP2_FLV_VIDEO_CODEC_VP9;
-          } else if (ext_codec == 2) {
-            tag->video_codec = RTMP2_FLV_VIDEO_CODEC_AV1;
-          }
-        }
-      }
-
-      tag->data = gst_buffer_new_allocate (NULL, data_size - 1, NULL);
-      GstMapInfo map;
-      if (gst_buffer_map (tag->data, &map, GST_MAP_WRITE)) {
-        memcpy (map.data, ptr, data_size - 1);
-        gst_buffer_unmap (tag->data, &map);
-      }
-      ptr += data_size - 1;
-      remaining -= data_size - 1;
-
-    } else if (tag->tag_type == RTMP2_FLV_TAG_AUDIO) {
-      if (data_size < 1) {
-        rtmp2_flv_tag_free (tag);
-        ptr += data_size;
-        remaining -= data_size;
-        continue;
-      }
-
-      codec_info = read_uint8 (&ptr, &remaining);
-      tag->audio_codec = (Rtmp2FlvAudioCodec) ((codec_info >> 4) & 0x0f);
-      tag->audio_sample_rate = ((codec_info >> 2) & 0x03);
-      tag->audio_sample_size = ((codec_info >> 1) & 0x01);
-      tag->audio_channels = (codec_info & 0x01);
+    /* Audio and video tags without a body carry nothing */
+    if (data_size == 0 && tag->tag_type != RTMP2_FLV_TAG_SCRIPT) {
+      rtmp2_flv_tag_free (tag);
+      continue;
+    }
 
-      /* Enhanced RTMP: Check for extended audio codec (13 = Opus) */
-      if (tag->audio_codec == 13) {
-        tag->audio_codec = RTMP2_FLV_AUDIO_CODEC_OPUS;
-      }
+    /* The whole tag body, described by the shared tag header decoder */
+    rtmp2_flv_tag_parse_header (tag, ptr, data_size);
 
-      tag->data = gst_buffer_new_allocate (NULL, data_size - 1, NULL);
-      GstMapInfo map;
-      if (gst_buffer_map (tag->data, &map, GST_MAP_WRITE)) {
-        memcpy (map.data, ptr, data_size - 1);
-        gst_buffer_unmap (tag->data, &map);
-      }
-      ptr += data_size - 1;
-      remaining -= data_size - 1;
-    } else {
-      tag->data = gst_buffer_new_allocate (NULL, data_size, NULL);
-      GstMapInfo map;
-      if (gst_buffer_map (tag->data, &map, GST_MAP_WRITE)) {
-        memcpy (map.data, ptr, data_size);
-        gst_buffer_unmap (tag->data, &map);
-      }
-      ptr += data_size;
-      remaining -= data_size;
+    tag->data = gst_buffer_new_allocate (NULL, data_size, NULL);
+    GstMapInfo map;
+    if (gst_buffer_map (tag->data, &map, GST_MAP_WRITE)) {
+      memcpy (map.data, ptr, data_size);
+      gst_buffer_unmap (tag->data, &map);
     }
+    ptr += data_size;
+    remaining -= data_size;
 
     *tags = g_list_append (*tags, tag);
   }
@@ -216,6 +160,430 @@ rtmp2_flv_tag_free (Rtmp2FlvTag * tag)
   g_free (tag);
 }
 
+/* Heap allocated copy of a tag, sharing its payload */
+Rtmp2FlvTag *
+rtmp2_flv_tag_copy (const Rtmp2FlvTag * tag)
+{
+  Rtmp2FlvTag *copy = g_new (Rtmp2FlvTag, 1);
+
+  *copy = *tag;
+  if (copy->data)
+    gst_buffer_ref (copy->data);
+
+  return copy;
+}
+
+/* Release the payload of a tag that is not heap allocated */
+void
+rtmp2_flv_tag_clear (Rtmp2FlvTag * tag)
+{
+  gst_clear_buffer (&tag->data);
+}
+
+/* Signed 24-bit big endian, as used for composition times */
+static gint32
+rtmp2_flv_read_si24 (const guint8 * data)
+{
+  guint32 value = GST_READ_UINT24_BE (data);
+
+  return (gint32) (value << 8) >> 8;
+}
+
+/* Video frame types, FrameType in both header layouts */
+#define RTMP2_FLV_FRAME_KEY 1
+#define RTMP2_FLV_FRAME_GENERATED_KEY 4
+#define RTMP2_FLV_FRAME_COMMAND 5
+
+/* E-RTMP VideoPacketType */
+enum
+{
+  EX_VIDEO_SEQUENCE_START = 0,
+  EX_VIDEO_CODED_FRAMES = 1,
+  EX_VIDEO_SEQUENCE_END = 2,
+  EX_VIDEO_CODED_FRAMES_X = 3,
+  EX_VIDEO_METADATA = 4,
+  EX_VIDEO_MPEG2TS_SEQUENCE_START = 5,
+  EX_VIDEO_MULTITRACK = 6,
+  EX_VIDEO_MOD_EX = 7,
+};
+
+/* E-RTMP VideoPacketModExType */
+enum
+{
+  EX_VIDEO_MOD_EX_TIMESTAMP_OFFSET_NANO = 0,
+};
+
+/* E-RTMP AvMultitrackType, NONE for a single track packet */
+enum
+{
+  EX_MULTITRACK_ONE_TRACK = 0,
+  EX_MULTITRACK_MANY_TRACKS = 1,
+  EX_MULTITRACK_MANY_TRACKS_MANY_CODECS = 2,
+  EX_MULTITRACK_NONE = 0xff,
+};
+
+static const struct
+{
+  guint32 fourcc;
+  Rtmp2FlvVideoCodec codec;
+} ex_video_codecs[] = {
+  {GST_MAKE_FOURCC ('a', 'v', 'c', '1'), RTMP2_FLV_VIDEO_CODEC_H264},
+  {GST_MAKE_FOURCC ('h', 'v', 'c', '1'), RTMP2_FLV_VIDEO_CODEC_H265},
+  {GST_MAKE_FOURCC ('v', 'p', '0', '9'), RTMP2_FLV_VIDEO_CODEC_VP9},
+  {GST_MAKE_FOURCC ('a', 'v', '0', '1'), RTMP2_FLV_VIDEO_CODEC_AV1},
+};
+
+/* Codec of a FourCC as it appears in the stream, 0 if unknown */
+static Rtmp2FlvVideoCodec
+rtmp2_flv_ex_video_codec (const guint8 * data)
+{
+  guint32 fourcc = GST_READ_UINT32_LE (data);
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (ex_video_codecs); i++) {
+    if (ex_video_codecs[i].fourcc == fourcc)
+      return ex_video_codecs[i].codec;
+  }
+
+  return 0;
+}
+
+/* E-RTMP v1/v2 ExVideoTagHeader: FrameType and PacketType, ModEx
+ * modifiers, a command byte or the multitrack header, the FourCC, and the
+ * per packet type fields before the codec payload. Only single track
+ * packets and track 0 of a one track packet carry a usable payload.
+ * Other tracks are passed through but are never headers or keyframes. */
+static void
+rtmp2_flv_tag_parse_ex_video (Rtmp2FlvTag * tag, const guint8 * data,
+    gsize size)
+{
+  guint frame_type = (data[0] >> 4) & 0x07;
+  guint packet_type = data[0] & 0x0F;
+  guint multitrack = EX_MULTITRACK_NONE;
+  guint track_id = 0;
+  gsize pos = 1;
+
+  /* Modifiers, each followed by its type and the next packet type. A
+   * nanosecond timestamp offset refines the millisecond timestamp. */
+  while (packet_type == EX_VIDEO_MOD_EX) {
+    gsize mod_size;
+    guint mod_type;
+
+    if (pos >= size)
+      return;
+    mod_size = data[pos++] + 1;
+    if (mod_size == 256) {
+      if (size - pos < 2)
+        return;
+      mod_size = GST_READ_UINT16_BE (data + pos) + 1;
+      pos += 2;
+    }
+    if (size - pos < mod_size + 1)
+      return;
+    mod_type = data[pos + mod_size] >> 4;
+    if (mod_type == EX_VIDEO_MOD_EX_TIMESTAMP_OFFSET_NANO && mod_size >= 3)
+      tag->timestamp_offset_ns = GST_READ_UINT24_BE (data + pos);
+    pos += mod_size;
+    packet_type = data[pos++] & 0x0F;
+  }
+
+  /* A command frame only holds the command */
+  if (frame_type == RTMP2_FLV_FRAME_COMMAND &&
+      packet_type != EX_VIDEO_METADATA)
+    return;
+
+  if (packet_type == EX_VIDEO_MULTITRACK) {
+    if (pos >= size)
+      return;
+    multitrack = data[pos] >> 4;
+    packet_type = data[pos++] & 0x0F;
+  }
+
+  /* The FourCC of all tracks, or of the first one followed by its ID and,
+   * with many tracks, its size */
+  if (size - pos < 4)
+    return;
+  tag->video_codec = rtmp2_flv_ex_video_codec (data + pos);
+  pos += 4;
+
+  if (multitrack != EX_MULTITRACK_NONE) {
+    if (pos >= size)
+      return;
+    track_id = data[pos++];
+    if (multitrack != EX_MULTITRACK_ONE_TRACK)
+      return;
+  }
+
+  if (tag->video_codec == 0 || track_id != 0)
+    return;
+
+  switch (packet_type) {
+    case EX_VIDEO_SEQUENCE_START:
+      tag->sequence_header = TRUE;
+      tag->video_keyframe = frame_type == RTMP2_FLV_FRAME_KEY;
+      break;
+    case EX_VIDEO_CODED_FRAMES:
+      /* Only AVC/HEVC carry a composition time */
+      if (tag->video_codec == RTMP2_FLV_VIDEO_CODEC_H264 ||
+          tag->video_codec == RTMP2_FLV_VIDEO_CODEC_H265) {
+        if (size - pos < 3)
+          return;
+        tag->composition_time = rtmp2_flv_read_si24 (data + pos);
+        pos += 3;
+      }
+      /* fall through */
+    case EX_VIDEO_CODED_FRAMES_X:
+      tag->video_keyframe = frame_type == RTMP2_FLV_FRAME_KEY ||
+          frame_type == RTMP2_FLV_FRAME_GENERATED_KEY;
+      break;
+    default:
+      /* SequenceEnd, Metadata and MPEG2TSSequenceStart aren't frames */
+      return;
+  }
+
+  /* Modifiers may push the payload beyond what the offset can hold */
+  if (pos <= G_MAXUINT8)
+    tag->payload_offset = pos;
+}
+
+/* Legacy VideoTagHeader: FrameType and CodecID, then for AVC/HEVC the
+ * AVCPacketType and composition time */
+static void
+rtmp2_flv_tag_parse_video (Rtmp2FlvTag * tag, const guint8 * data,
+    gsize size)
+{
+  guint frame_type = (data[0] >> 4) & 0x0F;
+
+  tag->video_codec = data[0] & 0x0F;
+  if (frame_type == RTMP2_FLV_FRAME_COMMAND)
+    return;
+
+  tag->video_keyframe = frame_type == RTMP2_FLV_FRAME_KEY;
+
+  if (tag->video_codec == RTMP2_FLV_VIDEO_CODEC_H264 ||
+      tag->video_codec == RTMP2_FLV_VIDEO_CODEC_H265) {
+    /* AVCPacketType 0: decoder configuration record, 1: NALUs,
+     * 2: end of sequence */
+    tag->sequence_header = size > 1 && data[1] == 0;
+    if (size >= 5 && data[1] < 2) {
+      tag->payload_offset = 5;
+      if (data[1] == 1)
+        tag->composition_time = rtmp2_flv_read_si24 (data + 2);
+    }
+  } else {
+    tag->payload_offset = 1;
+  }
+}
+
+/* Fill in the codec fields of tag from the start of its tag body, i.e.
+ * the payload of the RTMP message it was created from. The single tag
+ * header decoder of both the RTMP input and the FLV parser. */
+void
+rtmp2_flv_tag_parse_header (Rtmp2FlvTag * tag, const guint8 * data, gsize size)
+{
+  if (size < 1)
+    return;
+
+  if (tag->tag_type == RTMP2_FLV_TAG_VIDEO) {
+    /* IsExHeader */
+    if (data[0] & 0x80)
+      rtmp2_flv_tag_parse_ex_video (tag, data, size);
+    else
+      rtmp2_flv_tag_parse_video (tag, data, size);
+  } else if (tag->tag_type == RTMP2_FLV_TAG_AUDIO) {
+    tag->audio_codec = (data[0] >> 4) & 0x0F;
+    tag->audio_sample_rate = (data[0] >> 2) & 0x03;
+    tag->audio_sample_size = (data[0] >> 1) & 0x01;
+    tag->audio_channels = data[0] & 0x01;
+
+    /* AACPacketType 0: AudioSpecificConfig */
+    if (tag->audio_codec == RTMP2_FLV_AUDIO_CODEC_AAC) {
+      tag->sequence_header = size > 1 && data[1] == 0;
+      tag->payload_offset = 2;
+    } else {
+      tag->payload_offset = 1;
+    }
+  }
+
+  if (tag->payload_offset > size)
+    tag->payload_offset = 0;
+}
+
+/* Codec payload of an audio/video tag, or its configuration record for
+ * sequence headers, sharing the memory of the tag body. */
+GstBuffer *
+rtmp2_flv_tag_get_payload (const Rtmp2FlvTag * tag)
+{
+  gsize size;
+
+  if (!tag->data || tag->payload_offset == 0)
+    return NULL;
+
+  size = gst_buffer_get_size (tag->data);
+  if (tag->payload_offset >= size)
+    return NULL;
+
+  return gst_buffer_copy_region (tag->data, GST_BUFFER_COPY_MEMORY,
+      tag->payload_offset, size - tag->payload_offset);
+}
+
+/* Whether downstream needs this tag to decode anything that follows */
+gboolean
+rtmp2_flv_tag_is_header (const Rtmp2FlvTag * tag)
+{
+  return tag->sequence_header || tag->tag_type == RTMP2_FLV_TAG_SCRIPT;
+}
+
+/* ========== Tag ring ========== */
+
+/* A zeroed ring is a valid empty ring that accepts no tags, until it is
+ * initialized with a capacity */
+void
+rtmp2_flv_tag_ring_init (Rtmp2FlvTagRing * ring, guint capacity)
+{
+  memset (ring, 0, sizeof (Rtmp2FlvTagRing));
+
+  /* Round up to a power of two so indices can be masked */
+  ring->capacity = 1u << g_bit_storage (MAX (capacity, 2) - 1);
+  ring->mask = ring->capacity - 1;
+  ring->slots = g_new0 (Rtmp2FlvTag, ring->capacity);
+}
+
+void
+rtmp2_flv_tag_ring_clear (Rtmp2FlvTagRing * ring)
+{
+  Rtmp2FlvTag tag;
+
+  if (!ring->slots)
+    return;
+
+  while (rtmp2_flv_tag_ring_pop (ring, &tag))
+    rtmp2_flv_tag_clear (&tag);
+
+  g_free (ring->slots);
+  ring->slots = NULL;
+}
+
+/* Also count the queued payload bytes in total_bytes, which may be shared
+ * by many rings. Call before the first push. */
+void
+rtmp2_flv_tag_ring_set_total (Rtmp2FlvTagRing * ring, guint * total_bytes)
+{
+  ring->total_bytes = total_bytes;
+}
+
+/* Producer side. Copies the tag into the ring and takes ownership of
+ * tag->data. Returns FALSE without taking anything if the ring is full. */
+gboolean
+rtmp2_flv_tag_ring_push (Rtmp2FlvTagRing * ring, const Rtmp2FlvTag * tag)
+{
+  guint head = ring->head;
+
+  if (head - (guint) g_atomic_int_get (&ring->tail) >= ring->capacity)
+    return FALSE;
+
+  ring->slots[head & ring->mask] = *tag;
+  g_atomic_int_add (&ring->bytes, tag->data_size);
+  if (ring->total_bytes)
+    g_atomic_int_add (ring->total_bytes, tag->data_size);
+
+  /* Publish the slot */
+  g_atomic_int_set (&ring->head, head + 1);
+
+  return TRUE;
+}
+
+/* Consumer side. The caller owns tag->data afterwards. */
+gboolean
+rtmp2_flv_tag_ring_pop (Rtmp2FlvTagRing * ring, Rtmp2FlvTag * tag)
+{
+  guint tail = ring->tail;
+
+  if (tail == (guint) g_atomic_int_get (&ring->head))
+    return FALSE;
+
+  *tag = ring->slots[tail & ring->mask];
+  g_atomic_int_add (&ring->bytes, -(gint) tag->data_size);
+  if (ring->total_bytes)
+    g_atomic_int_add (ring->total_bytes, -(gint) tag->data_size);
+
+  /* Hand the slot back to the producer */
+  g_atomic_int_set (&ring->tail, tail + 1);
+
+  return TRUE;
+}
+
+/* Consumer side. Look at the index-th queued tag without popping it. */
+const Rtmp2FlvTag *
+rtmp2_flv_tag_ring_peek (Rtmp2FlvTagRing * ring, guint index)
+{
+  guint tail = ring->tail;
+
+  if ((guint) g_atomic_int_get (&ring->head) - tail <= index)
+    return NULL;
+
+  return &ring->slots[(tail + index) & ring->mask];
+}
+
+/* Number of queued tags, safe to call from any thread */
+guint
+rtmp2_flv_tag_ring_get_level (Rtmp2FlvTagRing * ring)
+{
+  /* Read tail first, head can only have moved further since */
+  guint tail = g_atomic_int_get (&ring->tail);
+
+  return (guint) g_atomic_int_get (&ring->head) - tail;
+}
+
+/* Number of queued payload bytes, safe to call from any thread */
+guint
+rtmp2_flv_tag_ring_get_bytes (Rtmp2FlvTagRing * ring)
+{
+  return g_atomic_int_get (&ring->bytes);
+}
+
+/* Frame a tag as FLV (tag header, payload, PreviousTagSize). The payload
+ * memory is shared by reference with tag->data, only the 15 bytes of
+ * framing are allocated. */
+GstBuffer *
+rtmp2_flv_tag_to_buffer (const Rtmp2FlvTag * tag)
+{
+  GstBuffer *buffer;
+  GstMemory *framing;
+  GstMapInfo map;
+  gsize data_size;
+
+  g_return_val_if_fail (tag != NULL, NULL);
+  g_return_val_if_fail (tag->data != NULL, NULL);
+
+  data_size = gst_buffer_get_size (tag->data);
+
+  /* Header and trailer live in one allocation, shared out in two pieces */
+  framing = gst_allocator_alloc (NULL, RTMP2_FLV_TAG_HEADER_SIZE + 4, NULL);
+  if (!gst_memory_map (framing, &map, GST_MAP_WRITE)) {
+    gst_memory_unref (framing);
+    return NULL;
+  }
+
+  map.data[0] = tag->tag_type;
+  GST_WRITE_UINT24_BE (map.data + 1, data_size);
+  GST_WRITE_UINT24_BE (map.data + 4, tag->timestamp & 0xffffff);
+  map.data[7] = (tag->timestamp >> 24) & 0xff;  /* Extended timestamp */
+  GST_WRITE_UINT24_BE (map.data + 8, 0);         /* Stream ID (always 0) */
+  GST_WRITE_UINT32_BE (map.data + RTMP2_FLV_TAG_HEADER_SIZE,
+      RTMP2_FLV_TAG_HEADER_SIZE + data_size);
+  gst_memory_unmap (framing, &map);
+
+  buffer = gst_buffer_copy_region (tag->data, GST_BUFFER_COPY_MEMORY, 0, -1);
+  gst_buffer_prepend_memory (buffer,
+      gst_memory_share (framing, 0, RTMP2_FLV_TAG_HEADER_SIZE));
+  gst_buffer_append_memory (buffer,
+      gst_memory_share (framing, RTMP2_FLV_TAG_HEADER_SIZE, 4));
+  gst_memory_unref (framing);
+
+  return buffer;
+}
+
 GstCaps *
 rtmp2_flv_tag_get_caps (Rtmp2FlvTag * tag)
 {
@@ -228,7 +596,7 @@ rtmp2_flv_tag_get_caps (Rtmp2FlvTag * tag)
             NULL);
       case RTMP2_FLV_VIDEO_CODEC_H265:
         return gst_caps_new_simple ("video/x-h265",
-            "stream-format", G_TYPE_STRING, "hev1",
+            "stream-format", G_TYPE_STRING, "hvc1",
             "alignment", G_TYPE_STRING, "au",
             NULL);
       case RTMP2_FLV_VIDEO_CODEC_VP9:
@@ -27,6 +27,7 @@
 G_BEGIN_DECLS
 
 #define RTMP2_FLV_TAG_HEADER_SIZE 11
+#define RTMP2_CACHE_LINE_SIZE 64
 
 typedef enum {
   RTMP2_FLV_TAG_AUDIO = 8,
@@ -64,25 +65,64 @@ typedef enum {
   RTMP2_FLV_AUDIO_CODEC_DEVICE = 15
 } Rtmp2FlvAudioCodec;
 
+/* Fields are ordered by size to leave no padding, rings store many of
+ * these by value */
 typedef struct {
+  GstBuffer *data;
+
+  /* Monotonic time of reception in microseconds, 0 if unknown */
+  gint64 arrival_time;
+
   Rtmp2FlvTagType tag_type;
   guint32 data_size;
   guint32 timestamp;
   guint32 stream_id;
-  
+
+  /* Per-session sequence number, in order of reception */
+  guint32 seqnum;
+
+  /* Codec configuration (AVC/HEVC/AAC sequence header) */
+  gboolean sequence_header;
+
   /* Video specific */
   Rtmp2FlvVideoCodec video_codec;
   gboolean video_keyframe;
+  gint32 composition_time;     /* PTS - DTS in milliseconds (AVC/HEVC) */
+  guint32 timestamp_offset_ns; /* E-RTMP ModEx TimestampOffsetNano */
   
   /* Audio specific */
   Rtmp2FlvAudioCodec audio_codec;
-  guint audio_sample_rate;
-  guint audio_sample_size;
-  guint audio_channels;
-  
-  GstBuffer *data;
+  guint8 audio_sample_rate;
+  guint8 audio_sample_size;
+  guint8 audio_channels;
+
+  /* Offset of the codec payload (or configuration record) in the tag
+   * body, past the FLV audio/video header. 0 if there is none. */
+  guint8 payload_offset;
 } Rtmp2FlvTag;
 
+/* Fixed-capacity single-producer/single-consumer ring of tags. Tags are
+ * stored by value. head is only written by the producer and tail only by
+ * the consumer, each on its own cache line. */
+typedef struct {
+  /* Read-only after init */
+  guint capacity;
+  guint mask;
+  Rtmp2FlvTag *slots;
+  guint *total_bytes;
+  guint8 _pad0[RTMP2_CACHE_LINE_SIZE - 2 * sizeof (guint) - 2 * sizeof (gpointer)];
+
+  guint head;
+  guint8 _pad1[RTMP2_CACHE_LINE_SIZE - sizeof (guint)];
+
+  guint tail;
+  guint8 _pad2[RTMP2_CACHE_LINE_SIZE - sizeof (guint)];
+
+  /* Queued payload bytes, updated by both sides */
+  guint bytes;
+  guint8 _pad3[RTMP2_CACHE_LINE_SIZE - sizeof (guint)];
+} Rtmp2FlvTagRing;
+
 typedef struct {
   GList *pending_tags;
   gboolean have_video_caps;
@@ -96,7 +136,22 @@ gboolean rtmp2_flv_parser_process (Rtmp2FlvParser *parser, const guint8 *data, g
                                    GList **tags, GError **error);
 Rtmp2FlvTag *rtmp2_flv_tag_new (void);
 void rtmp2_flv_tag_free (Rtmp2FlvTag *tag);
+Rtmp2FlvTag *rtmp2_flv_tag_copy (const Rtmp2FlvTag *tag);
+void rtmp2_flv_tag_clear (Rtmp2FlvTag *tag);
+void rtmp2_flv_tag_parse_header (Rtmp2FlvTag *tag, const guint8 *data, gsize size);
+gboolean rtmp2_flv_tag_is_header (const Rtmp2FlvTag *tag);
 GstCaps *rtmp2_flv_tag_get_caps (Rtmp2FlvTag *tag);
+GstBuffer *rtmp2_flv_tag_get_payload (const Rtmp2FlvTag *tag);
+GstBuffer *rtmp2_flv_tag_to_buffer (const Rtmp2FlvTag *tag);
+
+void rtmp2_flv_tag_ring_init (Rtmp2FlvTagRing *ring, guint capacity);
+void rtmp2_flv_tag_ring_clear (Rtmp2FlvTagRing *ring);
+void rtmp2_flv_tag_ring_set_total (Rtmp2FlvTagRing *ring, guint *total_bytes);
+gboolean rtmp2_flv_tag_ring_push (Rtmp2FlvTagRing *ring, const Rtmp2FlvTag *tag);
+gboolean rtmp2_flv_tag_ring_pop (Rtmp2FlvTagRing *ring, Rtmp2FlvTag *tag);
+const Rtmp2FlvTag *rtmp2_flv_tag_ring_peek (Rtmp2FlvTagRing *ring, guint index);
+guint rtmp2_flv_tag_ring_get_level (Rtmp2FlvTagRing *ring);
+guint rtmp2_flv_tag_ring_get_bytes (Rtmp2FlvTagRing *ring);
 
 G_END_DECLS
 
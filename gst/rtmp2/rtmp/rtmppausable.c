@@ -0,0 +1,325 @@
+/*
+ * GStreamer
+ * Copyright (C) 2025 Yaron Torbaty <yarontorbaty@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "rtmppausable.h"
+
+/* Input stream of the connection, passing reads through to the socket's
+ * own input stream unless paused */
+#define RTMP2_TYPE_PAUSABLE_INPUT_STREAM \
+  (rtmp2_pausable_input_stream_get_type ())
+G_DECLARE_FINAL_TYPE (Rtmp2PausableInputStream, rtmp2_pausable_input_stream,
+    RTMP2, PAUSABLE_INPUT_STREAM, GFilterInputStream);
+
+struct _Rtmp2PausableInputStream
+{
+  GFilterInputStream parent;
+
+  /* Protects paused and sources, the PausableSources handed out and not
+   * finalized yet */
+  GMutex lock;
+  gboolean paused;
+  GPtrArray *sources;
+};
+
+struct _Rtmp2PausableConnection
+{
+  GTcpConnection parent;
+
+  Rtmp2PausableInputStream *input;
+};
+
+/* Pollable source of the stream. The socket source as its child makes it
+ * dispatch, there is none while paused. */
+typedef struct
+{
+  GSource source;
+  Rtmp2PausableInputStream *stream;
+  GSource *child;
+} PausableSource;
+
+static void rtmp2_pausable_input_stream_pollable_init (GPollableInputStreamInterface
+    * iface);
+
+G_DEFINE_TYPE_WITH_CODE (Rtmp2PausableInputStream, rtmp2_pausable_input_stream,
+    G_TYPE_FILTER_INPUT_STREAM,
+    G_IMPLEMENT_INTERFACE (G_TYPE_POLLABLE_INPUT_STREAM,
+        rtmp2_pausable_input_stream_pollable_init));
+
+G_DEFINE_TYPE (Rtmp2PausableConnection, rtmp2_pausable_connection,
+    G_TYPE_TCP_CONNECTION);
+
+static GPollableInputStream *
+rtmp2_pausable_input_stream_get_base (Rtmp2PausableInputStream * self)
+{
+  return G_POLLABLE_INPUT_STREAM (g_filter_input_stream_get_base_stream
+      (G_FILTER_INPUT_STREAM (self)));
+}
+
+static gboolean
+pausable_source_dispatch (GSource * source, GSourceFunc callback,
+    gpointer user_data)
+{
+  PausableSource *ps = (PausableSource *) source;
+  GPollableSourceFunc func = (GPollableSourceFunc) callback;
+
+  return func (G_OBJECT (ps->stream), user_data);
+}
+
+static void
+pausable_source_finalize (GSource * source)
+{
+  PausableSource *ps = (PausableSource *) source;
+
+  g_mutex_lock (&ps->stream->lock);
+  g_ptr_array_remove_fast (ps->stream->sources, ps);
+  g_mutex_unlock (&ps->stream->lock);
+
+  g_clear_pointer (&ps->child, g_source_unref);
+  g_object_unref (ps->stream);
+}
+
+static GSourceFuncs pausable_source_funcs = {
+  NULL,
+  NULL,
+  pausable_source_dispatch,
+  pausable_source_finalize,
+};
+
+static void
+pausable_source_add_child_locked (PausableSource * ps)
+{
+  ps->child =
+      g_pollable_input_stream_create_source
+      (rtmp2_pausable_input_stream_get_base (ps->stream), NULL);
+  g_source_set_dummy_callback (ps->child);
+  g_source_add_child_source (&ps->source, ps->child);
+}
+
+static void
+pausable_source_remove_child_locked (PausableSource * ps)
+{
+  if (!ps->child)
+    return;
+
+  /* Gone with the source once it is destroyed */
+  if (!g_source_is_destroyed (&ps->source))
+    g_source_remove_child_source (&ps->source, ps->child);
+  g_clear_pointer (&ps->child, g_source_unref);
+}
+
+static gboolean
+rtmp2_pausable_input_stream_can_poll (GPollableInputStream * pollable)
+{
+  return TRUE;
+}
+
+static gboolean
+rtmp2_pausable_input_stream_is_readable (GPollableInputStream * pollable)
+{
+  Rtmp2PausableInputStream *self = RTMP2_PAUSABLE_INPUT_STREAM (pollable);
+  gboolean paused;
+
+  g_mutex_lock (&self->lock);
+  paused = self->paused;
+  g_mutex_unlock (&self->lock);
+
+  return !paused &&
+      g_pollable_input_stream_is_readable (rtmp2_pausable_input_stream_get_base
+      (self));
+}
+
+/* Without a socket source as child, the source never dispatches */
+static GSource *
+rtmp2_pausable_input_stream_create_source (GPollableInputStream * pollable,
+    GCancellable * cancellable)
+{
+  Rtmp2PausableInputStream *self = RTMP2_PAUSABLE_INPUT_STREAM (pollable);
+  GSource *source;
+  PausableSource *ps;
+
+  source = g_source_new (&pausable_source_funcs, sizeof (PausableSource));
+  g_source_set_name (source, "Rtmp2PausableSource");
+  ps = (PausableSource *) source;
+  ps->stream = g_object_ref (self);
+
+  if (cancellable) {
+    GSource *cancellable_source = g_cancellable_source_new (cancellable);
+
+    g_source_set_dummy_callback (cancellable_source);
+    g_source_add_child_source (source, cancellable_source);
+    g_source_unref (cancellable_source);
+  }
+
+  g_mutex_lock (&self->lock);
+  if (!self->paused)
+    pausable_source_add_child_locked (ps);
+  g_ptr_array_add (self->sources, ps);
+  g_mutex_unlock (&self->lock);
+
+  return source;
+}
+
+static gssize
+rtmp2_pausable_input_stream_read_nonblocking (GPollableInputStream * pollable,
+    void *buffer, gsize count, GError ** error)
+{
+  Rtmp2PausableInputStream *self = RTMP2_PAUSABLE_INPUT_STREAM (pollable);
+  gboolean paused;
+
+  g_mutex_lock (&self->lock);
+  paused = self->paused;
+  g_mutex_unlock (&self->lock);
+
+  if (paused) {
+    g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_WOULD_BLOCK,
+        "Reading is paused");
+    return -1;
+  }
+
+  return g_pollable_input_stream_read_nonblocking
+      (rtmp2_pausable_input_stream_get_base (self), buffer, count, NULL, error);
+}
+
+static void
+rtmp2_pausable_input_stream_pollable_init (GPollableInputStreamInterface *
+    iface)
+{
+  iface->can_poll = rtmp2_pausable_input_stream_can_poll;
+  iface->is_readable = rtmp2_pausable_input_stream_is_readable;
+  iface->create_source = rtmp2_pausable_input_stream_create_source;
+  iface->read_nonblocking = rtmp2_pausable_input_stream_read_nonblocking;
+}
+
+/* Sources keep their stream alive, none is left by now */
+static void
+rtmp2_pausable_input_stream_finalize (GObject * object)
+{
+  Rtmp2PausableInputStream *self = RTMP2_PAUSABLE_INPUT_STREAM (object);
+
+  g_ptr_array_unref (self->sources);
+  g_mutex_clear (&self->lock);
+
+  G_OBJECT_CLASS (rtmp2_pausable_input_stream_parent_class)->finalize
+      (object);
+}
+
+static void
+rtmp2_pausable_input_stream_class_init (Rtmp2PausableInputStreamClass * klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+
+  gobject_class->finalize = rtmp2_pausable_input_stream_finalize;
+}
+
+static void
+rtmp2_pausable_input_stream_init (Rtmp2PausableInputStream * self)
+{
+  g_mutex_init (&self->lock);
+  self->sources = g_ptr_array_new ();
+}
+
+/* The socket's own input stream stays with the connection, which closes
+ * it together with the socket */
+static GInputStream *
+rtmp2_pausable_connection_get_input_stream (GIOStream * stream)
+{
+  Rtmp2PausableConnection *self = RTMP2_PAUSABLE_CONNECTION (stream);
+
+  if (!self->input) {
+    GInputStream *base =
+        G_IO_STREAM_CLASS (rtmp2_pausable_connection_parent_class)->
+        get_input_stream (stream);
+
+    self->input = g_object_new (RTMP2_TYPE_PAUSABLE_INPUT_STREAM,
+        "base-stream", base, "close-base-stream", FALSE, NULL);
+  }
+
+  return G_INPUT_STREAM (self->input);
+}
+
+static void
+rtmp2_pausable_connection_finalize (GObject * object)
+{
+  Rtmp2PausableConnection *self = RTMP2_PAUSABLE_CONNECTION (object);
+
+  g_clear_object (&self->input);
+
+  G_OBJECT_CLASS (rtmp2_pausable_connection_parent_class)->finalize (object);
+}
+
+static void
+rtmp2_pausable_connection_class_init (Rtmp2PausableConnectionClass * klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+  GIOStreamClass *stream_class = G_IO_STREAM_CLASS (klass);
+
+  gobject_class->finalize = rtmp2_pausable_connection_finalize;
+  stream_class->get_input_stream = rtmp2_pausable_connection_get_input_stream;
+}
+
+static void
+rtmp2_pausable_connection_init (Rtmp2PausableConnection * self)
+{
+}
+
+/* Shares the socket of connection, which must stay open as long as the
+ * new connection is used. Closing either closes the socket. */
+Rtmp2PausableConnection *
+rtmp2_pausable_connection_new (GSocketConnection * connection)
+{
+  g_return_val_if_fail (G_IS_SOCKET_CONNECTION (connection), NULL);
+
+  return g_object_new (RTMP2_TYPE_PAUSABLE_CONNECTION, "socket",
+      g_socket_connection_get_socket (connection), NULL);
+}
+
+/* Called on the thread of the main context the input sources are attached
+ * to. Reading resumes with whatever the socket received meanwhile. */
+void
+rtmp2_pausable_connection_set_paused (Rtmp2PausableConnection * connection,
+    gboolean paused)
+{
+  Rtmp2PausableInputStream *self;
+  guint i;
+
+  g_return_if_fail (RTMP2_IS_PAUSABLE_CONNECTION (connection));
+
+  self = RTMP2_PAUSABLE_INPUT_STREAM (g_io_stream_get_input_stream (G_IO_STREAM
+          (connection)));
+
+  g_mutex_lock (&self->lock);
+  if (self->paused != paused) {
+    self->paused = paused;
+
+    for (i = 0; i < self->sources->len; i++) {
+      PausableSource *ps = g_ptr_array_index (self->sources, i);
+
+      if (paused)
+        pausable_source_remove_child_locked (ps);
+      else if (!g_source_is_destroyed (&ps->source))
+        pausable_source_add_child_locked (ps);
+    }
+  }
+  g_mutex_unlock (&self->lock);
+}
@@ -0,0 +1,43 @@
+/*
+ * GStreamer
+ * Copyright (C) 2025 Yaron Torbaty <yarontorbaty@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __RTMP2_PAUSABLE_H__
+#define __RTMP2_PAUSABLE_H__
+
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+/* TCP connection sharing the socket of an accepted connection, whose input
+ * stream can stop reading. A GstRtmpConnection created on it reads
+ * through that stream: while paused its input source is not polled, the
+ * socket's receive buffer fills and TCP flow control pushes back on the
+ * peer. */
+#define RTMP2_TYPE_PAUSABLE_CONNECTION (rtmp2_pausable_connection_get_type ())
+G_DECLARE_FINAL_TYPE (Rtmp2PausableConnection, rtmp2_pausable_connection,
+    RTMP2, PAUSABLE_CONNECTION, GTcpConnection)
+
+Rtmp2PausableConnection *rtmp2_pausable_connection_new (GSocketConnection *connection);
+void rtmp2_pausable_connection_set_paused (Rtmp2PausableConnection *connection,
+    gboolean paused);
+
+G_END_DECLS
+
+#endif /* __RTMP2_PAUSABLE_H__ */
@@ -180,21 +180,70 @@ gst_rtmp_enhanced_caps_parse (const GstAmfNode * command_object,
 /* ========== Server command responses ========== */
 
 void
-gst_rtmp_server_send_connect_result (GstRtmpConnection * connection,
-    gdouble transaction_id,
-    const GstRtmpEnhancedCaps * client_caps)
+gst_rtmp_server_send_connect_setup (GstRtmpConnection * connection,
+    guint32 window_ack_size, guint32 peer_bandwidth, guint32 chunk_size)
 {
-  GstAmfNode *properties;
-  GstAmfNode *info;
-  GBytes *payload;
-  guint8 *data;
-  gsize size;
-  GstBuffer *buffer;
-
   g_return_if_fail (GST_IS_RTMP_CONNECTION (connection));
 
   init_debug ();
 
+  if (window_ack_size > 0) {
+    GST_DEBUG ("Sending Window Acknowledgement Size %u", window_ack_size);
+    gst_rtmp_connection_request_window_size (connection, window_ack_size);
+  }
+
+  if (peer_bandwidth > 0) {
+    GstRtmpProtocolControl pc = {
+      .type = GST_RTMP_MESSAGE_TYPE_SET_PEER_BANDWIDTH,
+      .param = peer_bandwidth,
+      .param2 = 2,              /* dynamic limit */
+    };
+
+    GST_DEBUG ("Sending Set Peer Bandwidth %u", peer_bandwidth);
+    gst_rtmp_connection_queue_message (connection,
+        gst_rtmp_message_new_protocol_control (&pc));
+  }
+
+  /* The connection applies it to our own chunks once the message went
+   * out. The chunk size of the client is set by its own Set Chunk Size,
+   * which the connection honors when reassembling. */
+  if (chunk_size > 0) {
+    GstRtmpProtocolControl pc = {
+      .type = GST_RTMP_MESSAGE_TYPE_SET_CHUNK_SIZE,
+      .param = chunk_size,
+    };
+
+    GST_DEBUG ("Sending Set Chunk Size %u", chunk_size);
+    gst_rtmp_connection_queue_message (connection,
+        gst_rtmp_message_new_protocol_control (&pc));
+  }
+}
+
+/* Command responses only differ in their transaction ID and stream ID, so
+ * each is serialized once per process. Sending one copies the template
+ * and patches the numbers in place. */
+enum
+{
+  RESPONSE_RESULT,              /* releaseStream and FCPublish */
+  RESPONSE_CREATE_STREAM,
+  RESPONSE_PUBLISH_START,
+  RESPONSE_CONNECT,             /* one per videoFourCcInfoMap variant */
+  N_RESPONSES = RESPONSE_CONNECT + 8,
+};
+
+#define RESPONSE_CONNECT_HEVC (1 << 0)
+#define RESPONSE_CONNECT_VP9 (1 << 1)
+#define RESPONSE_CONNECT_AV1 (1 << 2)
+
+static GBytes *responses[N_RESPONSES];
+
+static GBytes *
+build_connect_result (guint variant)
+{
+  GstAmfNode *properties;
+  GstAmfNode *info;
+  GBytes *payload;
+
   /* Build properties object */
   properties = gst_amf_node_new_object ();
   gst_amf_node_append_field_string (properties, "fmsVer", "FMS/3,0,1,123", -1);
@@ -207,87 +256,192 @@ gst_rtmp_server_send_connect_result (GstRtmpConnection * connection,
   gst_amf_node_append_field_string (info, "description", "Connection succeeded.", -1);
   gst_amf_node_append_field_number (info, "objectEncoding", 0);
 
-  /* Add Enhanced RTMP support if client requested it */
-  if (client_caps && (client_caps->supports_hevc || client_caps->supports_vp9 ||
-          client_caps->supports_av1)) {
+  /* Enhanced RTMP support for the codecs the client requested */
+  if (variant) {
     GstAmfNode *fourcc_map = gst_amf_node_new_object ();
 
-    if (client_caps->supports_hevc) {
-      GstAmfNode *hevc_info = gst_amf_node_new_object ();
-      gst_amf_node_append_take_field (fourcc_map, "hvc1", hevc_info);
-    }
-    if (client_caps->supports_vp9) {
-      GstAmfNode *vp9_info = gst_amf_node_new_object ();
-      gst_amf_node_append_take_field (fourcc_map, "vp09", vp9_info);
-    }
-    if (client_caps->supports_av1) {
-      GstAmfNode *av1_info = gst_amf_node_new_object ();
-      gst_amf_node_append_take_field (fourcc_map, "av01", av1_info);
-    }
+    if (variant & RESPONSE_CONNECT_HEVC)
+      gst_amf_node_append_take_field (fourcc_map, "hvc1",
+          gst_amf_node_new_object ());
+    if (variant & RESPONSE_CONNECT_VP9)
+      gst_amf_node_append_take_field (fourcc_map, "vp09",
+          gst_amf_node_new_object ());
+    if (variant & RESPONSE_CONNECT_AV1)
+      gst_amf_node_append_take_field (fourcc_map, "av01",
+          gst_amf_node_new_object ());
 
     gst_amf_node_append_take_field (info, "videoFourCcInfoMap", fourcc_map);
-    GST_DEBUG ("Sending Enhanced RTMP capabilities in connect result");
   }
 
-  payload = gst_amf_serialize_command (transaction_id, "_result",
-      properties, info, NULL);
+  payload = gst_amf_serialize_command (0, "_result", properties, info, NULL);
 
   gst_amf_node_free (properties);
   gst_amf_node_free (info);
 
-  data = g_bytes_unref_to_data (payload, &size);
-  buffer = gst_rtmp_message_new_wrapped (GST_RTMP_MESSAGE_TYPE_COMMAND_AMF0,
-      3, 0, data, size);
+  return payload;
+}
 
-  GST_DEBUG ("Sending connect _result (transaction %.0f)", transaction_id);
-  gst_rtmp_connection_queue_message (connection, buffer);
+static GBytes *
+build_response (guint response)
+{
+  GstAmfNode *first, *second;
+  const gchar *command = "_result";
+  GBytes *payload;
+
+  if (response >= RESPONSE_CONNECT)
+    return build_connect_result (response - RESPONSE_CONNECT);
+
+  first = gst_amf_node_new_null ();
+
+  switch (response) {
+    case RESPONSE_RESULT:
+      second = gst_amf_node_new_null ();  /* _result with undefined */
+      break;
+    case RESPONSE_CREATE_STREAM:
+      second = gst_amf_node_new_number (0);
+      break;
+    case RESPONSE_PUBLISH_START:
+    default:
+      command = "onStatus";
+      second = gst_amf_node_new_object ();
+      gst_amf_node_append_field_string (second, "level", "status", -1);
+      gst_amf_node_append_field_string (second, "code",
+          "NetStream.Publish.Start", -1);
+      gst_amf_node_append_field_string (second, "description",
+          "Publishing started.", -1);
+      break;
+  }
+
+  payload = gst_amf_serialize_command (0, command, first, second, NULL);
+
+  gst_amf_node_free (first);
+  gst_amf_node_free (second);
+
+  return payload;
+}
+
+/* A copy of the response template with transaction_id patched in */
+static guint8 *
+response_new (guint response, gdouble transaction_id, gsize * size)
+{
+  const guint8 *template;
+  guint8 *data;
+  gsize offset;
+
+  if (g_once_init_enter (&responses[response]))
+    g_once_init_leave (&responses[response], build_response (response));
+
+  template = g_bytes_get_data (responses[response], size);
+  data = g_memdup2 (template, *size);
+
+  /* The command name string, then the number marker of the transaction
+   * ID */
+  offset = 3 + GST_READ_UINT16_BE (data + 1) + 1;
+  GST_WRITE_DOUBLE_BE (data + offset, transaction_id);
+
+  return data;
+}
+
+static void
+queue_response (GstRtmpConnection * connection, guint32 stream_id,
+    guint8 * data, gsize size)
+{
+  gst_rtmp_connection_queue_message (connection,
+      gst_rtmp_message_new_wrapped (GST_RTMP_MESSAGE_TYPE_COMMAND_AMF0,
+          3, stream_id, data, size));
+}
+
+guint8 *
+gst_rtmp_server_build_connect_result (gdouble transaction_id,
+    const GstRtmpEnhancedCaps * client_caps, gsize * size)
+{
+  guint variant = 0;
+
+  if (client_caps) {
+    if (client_caps->supports_hevc)
+      variant |= RESPONSE_CONNECT_HEVC;
+    if (client_caps->supports_vp9)
+      variant |= RESPONSE_CONNECT_VP9;
+    if (client_caps->supports_av1)
+      variant |= RESPONSE_CONNECT_AV1;
+  }
+
+  return response_new (RESPONSE_CONNECT + variant, transaction_id, size);
+}
+
+guint8 *
+gst_rtmp_server_build_create_stream_result (gdouble transaction_id,
+    guint32 stream_id, gsize * size)
+{
+  guint8 *data = response_new (RESPONSE_CREATE_STREAM, transaction_id, size);
+
+  /* The stream ID is the trailing number */
+  GST_WRITE_DOUBLE_BE (data + *size - 8, (gdouble) stream_id);
+  return data;
+}
+
+guint8 *
+gst_rtmp_server_build_publish_start (gsize * size)
+{
+  return response_new (RESPONSE_PUBLISH_START, 0, size);
+}
+
+guint8 *
+gst_rtmp_server_build_result (gdouble transaction_id, gsize * size)
+{
+  return response_new (RESPONSE_RESULT, transaction_id, size);
 }
 
 void
-gst_rtmp_server_send_create_stream_result (GstRtmpConnection * connection,
+gst_rtmp_server_send_connect_result (GstRtmpConnection * connection,
     gdouble transaction_id,
-    guint32 stream_id)
+    const GstRtmpEnhancedCaps * client_caps)
 {
-  GstAmfNode *null_node;
-  GstAmfNode *stream_id_node;
-  GBytes *payload;
   guint8 *data;
   gsize size;
-  GstBuffer *buffer;
 
   g_return_if_fail (GST_IS_RTMP_CONNECTION (connection));
 
   init_debug ();
 
-  null_node = gst_amf_node_new_null ();
-  stream_id_node = gst_amf_node_new_number ((gdouble) stream_id);
+  if (client_caps && (client_caps->supports_hevc || client_caps->supports_vp9
+          || client_caps->supports_av1))
+    GST_DEBUG ("Sending Enhanced RTMP capabilities in connect result");
 
-  payload = gst_amf_serialize_command (transaction_id, "_result",
-      null_node, stream_id_node, NULL);
+  data = gst_rtmp_server_build_connect_result (transaction_id, client_caps,
+      &size);
 
-  gst_amf_node_free (null_node);
-  gst_amf_node_free (stream_id_node);
+  GST_DEBUG ("Sending connect _result (transaction %.0f)", transaction_id);
+  queue_response (connection, 0, data, size);
+}
 
-  data = g_bytes_unref_to_data (payload, &size);
-  buffer = gst_rtmp_message_new_wrapped (GST_RTMP_MESSAGE_TYPE_COMMAND_AMF0,
-      3, 0, data, size);
+void
+gst_rtmp_server_send_create_stream_result (GstRtmpConnection * connection,
+    gdouble transaction_id,
+    guint32 stream_id)
+{
+  guint8 *data;
+  gsize size;
+
+  g_return_if_fail (GST_IS_RTMP_CONNECTION (connection));
+
+  init_debug ();
+
+  data = gst_rtmp_server_build_create_stream_result (transaction_id,
+      stream_id, &size);
 
   GST_DEBUG ("Sending createStream _result (transaction %.0f, stream %u)",
       transaction_id, stream_id);
-  gst_rtmp_connection_queue_message (connection, buffer);
+  queue_response (connection, 0, data, size);
 }
 
 void
 gst_rtmp_server_send_publish_start (GstRtmpConnection * connection,
     guint32 stream_id)
 {
-  GstAmfNode *null_node;
-  GstAmfNode *info;
-  GBytes *payload;
+  GstRtmpUserControl uc;
   guint8 *data;
   gsize size;
-  GstBuffer *buffer;
-  GstRtmpUserControl uc;
 
   g_return_if_fail (GST_IS_RTMP_CONNECTION (connection));
 
@@ -300,12 +454,35 @@ gst_rtmp_server_send_publish_start (GstRtmpConnection * connection,
   gst_rtmp_connection_queue_message (connection,
       gst_rtmp_message_new_user_control (&uc));
 
+  data = gst_rtmp_server_build_publish_start (&size);
+
+  GST_DEBUG ("Sending onStatus NetStream.Publish.Start (stream %u)", stream_id);
+  queue_response (connection, stream_id, data, size);
+}
+
+void
+gst_rtmp_server_send_publish_error (GstRtmpConnection * connection,
+    guint32 stream_id, const gchar * code, const gchar * description)
+{
+  GstAmfNode *null_node;
+  GstAmfNode *info;
+  GBytes *payload;
+  guint8 *data;
+  gsize size;
+  GstBuffer *buffer;
+
+  g_return_if_fail (GST_IS_RTMP_CONNECTION (connection));
+  g_return_if_fail (code != NULL);
+
+  init_debug ();
+
   /* Build onStatus info object */
   null_node = gst_amf_node_new_null ();
   info = gst_amf_node_new_object ();
-  gst_amf_node_append_field_string (info, "level", "status", -1);
-  gst_amf_node_append_field_string (info, "code", "NetStream.Publish.Start", -1);
-  gst_amf_node_append_field_string (info, "description", "Publishing started.", -1);
+  gst_amf_node_append_field_string (info, "level", "error", -1);
+  gst_amf_node_append_field_string (info, "code", code, -1);
+  gst_amf_node_append_field_string (info, "description",
+      description ? description : "", -1);
 
   payload = gst_amf_serialize_command (0, "onStatus", null_node, info, NULL);
 
@@ -316,7 +493,7 @@ gst_rtmp_server_send_publish_start (GstRtmpConnection * connection,
   buffer = gst_rtmp_message_new_wrapped (GST_RTMP_MESSAGE_TYPE_COMMAND_AMF0,
       3, stream_id, data, size);
 
-  GST_DEBUG ("Sending onStatus NetStream.Publish.Start (stream %u)", stream_id);
+  GST_DEBUG ("Sending onStatus %s (stream %u)", code, stream_id);
   gst_rtmp_connection_queue_message (connection, buffer);
 }
 
@@ -324,58 +501,151 @@ void
 gst_rtmp_server_send_release_stream_result (GstRtmpConnection * connection,
     gdouble transaction_id)
 {
-  GstAmfNode *null_node, *undefined_node;
-  GBytes *payload;
-  gpointer data;
+  guint8 *data;
   gsize size;
-  GstBuffer *buffer;
 
   g_return_if_fail (connection != NULL);
 
-  null_node = gst_amf_node_new_null ();
-  undefined_node = gst_amf_node_new_null ();  /* _result with undefined */
-
-  payload = gst_amf_serialize_command (transaction_id, "_result",
-      null_node, undefined_node, NULL);
-
-  gst_amf_node_free (null_node);
-  gst_amf_node_free (undefined_node);
-
-  data = g_bytes_unref_to_data (payload, &size);
-  buffer = gst_rtmp_message_new_wrapped (GST_RTMP_MESSAGE_TYPE_COMMAND_AMF0,
-      3, 0, data, size);
+  data = gst_rtmp_server_build_result (transaction_id, &size);
 
   GST_DEBUG ("Sending releaseStream _result (transaction %.0f)", transaction_id);
-  gst_rtmp_connection_queue_message (connection, buffer);
+  queue_response (connection, 0, data, size);
 }
 
 void
 gst_rtmp_server_send_fcpublish_result (GstRtmpConnection * connection,
     gdouble transaction_id)
 {
-  GstAmfNode *null_node, *undefined_node;
-  GBytes *payload;
-  gpointer data;
+  guint8 *data;
   gsize size;
-  GstBuffer *buffer;
 
   g_return_if_fail (connection != NULL);
 
-  null_node = gst_amf_node_new_null ();
-  undefined_node = gst_amf_node_new_null ();
+  data = gst_rtmp_server_build_result (transaction_id, &size);
 
-  payload = gst_amf_serialize_command (transaction_id, "_result",
-      null_node, undefined_node, NULL);
+  GST_DEBUG ("Sending FCPublish _result (transaction %.0f)", transaction_id);
+  queue_response (connection, 0, data, size);
+}
 
-  gst_amf_node_free (null_node);
-  gst_amf_node_free (undefined_node);
+void
+gst_rtmp_server_send_result (GstRtmpConnection * connection,
+    const gchar * command_name, gdouble transaction_id)
+{
+  guint8 *data;
+  gsize size;
 
-  data = g_bytes_unref_to_data (payload, &size);
-  buffer = gst_rtmp_message_new_wrapped (GST_RTMP_MESSAGE_TYPE_COMMAND_AMF0,
-      3, 0, data, size);
+  g_return_if_fail (connection != NULL);
 
-  GST_DEBUG ("Sending FCPublish _result (transaction %.0f)", transaction_id);
-  gst_rtmp_connection_queue_message (connection, buffer);
+  data = gst_rtmp_server_build_result (transaction_id, &size);
+
+  GST_DEBUG ("Sending %s _result (transaction %.0f)", command_name,
+      transaction_id);
+  queue_response (connection, 0, data, size);
+}
+
+/* ========== Aggregate messages ========== */
+
+/* FLV tag header of each sub-message: type, size, timestamp, extended
+ * timestamp and stream ID. A 4 byte back pointer follows its body. */
+#define AGGREGATE_HEADER_SIZE 11
+#define AGGREGATE_BACK_POINTER_SIZE 4
+
+gboolean
+gst_rtmp_server_foreach_aggregate (GstRtmpConnection * connection,
+    GstBuffer * buffer, GstRtmpServerMediaCallback func, gpointer user_data)
+{
+  GstRtmpMeta *meta;
+  GstMapInfo map;
+  GstClockTime dts;
+  gboolean have_first = FALSE;
+  guint32 first_ts = 0, prev_ts = 0;
+  gsize offset = 0;
+  gboolean ret = TRUE;
+
+  g_return_val_if_fail (GST_IS_BUFFER (buffer), FALSE);
+  g_return_val_if_fail (func != NULL, FALSE);
+
+  init_debug ();
+
+  meta = gst_buffer_get_rtmp_meta (buffer);
+  if (!meta || meta->type != GST_RTMP_MESSAGE_TYPE_AGGREGATE)
+    return FALSE;
+
+  if (!gst_buffer_map (buffer, &map, GST_MAP_READ))
+    return FALSE;
+
+  dts = GST_BUFFER_DTS (buffer);
+
+  while (offset < map.size) {
+    const guint8 *header = map.data + offset;
+    GstRtmpMessageType type;
+    GstRtmpMeta *sub_meta;
+    GstBuffer *sub;
+    guint32 size, ts, delta, ts_delta;
+
+    if (map.size - offset < AGGREGATE_HEADER_SIZE) {
+      ret = FALSE;
+      break;
+    }
+
+    type = header[0];
+    size = GST_READ_UINT24_BE (header + 1);
+    ts = GST_READ_UINT24_BE (header + 4) | ((guint32) header[7] << 24);
+
+    if (map.size - offset - AGGREGATE_HEADER_SIZE < size) {
+      ret = FALSE;
+      break;
+    }
+
+    /* Sub-message timestamps are relative to the first one, which stands
+     * for the timestamp of the aggregate. Like for any other message,
+     * ts_delta is the delta to the previous one, the first takes over the
+     * delta of the aggregate. */
+    if (!have_first) {
+      first_ts = prev_ts = ts;
+      ts_delta = meta->ts_delta;
+      have_first = TRUE;
+    } else {
+      ts_delta = ts - prev_ts;
+    }
+    delta = ts - first_ts;
+    prev_ts = ts;
+
+    if (type == GST_RTMP_MESSAGE_TYPE_VIDEO ||
+        type == GST_RTMP_MESSAGE_TYPE_AUDIO ||
+        type == GST_RTMP_MESSAGE_TYPE_DATA_AMF0) {
+      /* Shares the memory of the aggregate */
+      sub = gst_buffer_copy_region (buffer, GST_BUFFER_COPY_MEMORY,
+          offset + AGGREGATE_HEADER_SIZE, size);
+
+      sub_meta = gst_buffer_add_rtmp_meta (sub);
+      sub_meta->cstream = meta->cstream;
+      sub_meta->ts_delta = ts_delta;
+      sub_meta->size = size;
+      sub_meta->type = type;
+      sub_meta->mstream = meta->mstream;
+
+      if (GST_CLOCK_TIME_IS_VALID (dts))
+        GST_BUFFER_DTS (sub) = dts + delta * GST_MSECOND;
+
+      func (connection, sub, user_data);
+      gst_buffer_unref (sub);
+    } else {
+      GST_DEBUG ("Skipping message of type %d in aggregate", type);
+    }
+
+    /* The back pointer of the last sub-message may be missing */
+    offset += AGGREGATE_HEADER_SIZE + size;
+    offset += MIN (AGGREGATE_BACK_POINTER_SIZE, map.size - offset);
+  }
+
+  gst_buffer_unmap (buffer, &map);
+
+  if (!ret)
+    GST_WARNING ("Malformed aggregate message at offset %" G_GSIZE_FORMAT
+        " of %" G_GSIZE_FORMAT, offset, map.size);
+
+  return ret;
 }
 
 /* ========== Server command handlers ========== */
@@ -424,6 +694,10 @@ server_handle_input (GstRtmpConnection * connection, GstBuffer * buffer,
     if (data->media_callback) {
       data->media_callback (connection, buffer, data->user_data);
     }
+  } else if (meta->type == GST_RTMP_MESSAGE_TYPE_AGGREGATE &&
+      data->media_callback) {
+    gst_rtmp_server_foreach_aggregate (connection, buffer,
+        data->media_callback, data->user_data);
   }
 }
 
@@ -75,6 +75,15 @@ void gst_rtmp_server_accept_async (GSocketConnection * socket_connection,
 GstRtmpConnection * gst_rtmp_server_accept_finish (GAsyncResult * result,
     GError ** error);
 
+/* Call func on each audio, video and data message of an aggregate
+ * message, as RTMP messages sharing its memory. Their DTS is rebased on
+ * the aggregate's and their ts_delta is the delta to the previous
+ * message. Returns FALSE if the aggregate is malformed. */
+gboolean gst_rtmp_server_foreach_aggregate (GstRtmpConnection * connection,
+    GstBuffer * buffer,
+    GstRtmpServerMediaCallback func,
+    gpointer user_data);
+
 /* Set up server to handle incoming RTMP commands */
 void gst_rtmp_server_setup_handlers (GstRtmpConnection * connection,
     GstRtmpServerPublishCallback publish_callback,
@@ -82,6 +91,29 @@ void gst_rtmp_server_setup_handlers (GstRtmpConnection * connection,
     gpointer user_data,
     GDestroyNotify user_data_destroy);
 
+/* Send Window Acknowledgement Size, Set Peer Bandwidth and Set Chunk Size
+ * ahead of the connect result. 0 skips a message. */
+void gst_rtmp_server_send_connect_setup (GstRtmpConnection * connection,
+    guint32 window_ack_size,
+    guint32 peer_bandwidth,
+    guint32 chunk_size);
+
+/* Command response payloads, copied from templates serialized once per
+ * process with the numbers patched in. Free with g_free(). */
+guint8 * gst_rtmp_server_build_connect_result (gdouble transaction_id,
+    const GstRtmpEnhancedCaps * client_caps,
+    gsize * size);
+
+guint8 * gst_rtmp_server_build_create_stream_result (gdouble transaction_id,
+    guint32 stream_id,
+    gsize * size);
+
+guint8 * gst_rtmp_server_build_publish_start (gsize * size);
+
+/* _result with null and undefined, answering commands without a value */
+guint8 * gst_rtmp_server_build_result (gdouble transaction_id,
+    gsize * size);
+
 /* Send connect result (_result response to 'connect' command) */
 void gst_rtmp_server_send_connect_result (GstRtmpConnection * connection,
     gdouble transaction_id,
@@ -96,6 +128,12 @@ void gst_rtmp_server_send_create_stream_result (GstRtmpConnection * connection,
 void gst_rtmp_server_send_publish_start (GstRtmpConnection * connection,
     guint32 stream_id);
 
+/* Send an onStatus error refusing a publish, e.g. NetStream.Publish.BadName */
+void gst_rtmp_server_send_publish_error (GstRtmpConnection * connection,
+    guint32 stream_id,
+    const gchar * code,
+    const gchar * description);
+
 /* Send releaseStream result */
 void gst_rtmp_server_send_release_stream_result (GstRtmpConnection * connection,
     gdouble transaction_id);
@@ -104,6 +142,11 @@ void gst_rtmp_server_send_release_stream_result (GstRtmpConnection * connection,
 void gst_rtmp_server_send_fcpublish_result (GstRtmpConnection * connection,
     gdouble transaction_id);
 
+/* Send a _result without a value to any other command */
+void gst_rtmp_server_send_result (GstRtmpConnection * connection,
+    const gchar * command_name,
+    gdouble transaction_id);
+
 /* Parse Enhanced RTMP capabilities from connect command object */
 gboolean gst_rtmp_enhanced_caps_parse (const GstAmfNode * command_object,
     GstRtmpEnhancedCaps * out);
@@ -0,0 +1,182 @@
+/*
+ * GStreamer
+ * Copyright (C) 2025 Yaron Torbaty <yarontorbaty@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "rtmptimerwheel.h"
+#include <string.h>
+
+void
+rtmp2_timer_init (Rtmp2Timer * timer, gpointer owner)
+{
+  memset (timer, 0, sizeof (Rtmp2Timer));
+  timer->link.data = owner;
+}
+
+/* func is called with the owners of the expired timers. Owners may only
+ * go away on the wheel's thread, after cancelling their timer, so they are
+ * still alive when it runs. */
+void
+rtmp2_timer_wheel_init (Rtmp2TimerWheel * wheel, Rtmp2TimerFunc func)
+{
+  memset (wheel, 0, sizeof (Rtmp2TimerWheel));
+  g_mutex_init (&wheel->lock);
+  wheel->func = func;
+}
+
+/* Once stopped and no timer is cancelled anymore */
+void
+rtmp2_timer_wheel_clear (Rtmp2TimerWheel * wheel)
+{
+  g_mutex_clear (&wheel->lock);
+}
+
+static void
+rtmp2_timer_wheel_unlink_locked (Rtmp2TimerWheel * wheel, Rtmp2Timer * timer)
+{
+  g_queue_unlink (&wheel->slots[timer->expires % RTMP2_TIMER_WHEEL_SLOTS],
+      &timer->link);
+  timer->armed = FALSE;
+}
+
+/* Expire timer after ticks, replacing its current timeout. 0 only cancels
+ * it, as does a stopped wheel. */
+void
+rtmp2_timer_wheel_arm (Rtmp2TimerWheel * wheel, Rtmp2Timer * timer,
+    guint ticks)
+{
+  g_mutex_lock (&wheel->lock);
+  if (timer->armed)
+    rtmp2_timer_wheel_unlink_locked (wheel, timer);
+
+  if (ticks > 0 && !wheel->stopped) {
+    timer->expires = wheel->now + ticks;
+    g_queue_push_tail_link (&wheel->slots[timer->expires %
+            RTMP2_TIMER_WHEEL_SLOTS], &timer->link);
+    timer->armed = TRUE;
+  }
+  g_mutex_unlock (&wheel->lock);
+}
+
+/* Safe from any thread, like checking whether the timer is armed */
+void
+rtmp2_timer_wheel_cancel (Rtmp2TimerWheel * wheel, Rtmp2Timer * timer)
+{
+  g_mutex_lock (&wheel->lock);
+  if (timer->armed)
+    rtmp2_timer_wheel_unlink_locked (wheel, timer);
+  g_mutex_unlock (&wheel->lock);
+}
+
+gboolean
+rtmp2_timer_wheel_is_armed (Rtmp2TimerWheel * wheel, Rtmp2Timer * timer)
+{
+  gboolean armed;
+
+  g_mutex_lock (&wheel->lock);
+  armed = timer->armed;
+  g_mutex_unlock (&wheel->lock);
+
+  return armed;
+}
+
+/* Move the wheel up to tick target, catching up on the ticks in between.
+ * Returns the owners of the timers that expired, in expiry order. They
+ * are disarmed already. */
+GList *
+rtmp2_timer_wheel_advance (Rtmp2TimerWheel * wheel, guint64 target)
+{
+  GList *expired = NULL, *l, *next;
+
+  g_mutex_lock (&wheel->lock);
+  while (wheel->now < target) {
+    GQueue *slot;
+
+    wheel->now++;
+    slot = &wheel->slots[wheel->now % RTMP2_TIMER_WHEEL_SLOTS];
+    for (l = slot->head; l; l = next) {
+      Rtmp2Timer *timer = (Rtmp2Timer *) l;
+
+      next = l->next;
+      if (timer->expires <= wheel->now) {
+        rtmp2_timer_wheel_unlink_locked (wheel, timer);
+        expired = g_list_prepend (expired, l->data);
+      }
+    }
+  }
+  g_mutex_unlock (&wheel->lock);
+
+  return g_list_reverse (expired);
+}
+
+/* Runs on the event loop thread every tick */
+static gboolean
+rtmp2_timer_wheel_tick (gpointer user_data)
+{
+  Rtmp2TimerWheel *wheel = user_data;
+  GList *expired, *l;
+
+  expired = rtmp2_timer_wheel_advance (wheel,
+      (g_get_monotonic_time () - wheel->start_time) / G_TIME_SPAN_SECOND);
+  for (l = expired; l; l = l->next)
+    wheel->func (l->data);
+  g_list_free (expired);
+
+  return G_SOURCE_CONTINUE;
+}
+
+/* Start ticking once per second on the main context of the event loop */
+void
+rtmp2_timer_wheel_start (Rtmp2TimerWheel * wheel, GMainContext * context)
+{
+  g_mutex_lock (&wheel->lock);
+  wheel->start_time = g_get_monotonic_time ();
+  wheel->now = 0;
+  wheel->stopped = FALSE;
+  g_mutex_unlock (&wheel->lock);
+
+  wheel->source = g_timeout_source_new (1000);
+  g_source_set_callback (wheel->source, rtmp2_timer_wheel_tick, wheel, NULL);
+  g_source_attach (wheel->source, context);
+}
+
+/* Stop ticking and disarm all timers, on the event loop thread */
+void
+rtmp2_timer_wheel_stop (Rtmp2TimerWheel * wheel)
+{
+  guint i;
+
+  if (wheel->source) {
+    g_source_destroy (wheel->source);
+    g_clear_pointer (&wheel->source, g_source_unref);
+  }
+
+  g_mutex_lock (&wheel->lock);
+  wheel->stopped = TRUE;
+  for (i = 0; i < RTMP2_TIMER_WHEEL_SLOTS; i++) {
+    GList *link;
+
+    while ((link = g_queue_pop_head_link (&wheel->slots[i])))
+      ((Rtmp2Timer *) link)->armed = FALSE;
+  }
+  g_mutex_unlock (&wheel->lock);
+}
@@ -0,0 +1,68 @@
+/*
+ * GStreamer
+ * Copyright (C) 2025 Yaron Torbaty <yarontorbaty@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __RTMP2_TIMER_WHEEL_H__
+#define __RTMP2_TIMER_WHEEL_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Slots of the timer wheel, ticking once per second */
+#define RTMP2_TIMER_WHEEL_SLOTS 256
+
+/* Timeout embedded in its owner. All fields are protected by the lock of
+ * the wheel it is armed on. */
+typedef struct {
+  GList link;                  /* first, data is the owner */
+  guint64 expires;             /* wheel tick */
+  gboolean armed;
+} Rtmp2Timer;
+
+/* Called on the wheel's thread with the owner of an expired timer */
+typedef void (*Rtmp2TimerFunc) (gpointer owner);
+
+/* Timeouts of one event loop. Timers hash into the slot of the tick they
+ * expire at, arming and cancelling are O(1). A timeout longer than the
+ * wheel stays in its slot for further rounds. */
+typedef struct {
+  GMutex lock;
+  GQueue slots[RTMP2_TIMER_WHEEL_SLOTS];
+  guint64 now;                 /* current tick */
+  gint64 start_time;           /* monotonic time of tick 0 */
+  gboolean stopped;
+  GSource *source;
+  Rtmp2TimerFunc func;
+} Rtmp2TimerWheel;
+
+void rtmp2_timer_init (Rtmp2Timer *timer, gpointer owner);
+
+void rtmp2_timer_wheel_init (Rtmp2TimerWheel *wheel, Rtmp2TimerFunc func);
+void rtmp2_timer_wheel_clear (Rtmp2TimerWheel *wheel);
+void rtmp2_timer_wheel_start (Rtmp2TimerWheel *wheel, GMainContext *context);
+void rtmp2_timer_wheel_stop (Rtmp2TimerWheel *wheel);
+void rtmp2_timer_wheel_arm (Rtmp2TimerWheel *wheel, Rtmp2Timer *timer, guint ticks);
+void rtmp2_timer_wheel_cancel (Rtmp2TimerWheel *wheel, Rtmp2Timer *timer);
+gboolean rtmp2_timer_wheel_is_armed (Rtmp2TimerWheel *wheel, Rtmp2Timer *timer);
+GList *rtmp2_timer_wheel_advance (Rtmp2TimerWheel *wheel, guint64 target);
+
+G_END_DECLS
+
+#endif /* __RTMP2_TIMER_WHEEL_H__ */
@@ -0,0 +1,307 @@
+/* GStreamer
+ * Copyright (C) 2025 Yaron Torbaty <yarontorbaty@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/* Helpers shared by the rtmp2serversrc benchmarks: a client event loop,
+ * publishers built on the RTMP client of the plugin and a small
+ * percentile report. Each benchmark is a single program including this
+ * header. */
+
+#ifndef __RTMP2_BENCH_H__
+#define __RTMP2_BENCH_H__
+
+#include <gst/gst.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rtmp/rtmpclient.h"
+#include "rtmp/rtmpmessage.h"
+
+#define BENCH_FLASH_VER "FMLE/3.0 (compatible; FMSc/1.0)"
+
+/* Publishers never let more than this many messages wait in their
+ * connection, so a slow server shows up as lower throughput rather than
+ * as client memory */
+#define BENCH_MAX_QUEUED 64
+
+/* FLV tag header, AVC header and the send time */
+#define BENCH_SEND_TIME_END (11 + 5 + 8)
+
+typedef struct
+{
+  GMainContext *context;
+  GMainLoop *loop;
+  GThread *thread;
+} BenchLoop;
+
+typedef struct
+{
+  BenchLoop *loop;
+  GstRtmpLocation location;
+  GstRtmpConnection *connection;
+  guint32 stream_id;
+
+  GMutex lock;
+  GCond cond;
+  gboolean done;
+  gboolean closed;
+  GError *error;
+
+  /* Monotonic times of the connect call and of NetStream.Publish.Start */
+  gint64 start_time;
+  gint64 publish_time;
+} BenchPublisher;
+
+static gpointer
+bench_loop_thread_func (gpointer user_data)
+{
+  BenchLoop *loop = user_data;
+
+  g_main_context_push_thread_default (loop->context);
+  g_main_loop_run (loop->loop);
+  g_main_context_pop_thread_default (loop->context);
+  return NULL;
+}
+
+static BenchLoop *
+bench_loop_new (void)
+{
+  BenchLoop *loop = g_new0 (BenchLoop, 1);
+
+  loop->context = g_main_context_new ();
+  loop->loop = g_main_loop_new (loop->context, FALSE);
+  loop->thread = g_thread_new ("bench-client", bench_loop_thread_func, loop);
+  return loop;
+}
+
+static void
+bench_loop_free (BenchLoop * loop)
+{
+  g_main_loop_quit (loop->loop);
+  g_thread_join (loop->thread);
+  g_main_loop_unref (loop->loop);
+  g_main_context_unref (loop->context);
+  g_free (loop);
+}
+
+static void
+bench_publisher_finish (BenchPublisher * pub, GError * error)
+{
+  g_mutex_lock (&pub->lock);
+  pub->publish_time = g_get_monotonic_time ();
+  pub->error = error;
+  pub->done = TRUE;
+  g_cond_signal (&pub->cond);
+  g_mutex_unlock (&pub->lock);
+}
+
+static void
+bench_publish_done (GObject * source, GAsyncResult * result,
+    gpointer user_data)
+{
+  BenchPublisher *pub = user_data;
+  GError *error = NULL;
+
+  gst_rtmp_client_start_publish_finish (pub->connection, result,
+      &pub->stream_id, &error);
+  bench_publisher_finish (pub, error);
+}
+
+static void
+bench_connect_done (GObject * source, GAsyncResult * result,
+    gpointer user_data)
+{
+  BenchPublisher *pub = user_data;
+  GError *error = NULL;
+
+  pub->connection = gst_rtmp_client_connect_finish (result, &error);
+  if (!pub->connection) {
+    bench_publisher_finish (pub, error);
+    return;
+  }
+
+  gst_rtmp_client_start_publish_async (pub->connection,
+      pub->location.stream, NULL, bench_publish_done, pub);
+}
+
+static gboolean
+bench_connect_cb (gpointer user_data)
+{
+  BenchPublisher *pub = user_data;
+
+  pub->start_time = g_get_monotonic_time ();
+  gst_rtmp_client_connect_async (&pub->location, NULL, bench_connect_done,
+      pub);
+  return G_SOURCE_REMOVE;
+}
+
+/* Start connecting and publishing from the client loop, returns at once */
+static BenchPublisher *
+bench_publisher_start (BenchLoop * loop, guint port, const gchar * app,
+    const gchar * stream_key)
+{
+  BenchPublisher *pub = g_new0 (BenchPublisher, 1);
+
+  pub->loop = loop;
+  pub->location.scheme = GST_RTMP_SCHEME_RTMP;
+  pub->location.host = g_strdup ("127.0.0.1");
+  pub->location.port = port;
+  pub->location.application = g_strdup (app);
+  pub->location.stream = g_strdup (stream_key);
+  pub->location.authmod = GST_RTMP_AUTHMOD_NONE;
+  pub->location.timeout = 10;
+  pub->location.flash_ver = g_strdup (BENCH_FLASH_VER);
+  pub->location.publish = TRUE;
+  g_mutex_init (&pub->lock);
+  g_cond_init (&pub->cond);
+
+  g_main_context_invoke (loop->context, bench_connect_cb, pub);
+  return pub;
+}
+
+/* Wait for NetStream.Publish.Start or a failure */
+static gboolean
+bench_publisher_wait (BenchPublisher * pub)
+{
+  g_mutex_lock (&pub->lock);
+  while (!pub->done)
+    g_cond_wait (&pub->cond, &pub->lock);
+  g_mutex_unlock (&pub->lock);
+
+  if (pub->error) {
+    g_printerr ("publisher %s/%s failed: %s\n", pub->location.application,
+        pub->location.stream, pub->error->message);
+    return FALSE;
+  }
+  return TRUE;
+}
+
+static BenchPublisher *
+bench_publisher_new (BenchLoop * loop, guint port, const gchar * app,
+    const gchar * stream_key)
+{
+  BenchPublisher *pub = bench_publisher_start (loop, port, app, stream_key);
+
+  bench_publisher_wait (pub);
+  return pub;
+}
+
+static gboolean
+bench_publisher_close_cb (gpointer user_data)
+{
+  BenchPublisher *pub = user_data;
+
+  if (pub->connection) {
+    gst_rtmp_connection_close (pub->connection);
+    g_object_unref (pub->connection);
+  }
+
+  g_mutex_lock (&pub->lock);
+  pub->connection = NULL;
+  pub->closed = TRUE;
+  g_cond_signal (&pub->cond);
+  g_mutex_unlock (&pub->lock);
+  return G_SOURCE_REMOVE;
+}
+
+static void
+bench_publisher_free (BenchPublisher * pub)
+{
+  g_mutex_lock (&pub->lock);
+  g_main_context_invoke (pub->loop->context, bench_publisher_close_cb, pub);
+  while (!pub->closed)
+    g_cond_wait (&pub->cond, &pub->lock);
+  g_mutex_unlock (&pub->lock);
+
+  g_clear_error (&pub->error);
+  gst_rtmp_location_clear (&pub->location);
+  g_mutex_clear (&pub->lock);
+  g_cond_clear (&pub->cond);
+  g_free (pub);
+}
+
+/* Queue one AVC video message of size bytes. The first 8 payload bytes
+ * after the 5-byte AVC header carry the monotonic send time, so a sink can
+ * measure the delivery delay. */
+static void
+bench_publisher_send_video (BenchPublisher * pub, guint32 timestamp,
+    gboolean keyframe, gsize size)
+{
+  GstBuffer *message;
+  guint8 *data;
+  gint64 now;
+
+  size = MAX (size, 13);
+  data = g_malloc0 (size);
+  data[0] = keyframe ? 0x17 : 0x27;
+  data[1] = 1;
+
+  while (gst_rtmp_connection_get_num_queued (pub->connection) >
+      BENCH_MAX_QUEUED)
+    g_usleep (100);
+
+  now = g_get_monotonic_time ();
+  GST_WRITE_UINT64_BE (data + 5, now);
+
+  message = gst_rtmp_message_new_wrapped (GST_RTMP_MESSAGE_TYPE_VIDEO, 4,
+      pub->stream_id, data, size);
+  GST_BUFFER_DTS (message) = timestamp * GST_MSECOND;
+  gst_rtmp_connection_queue_message (pub->connection, message);
+}
+
+/* Send time written by bench_publisher_send_video() into an FLV video
+ * tag as pushed by the element, or 0 for any other buffer */
+static gint64
+bench_flv_buffer_send_time (GstBuffer * buffer)
+{
+  guint8 data[BENCH_SEND_TIME_END];
+  gsize size = gst_buffer_extract (buffer, 0, data, sizeof (data));
+
+  if (size < sizeof (data) || data[0] != 9 || (data[11] != 0x17 &&
+          data[11] != 0x27))
+    return 0;
+  return GST_READ_UINT64_BE (data + 11 + 5);
+}
+
+static gint
+bench_compare_int64 (gconstpointer a, gconstpointer b)
+{
+  gint64 va = *(const gint64 *) a;
+  gint64 vb = *(const gint64 *) b;
+
+  return va < vb ? -1 : va > vb;
+}
+
+/* Print min, median, 99th percentile and max of samples in
+ * microseconds, sorting them in place */
+static void
+bench_report_us (const gchar * name, gint64 * samples, guint n)
+{
+  if (n == 0) {
+    g_print ("%-32s no samples\n", name);
+    return;
+  }
+
+  qsort (samples, n, sizeof (gint64), bench_compare_int64);
+  g_print ("%-32s n=%-7u min=%-7" G_GINT64_FORMAT " p50=%-7" G_GINT64_FORMAT
+      " p99=%-7" G_GINT64_FORMAT " max=%-7" G_GINT64_FORMAT " us\n", name, n,
+      samples[0], samples[n / 2], samples[MIN (n - 1, n * 99 / 100)],
+      samples[n - 1]);
+}
+
+#endif /* __RTMP2_BENCH_H__ */
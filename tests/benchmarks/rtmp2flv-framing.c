@@ -0,0 +1,104 @@
+/* GStreamer
+ * Copyright (C) 2025 Yaron Torbaty <yarontorbaty@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/* CPU per byte of FLV tag framing: rtmp2_flv_tag_to_buffer(), which
+ * shares the tag body, against allocating a buffer for the whole tag and
+ * copying the body into it as the output path used to.
+ *
+ * Usage: rtmp2flv-framing [megabytes-per-size]
+ */
+
+#include <gst/gst.h>
+#include <stdlib.h>
+
+#include "rtmp/rtmpflv.h"
+
+static GstBuffer *
+copy_to_buffer (const Rtmp2FlvTag * tag)
+{
+  gsize data_size = gst_buffer_get_size (tag->data);
+  GstBuffer *buffer;
+  GstMapInfo map;
+
+  buffer = gst_buffer_new_allocate (NULL,
+      RTMP2_FLV_TAG_HEADER_SIZE + data_size + 4, NULL);
+  gst_buffer_map (buffer, &map, GST_MAP_WRITE);
+  map.data[0] = tag->tag_type;
+  GST_WRITE_UINT24_BE (map.data + 1, data_size);
+  GST_WRITE_UINT24_BE (map.data + 4, tag->timestamp & 0xffffff);
+  map.data[7] = (tag->timestamp >> 24) & 0xff;
+  GST_WRITE_UINT24_BE (map.data + 8, 0);
+  gst_buffer_extract (tag->data, 0, map.data + RTMP2_FLV_TAG_HEADER_SIZE,
+      data_size);
+  GST_WRITE_UINT32_BE (map.data + RTMP2_FLV_TAG_HEADER_SIZE + data_size,
+      RTMP2_FLV_TAG_HEADER_SIZE + data_size);
+  gst_buffer_unmap (buffer, &map);
+
+  return buffer;
+}
+
+static gdouble
+run (GstBuffer * (*frame) (const Rtmp2FlvTag *), const Rtmp2FlvTag * tag,
+    guint iterations)
+{
+  gint64 start = g_get_monotonic_time ();
+  guint i;
+
+  for (i = 0; i < iterations; i++)
+    gst_buffer_unref (frame (tag));
+
+  /* Nanoseconds per body byte */
+  return (g_get_monotonic_time () - start) * 1000.0 / ((gdouble) iterations *
+      gst_buffer_get_size (tag->data));
+}
+
+gint
+main (gint argc, gchar * argv[])
+{
+  static const gsize sizes[] = { 256, 4096, 65536, 1048576 };
+  guint megabytes = argc > 1 ? atoi (argv[1]) : 1024;
+  guint i;
+
+  gst_init (&argc, &argv);
+
+  g_print ("%-10s %-12s %-12s %-12s\n", "body", "copy ns/B", "share ns/B",
+      "share ns/tag");
+
+  for (i = 0; i < G_N_ELEMENTS (sizes); i++) {
+    Rtmp2FlvTag tag = { 0, };
+    guint iterations = MAX (1, (guint64) megabytes * 1024 * 1024 / sizes[i]);
+    gdouble copy, share;
+
+    tag.tag_type = RTMP2_FLV_TAG_VIDEO;
+    tag.timestamp = 1000;
+    tag.data = gst_buffer_new_allocate (NULL, sizes[i], NULL);
+    gst_buffer_memset (tag.data, 0, 0x5a, sizes[i]);
+    tag.data_size = sizes[i];
+
+    copy = run (copy_to_buffer, &tag, iterations);
+    share = run (rtmp2_flv_tag_to_buffer, &tag, iterations);
+
+    g_print ("%-10" G_GSIZE_FORMAT " %-12.4f %-12.4f %-12.1f\n", sizes[i],
+        copy, share, share * sizes[i]);
+
+    rtmp2_flv_tag_clear (&tag);
+  }
+
+  return 0;
+}
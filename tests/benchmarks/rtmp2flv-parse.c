@@ -0,0 +1,103 @@
+/* GStreamer
+ * Copyright (C) 2025 Yaron Torbaty <yarontorbaty@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/* Time per call of rtmp2_flv_tag_parse_header() for legacy audio and
+ * video headers and for E-RTMP ExHeader, ModEx and multitrack video
+ * headers. Each call starts from a cleared tag, as a newly received tag
+ * does.
+ *
+ * Usage: rtmp2flv-parse [millions-of-calls-per-header]
+ */
+
+#include <gst/gst.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rtmp/rtmpflv.h"
+
+#define HVC1 'h', 'v', 'c', '1'
+#define AV01 'a', 'v', '0', '1'
+
+/* IsExHeader, FrameType and VideoPacketType */
+#define EX_HEADER(frame_type, packet_type) \
+  (0x80 | (frame_type) << 4 | (packet_type))
+
+typedef struct
+{
+  const gchar *name;
+  Rtmp2FlvTagType tag_type;
+  guint8 data[16];
+  gsize size;
+} ParseHeader;
+
+static const ParseHeader headers[] = {
+  {"legacy aac", RTMP2_FLV_TAG_AUDIO, {0xaf, 0x01, 0xaa}, 3},
+  {"legacy avc", RTMP2_FLV_TAG_VIDEO, {0x17, 0x01, 0x00, 0x00, 0x28, 0xaa},
+      6},
+  {"exheader hevc", RTMP2_FLV_TAG_VIDEO, {EX_HEADER (1, 1), HVC1, 0x00,
+          0x00, 0x28, 0xaa}, 9},
+  {"modex timestamp offset", RTMP2_FLV_TAG_VIDEO, {EX_HEADER (1, 7), 0x02,
+          0x07, 0xa1, 0x20, 0x01, HVC1, 0x00, 0x00, 0x00, 0xaa}, 14},
+  {"multitrack one track", RTMP2_FLV_TAG_VIDEO, {EX_HEADER (1, 6), 0x01,
+          HVC1, 0x00, 0x00, 0x00, 0x05, 0xaa}, 11},
+  {"multitrack many tracks", RTMP2_FLV_TAG_VIDEO, {EX_HEADER (1, 6), 0x23,
+          AV01, 0x00, 0x00, 0x00, 0x01, 0xaa, 'v', 'p', '0', '9'}, 15},
+};
+
+/* Read by the loop so that the calls are not optimized away */
+static volatile guint sink;
+
+static gdouble
+run (const ParseHeader * header, guint64 iterations)
+{
+  Rtmp2FlvTag tag;
+  gint64 start = g_get_monotonic_time ();
+  guint64 i;
+
+  for (i = 0; i < iterations; i++) {
+    memset (&tag, 0, sizeof (tag));
+    tag.tag_type = header->tag_type;
+    rtmp2_flv_tag_parse_header (&tag, header->data, header->size);
+    sink += tag.payload_offset;
+  }
+
+  /* Nanoseconds per call */
+  return (g_get_monotonic_time () - start) * 1000.0 / iterations;
+}
+
+gint
+main (gint argc, gchar * argv[])
+{
+  guint millions = argc > 1 ? atoi (argv[1]) : 50;
+  guint64 iterations = MAX (1, (guint64) millions * 1000000);
+  guint i;
+
+  gst_init (&argc, &argv);
+
+  g_print ("%-24s %-8s %-10s\n", "header", "bytes", "ns/call");
+
+  for (i = 0; i < G_N_ELEMENTS (headers); i++) {
+    gdouble ns = run (&headers[i], iterations);
+
+    g_print ("%-24s %-8" G_GSIZE_FORMAT " %-10.2f\n", headers[i].name,
+        headers[i].size, ns);
+  }
+
+  return 0;
+}
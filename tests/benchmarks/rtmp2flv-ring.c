@@ -0,0 +1,192 @@
+/* GStreamer
+ * Copyright (C) 2025 Yaron Torbaty <yarontorbaty@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/* Producer/consumer contention on the tag hand-off between the event
+ * loop and the streaming task, with the two threads pinned to different
+ * cores: the lock-free Rtmp2FlvTagRing against the mutex protected GQueue
+ * of heap allocated tags it replaced.
+ *
+ * Usage: rtmp2flv-ring [tags] [producer-cpu] [consumer-cpu]
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <gst/gst.h>
+#include <stdlib.h>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "rtmp/rtmpflv.h"
+
+typedef struct
+{
+  Rtmp2FlvTagRing ring;
+
+  GMutex lock;
+  GQueue queue;
+} Bench;
+
+static guint n_tags;
+static gint producer_cpu, consumer_cpu;
+
+static void
+pin_to_cpu (gint cpu)
+{
+#ifdef __linux__
+  cpu_set_t set;
+
+  CPU_ZERO (&set);
+  CPU_SET (cpu, &set);
+  if (pthread_setaffinity_np (pthread_self (), sizeof (set), &set) != 0)
+    g_printerr ("could not pin thread to CPU %d\n", cpu);
+#endif
+}
+
+static void
+fill_tag (Rtmp2FlvTag * tag, guint i)
+{
+  tag->tag_type = i % 3 ? RTMP2_FLV_TAG_AUDIO : RTMP2_FLV_TAG_VIDEO;
+  tag->seqnum = i;
+  tag->timestamp = i;
+  tag->data_size = 100 + i % 1000;
+}
+
+static gpointer
+ring_producer (gpointer user_data)
+{
+  Bench *bench = user_data;
+  Rtmp2FlvTag tag = { 0, };
+  guint i;
+
+  pin_to_cpu (producer_cpu);
+  for (i = 0; i < n_tags; i++) {
+    fill_tag (&tag, i);
+    while (!rtmp2_flv_tag_ring_push (&bench->ring, &tag));
+  }
+
+  return NULL;
+}
+
+static void
+ring_consume (Bench * bench)
+{
+  Rtmp2FlvTag tag;
+  guint i;
+
+  for (i = 0; i < n_tags; i++) {
+    while (!rtmp2_flv_tag_ring_pop (&bench->ring, &tag));
+    g_assert (tag.seqnum == i);
+  }
+}
+
+static gpointer
+queue_producer (gpointer user_data)
+{
+  Bench *bench = user_data;
+  guint i;
+
+  pin_to_cpu (producer_cpu);
+  for (i = 0; i < n_tags; i++) {
+    Rtmp2FlvTag *tag = rtmp2_flv_tag_new ();
+
+    fill_tag (tag, i);
+    g_mutex_lock (&bench->lock);
+    g_queue_push_tail (&bench->queue, tag);
+    g_mutex_unlock (&bench->lock);
+  }
+
+  return NULL;
+}
+
+static void
+queue_consume (Bench * bench)
+{
+  guint i = 0;
+
+  while (i < n_tags) {
+    Rtmp2FlvTag *tag;
+
+    g_mutex_lock (&bench->lock);
+    tag = g_queue_pop_head (&bench->queue);
+    g_mutex_unlock (&bench->lock);
+
+    if (!tag)
+      continue;
+    g_assert (tag->seqnum == i);
+    rtmp2_flv_tag_free (tag);
+    i++;
+  }
+}
+
+static void
+run (const gchar * name, GThreadFunc producer, void (*consume) (Bench *),
+    Bench * bench)
+{
+  GThread *thread;
+  gint64 start;
+  gdouble elapsed;
+
+  pin_to_cpu (consumer_cpu);
+  start = g_get_monotonic_time ();
+  thread = g_thread_new ("producer", producer, bench);
+  consume (bench);
+  g_thread_join (thread);
+  elapsed = g_get_monotonic_time () - start;
+
+  g_print ("%-24s %8.2f Mtags/s %8.1f ns/tag\n", name, n_tags / elapsed,
+      elapsed * 1000.0 / n_tags);
+}
+
+gint
+main (gint argc, gchar * argv[])
+{
+  static const guint capacities[] = { 64, 1024, 16384 };
+  Bench bench = { 0, };
+  guint i;
+
+  n_tags = argc > 1 ? atoi (argv[1]) : 10000000;
+  producer_cpu = argc > 2 ? atoi (argv[2]) : 0;
+  consumer_cpu = argc > 3 ? atoi (argv[3]) : 1;
+
+  gst_init (&argc, &argv);
+
+  g_print ("%u tags, producer on CPU %d, consumer on CPU %d\n", n_tags,
+      producer_cpu, consumer_cpu);
+
+  for (i = 0; i < G_N_ELEMENTS (capacities); i++) {
+    gchar *name = g_strdup_printf ("ring capacity=%u", capacities[i]);
+
+    rtmp2_flv_tag_ring_init (&bench.ring, capacities[i]);
+    run (name, ring_producer, ring_consume, &bench);
+    rtmp2_flv_tag_ring_clear (&bench.ring);
+    g_free (name);
+  }
+
+  g_mutex_init (&bench.lock);
+  g_queue_init (&bench.queue);
+  run ("mutex + GQueue", queue_producer, queue_consume, &bench);
+  g_mutex_clear (&bench.lock);
+
+  return 0;
+}
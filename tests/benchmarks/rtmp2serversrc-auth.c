@@ -0,0 +1,201 @@
+/* GStreamer
+ * Copyright (C) 2025 Yaron Torbaty <yarontorbaty@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/* Stream key authorization throughput of rtmp2serversrc, while the key
+ * table is hot reloaded.
+ *
+ * For several key table sizes, a burst of publishers connects to a
+ * multi-stream element, half of them with a key from the table and half
+ * with an unknown one. A thread meanwhile replaces the table with a new
+ * one of the same size every 10 ms. The program reports the publishes
+ * answered per second, the connect-to-answer time of accepted and refused
+ * publishers and how long replacing the table took.
+ *
+ * Usage: rtmp2serversrc-auth [publishers]
+ */
+
+#include "rtmp2bench.h"
+
+#define BENCH_PORT 19650
+
+typedef struct
+{
+  GstElement *src;
+  gchar **keys;
+  gint stop;
+  gint64 *samples;
+  guint n_samples;
+  guint max_samples;
+} ReloadData;
+
+/* Each stream pad goes to a fakesink */
+static void
+on_pad_added (GstElement * src, GstPad * pad, gpointer user_data)
+{
+  GstElement *pipeline = user_data;
+  GstElement *sink = gst_element_factory_make ("fakesink", NULL);
+  GstPad *sinkpad;
+
+  g_object_set (sink, "sync", FALSE, "async", FALSE, NULL);
+  gst_bin_add (GST_BIN (pipeline), sink);
+  sinkpad = gst_element_get_static_pad (sink, "sink");
+  gst_pad_link (pad, sinkpad);
+  gst_object_unref (sinkpad);
+  gst_element_sync_state_with_parent (sink);
+}
+
+static gchar **
+make_keys (guint n)
+{
+  gchar **keys = g_new0 (gchar *, n + 1);
+  guint i;
+
+  for (i = 0; i < n; i++)
+    keys[i] = g_strdup_printf ("key%u", i);
+  return keys;
+}
+
+static gpointer
+reload_func (gpointer user_data)
+{
+  ReloadData *data = user_data;
+
+  while (!g_atomic_int_get (&data->stop)) {
+    gint64 start = g_get_monotonic_time ();
+
+    g_object_set (data->src, "stream-keys", data->keys, NULL);
+    if (data->n_samples < data->max_samples)
+      data->samples[data->n_samples++] = g_get_monotonic_time () - start;
+    g_usleep (10 * 1000);
+  }
+
+  return NULL;
+}
+
+/* Wait for the answer to the publish, without reporting refusals */
+static gboolean
+wait_answer (BenchPublisher * pub)
+{
+  g_mutex_lock (&pub->lock);
+  while (!pub->done)
+    g_cond_wait (&pub->cond, &pub->lock);
+  g_mutex_unlock (&pub->lock);
+
+  return pub->error == NULL;
+}
+
+static void
+run (guint port, guint n_keys, guint n_pubs)
+{
+  GstElement *pipeline;
+  BenchLoop *loop;
+  BenchPublisher **pubs;
+  ReloadData reload = { 0, };
+  GThread *thread;
+  gint64 *accepted, *refused, start, elapsed;
+  guint i, n_valid, n_accepted = 0, n_refused = 0;
+  gchar *name;
+
+  pipeline = gst_pipeline_new (NULL);
+  reload.src = gst_element_factory_make ("rtmp2serversrc", NULL);
+  reload.keys = make_keys (n_keys);
+  g_object_set (reload.src, "port", port, "multi-stream", TRUE,
+      "stream-keys", reload.keys, NULL);
+  g_signal_connect (reload.src, "pad-added", G_CALLBACK (on_pad_added),
+      pipeline);
+  gst_bin_add (GST_BIN (pipeline), reload.src);
+
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+  gst_element_get_state (pipeline, NULL, NULL, GST_CLOCK_TIME_NONE);
+
+  reload.max_samples = 10000;
+  reload.samples = g_new (gint64, reload.max_samples);
+  thread = g_thread_new ("bench-reload", reload_func, &reload);
+
+  /* Distinct keys from all over the table, a live key can't be taken
+   * twice */
+  n_valid = MIN (n_pubs / 2, n_keys);
+  loop = bench_loop_new ();
+  pubs = g_new0 (BenchPublisher *, n_pubs);
+  start = g_get_monotonic_time ();
+  for (i = 0; i < n_pubs; i++) {
+    gchar *key = i < n_valid ?
+        g_strdup_printf ("key%u", i * (n_keys / n_valid)) :
+        g_strdup_printf ("bad%u", i);
+
+    pubs[i] = bench_publisher_start (loop, port, "live", key);
+    g_free (key);
+  }
+
+  accepted = g_new (gint64, n_pubs);
+  refused = g_new (gint64, n_pubs);
+  for (i = 0; i < n_pubs; i++) {
+    gint64 time;
+    gboolean ok = wait_answer (pubs[i]);
+
+    time = pubs[i]->publish_time - pubs[i]->start_time;
+    if (ok)
+      accepted[n_accepted++] = time;
+    else
+      refused[n_refused++] = time;
+  }
+  elapsed = g_get_monotonic_time () - start;
+
+  g_atomic_int_set (&reload.stop, TRUE);
+  g_thread_join (thread);
+
+  g_print ("keys=%-8u publishers=%-6u %8.0f answers/s (expected %u "
+      "accepted)\n", n_keys, n_pubs,
+      n_pubs * (gdouble) G_USEC_PER_SEC / MAX (elapsed, 1), n_valid);
+  name = g_strdup_printf ("  accepted keys=%u", n_keys);
+  bench_report_us (name, accepted, n_accepted);
+  g_free (name);
+  name = g_strdup_printf ("  refused keys=%u", n_keys);
+  bench_report_us (name, refused, n_refused);
+  g_free (name);
+  name = g_strdup_printf ("  reload keys=%u", n_keys);
+  bench_report_us (name, reload.samples, reload.n_samples);
+  g_free (name);
+
+  for (i = 0; i < n_pubs; i++)
+    bench_publisher_free (pubs[i]);
+  g_free (pubs);
+  g_free (accepted);
+  g_free (refused);
+  bench_loop_free (loop);
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  gst_object_unref (pipeline);
+  g_strfreev (reload.keys);
+  g_free (reload.samples);
+}
+
+gint
+main (gint argc, gchar * argv[])
+{
+  static const guint table_sizes[] = { 1, 1000, 100000 };
+  guint n_pubs = argc > 1 ? atoi (argv[1]) : 200;
+  guint i;
+
+  gst_init (&argc, &argv);
+
+  for (i = 0; i < G_N_ELEMENTS (table_sizes); i++)
+    run (BENCH_PORT + i, table_sizes[i], n_pubs);
+
+  return 0;
+}
@@ -0,0 +1,156 @@
+/* GStreamer
+ * Copyright (C) 2025 Yaron Torbaty <yarontorbaty@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/* Output throughput of rtmp2serversrc at a high tag rate with and
+ * without batching.
+ *
+ * A publisher sends small messages as fast as the connection takes them.
+ * For each max-batch-tags value, the program reports the tags per second
+ * that reach a fakesink and the process CPU time per tag.
+ *
+ * Usage: rtmp2serversrc-batch [tags] [tag-size]
+ */
+
+#include "rtmp2bench.h"
+
+#include <sys/resource.h>
+
+#define BENCH_PORT 19450
+
+typedef struct
+{
+  GMutex lock;
+  GCond cond;
+  guint received;
+  guint wanted;
+  gint64 first_time;
+  gint64 last_time;
+} BatchData;
+
+static void
+on_handoff (GstElement * sink, GstBuffer * buffer, GstPad * pad,
+    gpointer user_data)
+{
+  BatchData *data = user_data;
+  gint64 now;
+
+  if (bench_flv_buffer_send_time (buffer) == 0)
+    return;
+
+  now = g_get_monotonic_time ();
+  g_mutex_lock (&data->lock);
+  if (data->received++ == 0)
+    data->first_time = now;
+  data->last_time = now;
+  if (data->received == data->wanted)
+    g_cond_signal (&data->cond);
+  g_mutex_unlock (&data->lock);
+}
+
+static gint64
+process_cpu_time_us (void)
+{
+  struct rusage usage;
+
+  getrusage (RUSAGE_SELF, &usage);
+  return (gint64) usage.ru_utime.tv_sec * G_USEC_PER_SEC +
+      usage.ru_utime.tv_usec + (gint64) usage.ru_stime.tv_sec *
+      G_USEC_PER_SEC + usage.ru_stime.tv_usec;
+}
+
+static void
+run (guint port, guint batch_tags, guint tags, gsize tag_size)
+{
+  GstElement *pipeline, *src, *sink;
+  BenchLoop *loop;
+  BenchPublisher *pub;
+  BatchData data = { 0, };
+  gint64 cpu_start, deadline;
+  gchar *name;
+  guint i;
+
+  pipeline = gst_parse_launch ("rtmp2serversrc name=src ! "
+      "fakesink name=sink sync=false signal-handoffs=true", NULL);
+  g_assert (pipeline);
+  src = gst_bin_get_by_name (GST_BIN (pipeline), "src");
+  sink = gst_bin_get_by_name (GST_BIN (pipeline), "sink");
+  g_object_set (src, "port", port, "max-batch-tags", batch_tags,
+      "max-queue-tags", 65536, NULL);
+
+  g_mutex_init (&data.lock);
+  g_cond_init (&data.cond);
+  data.wanted = tags;
+  g_signal_connect (sink, "handoff", G_CALLBACK (on_handoff), &data);
+
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+  gst_element_get_state (pipeline, NULL, NULL, GST_CLOCK_TIME_NONE);
+
+  loop = bench_loop_new ();
+  pub = bench_publisher_new (loop, port, "live", "batch");
+  if (pub->error)
+    goto done;
+
+  cpu_start = process_cpu_time_us ();
+  for (i = 0; i < tags; i++)
+    bench_publisher_send_video (pub, i, i == 0, tag_size);
+
+  deadline = g_get_monotonic_time () + 30 * G_TIME_SPAN_SECOND;
+  g_mutex_lock (&data.lock);
+  while (data.received < data.wanted)
+    if (!g_cond_wait_until (&data.cond, &data.lock, deadline))
+      break;
+  g_mutex_unlock (&data.lock);
+
+  name = g_strdup_printf ("max-batch-tags=%u", batch_tags);
+  if (data.received > 1) {
+    g_print ("%-24s tags=%-8u %10.0f tags/s %8.3f us CPU/tag\n", name,
+        data.received, (data.received - 1) * (gdouble) G_USEC_PER_SEC /
+        MAX (1, data.last_time - data.first_time),
+        (process_cpu_time_us () - cpu_start) / (gdouble) data.received);
+  } else {
+    g_print ("%-24s no tags received\n", name);
+  }
+  g_free (name);
+
+done:
+  bench_publisher_free (pub);
+  bench_loop_free (loop);
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  gst_object_unref (src);
+  gst_object_unref (sink);
+  gst_object_unref (pipeline);
+  g_mutex_clear (&data.lock);
+  g_cond_clear (&data.cond);
+}
+
+gint
+main (gint argc, gchar * argv[])
+{
+  static const guint batches[] = { 1, 8, 64, 0 };
+  guint tags = argc > 1 ? atoi (argv[1]) : 200000;
+  gsize tag_size = argc > 2 ? atoi (argv[2]) : 200;
+  guint i;
+
+  gst_init (&argc, &argv);
+
+  for (i = 0; i < G_N_ELEMENTS (batches); i++)
+    run (BENCH_PORT + i, batches[i], tags, tag_size);
+
+  return 0;
+}
@@ -0,0 +1,179 @@
+/* GStreamer
+ * Copyright (C) 2025 Yaron Torbaty <yarontorbaty@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/* Chunk reassembly cost of rtmp2serversrc for publisher chunk sizes of
+ * 128, 4096 and 65536 bytes.
+ *
+ * The publisher runs in a child process, a copy of this program, so that
+ * the CPU time of the parent only covers the element: reading, chunk
+ * reassembly, FLV framing and pushing into a fakesink. The publisher sends
+ * Set Chunk Size and then large video messages as fast as the connection
+ * takes them. The program reports the received rate and the CPU percentage
+ * spent per Mbit/s.
+ *
+ * Usage: rtmp2serversrc-chunksize [seconds] [tag-size]
+ */
+
+#include "rtmp2bench.h"
+
+#include <sys/resource.h>
+
+#define BENCH_PORT 19750
+
+typedef struct
+{
+  gint64 bytes;
+} ChunkData;
+
+static void
+on_handoff (GstElement * sink, GstBuffer * buffer, GstPad * pad,
+    gpointer user_data)
+{
+  ChunkData *data = user_data;
+
+  /* Only called from the streaming thread */
+  if (bench_flv_buffer_send_time (buffer) != 0)
+    data->bytes += gst_buffer_get_size (buffer);
+}
+
+static gint64
+process_cpu_time_us (void)
+{
+  struct rusage usage;
+
+  getrusage (RUSAGE_SELF, &usage);
+  return (gint64) usage.ru_utime.tv_sec * G_USEC_PER_SEC +
+      usage.ru_utime.tv_usec + (gint64) usage.ru_stime.tv_sec *
+      G_USEC_PER_SEC + usage.ru_stime.tv_usec;
+}
+
+/* Child process: publish with the given chunk size until the time is up */
+static gint
+publish (guint port, guint chunk_size, guint seconds, gsize tag_size)
+{
+  BenchLoop *loop = bench_loop_new ();
+  BenchPublisher *pub = bench_publisher_new (loop, port, "live", "chunks");
+  GstRtmpProtocolControl pc = {
+    .type = GST_RTMP_MESSAGE_TYPE_SET_CHUNK_SIZE,
+    .param = chunk_size,
+  };
+  gint64 end_time;
+  guint32 timestamp = 0;
+
+  if (pub->error)
+    return 1;
+
+  /* The connection applies it to the messages queued after it */
+  gst_rtmp_connection_queue_message (pub->connection,
+      gst_rtmp_message_new_protocol_control (&pc));
+
+  end_time = g_get_monotonic_time () + seconds * G_TIME_SPAN_SECOND;
+  while (g_get_monotonic_time () < end_time) {
+    bench_publisher_send_video (pub, timestamp, timestamp % 60 == 0,
+        tag_size);
+    timestamp += 33;
+  }
+
+  bench_publisher_free (pub);
+  bench_loop_free (loop);
+  return 0;
+}
+
+static void
+run (const gchar * program, guint port, guint chunk_size, guint seconds,
+    gsize tag_size)
+{
+  GstElement *pipeline, *src, *sink;
+  ChunkData data = { 0, };
+  GError *error = NULL;
+  gchar *argv[7];
+  gint64 cpu_start, start;
+  gdouble elapsed, cpu, mbps;
+  gint status;
+
+  pipeline = gst_pipeline_new (NULL);
+  src = gst_element_factory_make ("rtmp2serversrc", NULL);
+  sink = gst_element_factory_make ("fakesink", NULL);
+  g_object_set (src, "port", port, NULL);
+  g_object_set (sink, "sync", FALSE, "signal-handoffs", TRUE, NULL);
+  g_signal_connect (sink, "handoff", G_CALLBACK (on_handoff), &data);
+  gst_bin_add_many (GST_BIN (pipeline), src, sink, NULL);
+  gst_element_link (src, sink);
+
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+  gst_element_get_state (pipeline, NULL, NULL, GST_CLOCK_TIME_NONE);
+
+  argv[0] = (gchar *) program;
+  argv[1] = (gchar *) "--publish";
+  argv[2] = g_strdup_printf ("%u", port);
+  argv[3] = g_strdup_printf ("%u", chunk_size);
+  argv[4] = g_strdup_printf ("%u", seconds);
+  argv[5] = g_strdup_printf ("%" G_GSIZE_FORMAT, tag_size);
+  argv[6] = NULL;
+
+  cpu_start = process_cpu_time_us ();
+  start = g_get_monotonic_time ();
+  if (!g_spawn_sync (NULL, argv, NULL, G_SPAWN_SEARCH_PATH |
+          G_SPAWN_CHILD_INHERITS_STDIN, NULL, NULL, NULL, NULL, &status,
+          &error) || !g_spawn_check_wait_status (status, &error)) {
+    g_printerr ("publisher failed: %s\n", error->message);
+    g_clear_error (&error);
+    goto done;
+  }
+
+  /* Let the queued messages arrive */
+  g_usleep (G_USEC_PER_SEC / 2);
+  elapsed = (g_get_monotonic_time () - start) / (gdouble) G_USEC_PER_SEC;
+  cpu = (process_cpu_time_us () - cpu_start) / (gdouble) G_USEC_PER_SEC;
+  mbps = data.bytes * 8 / elapsed / 1e6;
+
+  g_print ("chunk-size=%-6u %10.1f Mbit/s %6.1f %% CPU %8.4f %% CPU per "
+      "Mbit/s\n", chunk_size, mbps, cpu * 100 / elapsed,
+      cpu * 100 / elapsed / MAX (mbps, 0.001));
+
+done:
+  g_free (argv[2]);
+  g_free (argv[3]);
+  g_free (argv[4]);
+  g_free (argv[5]);
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  gst_object_unref (pipeline);
+}
+
+gint
+main (gint argc, gchar * argv[])
+{
+  static const guint chunk_sizes[] = { 128, 4096, 65536 };
+  guint seconds, i;
+  gsize tag_size;
+
+  gst_init (&argc, &argv);
+
+  if (argc == 6 && g_str_equal (argv[1], "--publish"))
+    return publish (atoi (argv[2]), atoi (argv[3]), atoi (argv[4]),
+        atoi (argv[5]));
+
+  seconds = argc > 1 ? atoi (argv[1]) : 5;
+  tag_size = argc > 2 ? atoi (argv[2]) : 100000;
+
+  for (i = 0; i < G_N_ELEMENTS (chunk_sizes); i++)
+    run (argv[0], BENCH_PORT + i, chunk_sizes[i], seconds, tag_size);
+
+  return 0;
+}
@@ -0,0 +1,112 @@
+/* GStreamer
+ * Copyright (C) 2025 Yaron Torbaty <yarontorbaty@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/* Connect storm against a multi-stream rtmp2serversrc.
+ *
+ * A burst of publishers, 1000 by default, connects at once, each with its
+ * own stream key, spread over a few client threads. Each one goes through
+ * the handshake, connect, releaseStream, FCPublish, createStream and
+ * publish. The program reports the time from the connect call to
+ * NetStream.Publish.Start and how many publishers started per second.
+ *
+ * Usage: rtmp2serversrc-connect [publishers] [io-threads]
+ */
+
+#include "rtmp2bench.h"
+
+#define BENCH_PORT 19850
+
+/* Client threads, each with its own loop */
+#define BENCH_CLIENTS 4
+
+/* Each stream pad goes to a fakesink */
+static void
+on_pad_added (GstElement * src, GstPad * pad, gpointer user_data)
+{
+  GstElement *pipeline = user_data;
+  GstElement *sink = gst_element_factory_make ("fakesink", NULL);
+  GstPad *sinkpad;
+
+  g_object_set (sink, "sync", FALSE, "async", FALSE, NULL);
+  gst_bin_add (GST_BIN (pipeline), sink);
+  sinkpad = gst_element_get_static_pad (sink, "sink");
+  gst_pad_link (pad, sinkpad);
+  gst_object_unref (sinkpad);
+  gst_element_sync_state_with_parent (sink);
+}
+
+gint
+main (gint argc, gchar * argv[])
+{
+  guint n_pubs = argc > 1 ? atoi (argv[1]) : 1000;
+  guint io_threads = argc > 2 ? atoi (argv[2]) : 1;
+  GstElement *pipeline, *src;
+  BenchLoop *loops[BENCH_CLIENTS];
+  BenchPublisher **pubs;
+  gint64 *samples, start, elapsed;
+  guint i, n_samples = 0;
+
+  gst_init (&argc, &argv);
+
+  pipeline = gst_pipeline_new (NULL);
+  src = gst_element_factory_make ("rtmp2serversrc", NULL);
+  g_object_set (src, "port", BENCH_PORT, "multi-stream", TRUE,
+      "io-threads", io_threads, NULL);
+  g_signal_connect (src, "pad-added", G_CALLBACK (on_pad_added), pipeline);
+  gst_bin_add (GST_BIN (pipeline), src);
+
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+  gst_element_get_state (pipeline, NULL, NULL, GST_CLOCK_TIME_NONE);
+
+  for (i = 0; i < BENCH_CLIENTS; i++)
+    loops[i] = bench_loop_new ();
+
+  pubs = g_new0 (BenchPublisher *, n_pubs);
+  start = g_get_monotonic_time ();
+  for (i = 0; i < n_pubs; i++) {
+    gchar *key = g_strdup_printf ("stream%u", i);
+
+    pubs[i] = bench_publisher_start (loops[i % BENCH_CLIENTS], BENCH_PORT,
+        "live", key);
+    g_free (key);
+  }
+
+  samples = g_new (gint64, n_pubs);
+  for (i = 0; i < n_pubs; i++) {
+    if (bench_publisher_wait (pubs[i]))
+      samples[n_samples++] = pubs[i]->publish_time - pubs[i]->start_time;
+  }
+  elapsed = g_get_monotonic_time () - start;
+
+  g_print ("publishers=%-6u io-threads=%-3u %8.0f publishes/s, %u failed\n",
+      n_pubs, io_threads, n_samples * (gdouble) G_USEC_PER_SEC /
+      MAX (elapsed, 1), n_pubs - n_samples);
+  bench_report_us ("  connect to Publish.Start", samples, n_samples);
+
+  for (i = 0; i < n_pubs; i++)
+    bench_publisher_free (pubs[i]);
+  g_free (pubs);
+  g_free (samples);
+  for (i = 0; i < BENCH_CLIENTS; i++)
+    bench_loop_free (loops[i]);
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  gst_object_unref (pipeline);
+
+  return 0;
+}
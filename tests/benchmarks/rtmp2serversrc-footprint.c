@@ -0,0 +1,308 @@
+/* GStreamer
+ * Copyright (C) 2025 Yaron Torbaty <yarontorbaty@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/* Memory per connection of a multi-stream rtmp2serversrc with 10000
+ * connections, idle, handshaking and publishing.
+ *
+ * The connections come from a child process, a copy of this program, so
+ * that the memory of the parent only covers the element. Idle connections
+ * are TCP connections that send nothing, handshaking ones send C0 and C1
+ * and never answer, publishing ones go up to NetStream.Publish.Start and
+ * send no media. Each kind runs against a new element on its own port.
+ * Once the element has taken all connections, the program reports the
+ * growth of the heap in use and of the resident set divided by the number
+ * of connections. The fakesink linked to each stream pad counts towards
+ * the publishing figure.
+ *
+ * Usage: rtmp2serversrc-footprint [connections]
+ */
+
+#include "rtmp2bench.h"
+
+#include <stdio.h>
+#include <unistd.h>
+#include <malloc.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#define BENCH_PORT 19950
+
+/* Client threads of the publishing child, each with its own loop */
+#define BENCH_CLIENTS 4
+
+/* C0 and C1 of the RTMP handshake */
+#define BENCH_HANDSHAKE_SIZE (1 + 1536)
+
+typedef enum
+{
+  BENCH_IDLE,
+  BENCH_HANDSHAKING,
+  BENCH_PUBLISHING,
+} BenchState;
+
+static const gchar *const state_names[] = {
+  "idle", "handshaking", "publishing"
+};
+
+/* Every connection is a descriptor on both ends */
+static void
+raise_fd_limit (void)
+{
+  struct rlimit limit;
+
+  if (getrlimit (RLIMIT_NOFILE, &limit) == 0 &&
+      limit.rlim_cur < limit.rlim_max) {
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit (RLIMIT_NOFILE, &limit);
+  }
+}
+
+static gint64
+process_rss_bytes (void)
+{
+  gint64 size = 0, resident = 0;
+  FILE *f = fopen ("/proc/self/statm", "r");
+
+  if (!f)
+    return 0;
+  if (fscanf (f, "%" G_GINT64_FORMAT " %" G_GINT64_FORMAT, &size,
+          &resident) != 2)
+    resident = 0;
+  fclose (f);
+  return resident * sysconf (_SC_PAGESIZE);
+}
+
+static gint64
+process_heap_bytes (void)
+{
+#if defined (__GLIBC__) && __GLIBC_PREREQ (2, 33)
+  struct mallinfo2 info = mallinfo2 ();
+
+  return info.uordblks + info.hblkhd;
+#else
+  return 0;
+#endif
+}
+
+static GSocket *
+connect_raw (guint port)
+{
+  GInetAddress *inet = g_inet_address_new_loopback (G_SOCKET_FAMILY_IPV4);
+  GSocketAddress *address = g_inet_socket_address_new (inet, port);
+  GSocket *socket;
+  GError *error = NULL;
+
+  socket = g_socket_new (G_SOCKET_FAMILY_IPV4, G_SOCKET_TYPE_STREAM,
+      G_SOCKET_PROTOCOL_TCP, &error);
+  if (socket && !g_socket_connect (socket, address, NULL, &error))
+    g_clear_object (&socket);
+  if (!socket) {
+    g_printerr ("connect failed: %s\n", error->message);
+    g_clear_error (&error);
+  }
+
+  g_object_unref (address);
+  g_object_unref (inet);
+  return socket;
+}
+
+/* Child process: open the connections, say so on stdout and hold them
+ * until stdin closes */
+static gint
+hold (guint port, BenchState state, guint n)
+{
+  BenchLoop *loops[BENCH_CLIENTS] = { NULL, };
+  BenchPublisher **pubs = NULL;
+  GSocket **sockets = NULL;
+  guint8 handshake[BENCH_HANDSHAKE_SIZE] = { 3, };
+  gchar byte;
+  guint i;
+
+  if (state == BENCH_PUBLISHING) {
+    for (i = 0; i < BENCH_CLIENTS; i++)
+      loops[i] = bench_loop_new ();
+
+    pubs = g_new0 (BenchPublisher *, n);
+    for (i = 0; i < n; i++) {
+      gchar *key = g_strdup_printf ("stream%u", i);
+
+      pubs[i] = bench_publisher_start (loops[i % BENCH_CLIENTS], port,
+          "live", key);
+      g_free (key);
+    }
+    for (i = 0; i < n; i++)
+      bench_publisher_wait (pubs[i]);
+  } else {
+    sockets = g_new0 (GSocket *, n);
+    for (i = 0; i < n; i++) {
+      sockets[i] = connect_raw (port);
+      if (sockets[i] && state == BENCH_HANDSHAKING)
+        g_socket_send (sockets[i], (const gchar *) handshake,
+            sizeof (handshake), NULL, NULL);
+    }
+  }
+
+  g_print ("ready\n");
+  fflush (stdout);
+  while (read (STDIN_FILENO, &byte, 1) > 0);
+
+  for (i = 0; i < n; i++) {
+    if (pubs)
+      bench_publisher_free (pubs[i]);
+    else if (sockets[i])
+      g_object_unref (sockets[i]);
+  }
+  g_free (pubs);
+  g_free (sockets);
+  for (i = 0; i < BENCH_CLIENTS; i++) {
+    if (loops[i])
+      bench_loop_free (loops[i]);
+  }
+  return 0;
+}
+
+/* Each stream pad goes to a fakesink */
+static void
+on_pad_added (GstElement * src, GstPad * pad, gpointer user_data)
+{
+  GstElement *pipeline = user_data;
+  GstElement *sink = gst_element_factory_make ("fakesink", NULL);
+  GstPad *sinkpad;
+
+  g_object_set (sink, "sync", FALSE, "async", FALSE, NULL);
+  gst_bin_add (GST_BIN (pipeline), sink);
+  sinkpad = gst_element_get_static_pad (sink, "sink");
+  gst_pad_link (pad, sinkpad);
+  gst_object_unref (sinkpad);
+  gst_element_sync_state_with_parent (sink);
+}
+
+/* Wait up to a minute for the element to hold n sessions, or n streams
+ * when publishing */
+static gboolean
+wait_settled (GstElement * src, BenchState state, guint n)
+{
+  const gchar *field = state == BENCH_PUBLISHING ? "streams" : "sessions";
+  gint64 end_time = g_get_monotonic_time () + 60 * G_TIME_SPAN_SECOND;
+  guint count = 0;
+
+  while (g_get_monotonic_time () < end_time) {
+    GstStructure *stats;
+
+    g_object_get (src, "stats", &stats, NULL);
+    gst_structure_get_uint (stats, field, &count);
+    gst_structure_free (stats);
+    if (count >= n)
+      break;
+    g_usleep (G_USEC_PER_SEC / 10);
+  }
+
+  if (count < n) {
+    g_printerr ("%s: only %u of %u %s\n", state_names[state], count, n,
+        field);
+    return FALSE;
+  }
+
+  /* Let the last reads and handshake replies finish */
+  g_usleep (G_USEC_PER_SEC);
+  return TRUE;
+}
+
+static void
+run (const gchar * program, guint port, BenchState state, guint n)
+{
+  GstElement *pipeline, *src;
+  GError *error = NULL;
+  gchar *argv[6];
+  gchar line[16];
+  gint64 heap_start, rss_start;
+  GPid pid;
+  gint in_fd, out_fd, status;
+  FILE *out;
+
+  pipeline = gst_pipeline_new (NULL);
+  src = gst_element_factory_make ("rtmp2serversrc", NULL);
+  g_object_set (src, "port", port, "multi-stream", TRUE,
+      "handshake-timeout", 0, "publish-timeout", 0, "timeout", 3600, NULL);
+  g_signal_connect (src, "pad-added", G_CALLBACK (on_pad_added), pipeline);
+  gst_bin_add (GST_BIN (pipeline), src);
+
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+  gst_element_get_state (pipeline, NULL, NULL, GST_CLOCK_TIME_NONE);
+
+  argv[0] = (gchar *) program;
+  argv[1] = (gchar *) "--hold";
+  argv[2] = g_strdup_printf ("%u", port);
+  argv[3] = g_strdup_printf ("%u", state);
+  argv[4] = g_strdup_printf ("%u", n);
+  argv[5] = NULL;
+
+  heap_start = process_heap_bytes ();
+  rss_start = process_rss_bytes ();
+
+  if (!g_spawn_async_with_pipes (NULL, argv, NULL, G_SPAWN_SEARCH_PATH |
+          G_SPAWN_DO_NOT_REAP_CHILD, NULL, NULL, &pid, &in_fd, &out_fd, NULL,
+          &error)) {
+    g_printerr ("client failed: %s\n", error->message);
+    g_clear_error (&error);
+    goto done;
+  }
+
+  out = fdopen (out_fd, "r");
+  if (fgets (line, sizeof (line), out) && wait_settled (src, state, n)) {
+    gint64 heap = process_heap_bytes () - heap_start;
+    gint64 rss = process_rss_bytes () - rss_start;
+
+    g_print ("%-12s connections=%-6u %8" G_GINT64_FORMAT " heap bytes "
+        "%8" G_GINT64_FORMAT " RSS bytes per connection\n",
+        state_names[state], n, heap / n, rss / n);
+  }
+
+  close (in_fd);
+  fclose (out);
+  waitpid (pid, &status, 0);
+  g_spawn_close_pid (pid);
+
+done:
+  g_free (argv[2]);
+  g_free (argv[3]);
+  g_free (argv[4]);
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  gst_object_unref (pipeline);
+}
+
+gint
+main (gint argc, gchar * argv[])
+{
+  BenchState state;
+  guint n;
+
+  gst_init (&argc, &argv);
+  raise_fd_limit ();
+
+  if (argc == 5 && g_str_equal (argv[1], "--hold"))
+    return hold (atoi (argv[2]), atoi (argv[3]), atoi (argv[4]));
+
+  n = argc > 1 ? MAX (atoi (argv[1]), 1) : 10000;
+
+  for (state = BENCH_IDLE; state <= BENCH_PUBLISHING; state++)
+    run (argv[0], BENCH_PORT + state, state, n);
+
+  return 0;
+}
@@ -0,0 +1,205 @@
+/* GStreamer
+ * Copyright (C) 2025 Yaron Torbaty <yarontorbaty@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/* Ingest throughput of a multi-stream rtmp2serversrc as io-threads
+ * scales.
+ *
+ * Many publishers send small video messages as fast as their connections
+ * take them, spread over a few client threads. For each io-threads value,
+ * the program reports the tags per second that reach the fakesinks of all
+ * stream pads, and the process CPU time per tag.
+ *
+ * Usage: rtmp2serversrc-iothreads [publishers] [seconds] [tag-size]
+ */
+
+#include "rtmp2bench.h"
+
+#include <sys/resource.h>
+
+#define BENCH_PORT 19550
+
+/* Client threads, each with its own loop and sender */
+#define BENCH_CLIENTS 4
+
+typedef struct
+{
+  GstElement *pipeline;
+  gint received;
+} IoData;
+
+typedef struct
+{
+  BenchPublisher **pubs;
+  guint n_pubs;
+  gsize tag_size;
+  gint64 end_time;
+  GThread *thread;
+} IoSender;
+
+static void
+on_handoff (GstElement * sink, GstBuffer * buffer, GstPad * pad,
+    gpointer user_data)
+{
+  IoData *data = user_data;
+
+  if (bench_flv_buffer_send_time (buffer) != 0)
+    g_atomic_int_inc (&data->received);
+}
+
+/* A fakesink for each new stream pad */
+static void
+on_pad_added (GstElement * src, GstPad * pad, gpointer user_data)
+{
+  IoData *data = user_data;
+  GstElement *sink = gst_element_factory_make ("fakesink", NULL);
+  GstPad *sinkpad;
+
+  g_object_set (sink, "sync", FALSE, "async", FALSE, "signal-handoffs", TRUE,
+      NULL);
+  g_signal_connect (sink, "handoff", G_CALLBACK (on_handoff), data);
+  gst_bin_add (GST_BIN (data->pipeline), sink);
+  sinkpad = gst_element_get_static_pad (sink, "sink");
+  gst_pad_link (pad, sinkpad);
+  gst_object_unref (sinkpad);
+  gst_element_sync_state_with_parent (sink);
+}
+
+static gpointer
+sender_func (gpointer user_data)
+{
+  IoSender *sender = user_data;
+  guint32 timestamp = 0;
+
+  /* Round-robin over the publishers of this client thread */
+  while (g_get_monotonic_time () < sender->end_time) {
+    guint i;
+
+    for (i = 0; i < sender->n_pubs; i++)
+      bench_publisher_send_video (sender->pubs[i], timestamp, timestamp == 0,
+          sender->tag_size);
+    timestamp++;
+  }
+
+  return NULL;
+}
+
+static gint64
+process_cpu_time_us (void)
+{
+  struct rusage usage;
+
+  getrusage (RUSAGE_SELF, &usage);
+  return (gint64) usage.ru_utime.tv_sec * G_USEC_PER_SEC +
+      usage.ru_utime.tv_usec + (gint64) usage.ru_stime.tv_sec *
+      G_USEC_PER_SEC + usage.ru_stime.tv_usec;
+}
+
+static void
+run (guint port, guint io_threads, guint n_pubs, guint seconds,
+    gsize tag_size)
+{
+  GstElement *src;
+  BenchLoop *loops[BENCH_CLIENTS];
+  IoSender senders[BENCH_CLIENTS] = { {0,}, };
+  BenchPublisher **pubs;
+  IoData data = { 0, };
+  gint64 cpu_start, start;
+  gdouble elapsed;
+  guint i, received;
+
+  data.pipeline = gst_pipeline_new (NULL);
+  src = gst_element_factory_make ("rtmp2serversrc", NULL);
+  g_object_set (src, "port", port, "io-threads", io_threads,
+      "multi-stream", TRUE, NULL);
+  g_signal_connect (src, "pad-added", G_CALLBACK (on_pad_added), &data);
+  gst_bin_add (GST_BIN (data.pipeline), src);
+
+  gst_element_set_state (data.pipeline, GST_STATE_PLAYING);
+  gst_element_get_state (data.pipeline, NULL, NULL, GST_CLOCK_TIME_NONE);
+
+  for (i = 0; i < BENCH_CLIENTS; i++)
+    loops[i] = bench_loop_new ();
+
+  /* Connect all of them first, then start sending */
+  pubs = g_new0 (BenchPublisher *, n_pubs);
+  for (i = 0; i < n_pubs; i++) {
+    gchar *key = g_strdup_printf ("stream%u", i);
+
+    pubs[i] = bench_publisher_start (loops[i % BENCH_CLIENTS], port, "live",
+        key);
+    g_free (key);
+  }
+  for (i = 0; i < n_pubs; i++) {
+    if (!bench_publisher_wait (pubs[i]))
+      goto done;
+  }
+
+  cpu_start = process_cpu_time_us ();
+  start = g_get_monotonic_time ();
+  for (i = 0; i < BENCH_CLIENTS; i++) {
+    IoSender *sender = &senders[i];
+    guint j;
+
+    sender->pubs = g_new (BenchPublisher *, n_pubs / BENCH_CLIENTS + 1);
+    for (j = i; j < n_pubs; j += BENCH_CLIENTS)
+      sender->pubs[sender->n_pubs++] = pubs[j];
+    sender->tag_size = tag_size;
+    sender->end_time = start + seconds * G_TIME_SPAN_SECOND;
+    sender->thread = g_thread_new ("bench-sender", sender_func, sender);
+  }
+  for (i = 0; i < BENCH_CLIENTS; i++) {
+    g_thread_join (senders[i].thread);
+    g_free (senders[i].pubs);
+  }
+
+  /* Let the queued messages arrive */
+  g_usleep (G_USEC_PER_SEC / 2);
+  received = g_atomic_int_get (&data.received);
+  elapsed = (g_get_monotonic_time () - start) / (gdouble) G_USEC_PER_SEC;
+
+  g_print ("io-threads=%-4u publishers=%-5u %10.0f tags/s %8.3f us CPU/tag\n",
+      io_threads, n_pubs, received / elapsed,
+      (process_cpu_time_us () - cpu_start) / (gdouble) MAX (received, 1));
+
+done:
+  for (i = 0; i < n_pubs; i++)
+    bench_publisher_free (pubs[i]);
+  g_free (pubs);
+  for (i = 0; i < BENCH_CLIENTS; i++)
+    bench_loop_free (loops[i]);
+  gst_element_set_state (data.pipeline, GST_STATE_NULL);
+  gst_object_unref (data.pipeline);
+}
+
+gint
+main (gint argc, gchar * argv[])
+{
+  guint n_pubs = argc > 1 ? atoi (argv[1]) : 64;
+  guint seconds = argc > 2 ? atoi (argv[2]) : 5;
+  gsize tag_size = argc > 3 ? atoi (argv[3]) : 1024;
+  guint io_threads, max_threads = MAX (g_get_num_processors (), 1);
+  guint port = BENCH_PORT;
+
+  gst_init (&argc, &argv);
+
+  for (io_threads = 1; io_threads <= max_threads; io_threads *= 2)
+    run (port++, io_threads, n_pubs, seconds, tag_size);
+
+  return 0;
+}
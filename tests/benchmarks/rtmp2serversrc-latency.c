@@ -0,0 +1,175 @@
+/* GStreamer
+ * Copyright (C) 2025 Yaron Torbaty <yarontorbaty@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/* Ingest-to-push delay of rtmp2serversrc, and the CPU time its idle
+ * streaming tasks burn.
+ *
+ * One publisher sends video messages at a fixed interval. A fakesink
+ * handoff reads the send time stamped into each payload and records how
+ * long the message took from the client's queue to the element's pad
+ * push. Then a number of elements sit idle in PLAYING with no publisher
+ * and the process CPU time over that period is reported.
+ *
+ * Usage: rtmp2serversrc-latency [messages] [interval-ms] [idle-elements]
+ */
+
+#include "rtmp2bench.h"
+
+#include <sys/resource.h>
+
+#define BENCH_PORT 19350
+
+typedef struct
+{
+  GMutex lock;
+  GCond cond;
+  gint64 *samples;
+  guint n_samples;
+  guint wanted;
+} LatencyData;
+
+static void
+on_handoff (GstElement * sink, GstBuffer * buffer, GstPad * pad,
+    gpointer user_data)
+{
+  LatencyData *data = user_data;
+  gint64 now = g_get_monotonic_time ();
+  gint64 sent = bench_flv_buffer_send_time (buffer);
+
+  if (sent == 0)
+    return;
+
+  g_mutex_lock (&data->lock);
+  if (data->n_samples < data->wanted)
+    data->samples[data->n_samples++] = now - sent;
+  g_cond_signal (&data->cond);
+  g_mutex_unlock (&data->lock);
+}
+
+static void
+run_latency (guint messages, guint interval_ms)
+{
+  GstElement *pipeline, *sink;
+  BenchLoop *loop;
+  BenchPublisher *pub;
+  LatencyData data = { 0, };
+  gint64 deadline;
+  guint i;
+
+  pipeline = gst_parse_launch ("rtmp2serversrc name=src port="
+      G_STRINGIFY (BENCH_PORT) " ! fakesink name=sink sync=false "
+      "signal-handoffs=true", NULL);
+  g_assert (pipeline);
+  sink = gst_bin_get_by_name (GST_BIN (pipeline), "sink");
+
+  g_mutex_init (&data.lock);
+  g_cond_init (&data.cond);
+  data.samples = g_new (gint64, messages);
+  data.wanted = messages;
+  g_signal_connect (sink, "handoff", G_CALLBACK (on_handoff), &data);
+
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+  gst_element_get_state (pipeline, NULL, NULL, GST_CLOCK_TIME_NONE);
+
+  loop = bench_loop_new ();
+  pub = bench_publisher_new (loop, BENCH_PORT, "live", "latency");
+  if (pub->error)
+    goto done;
+
+  for (i = 0; i < messages; i++) {
+    bench_publisher_send_video (pub, i * interval_ms, i % 30 == 0, 4096);
+    g_usleep (interval_ms * 1000);
+  }
+
+  deadline = g_get_monotonic_time () + 5 * G_TIME_SPAN_SECOND;
+  g_mutex_lock (&data.lock);
+  while (data.n_samples < data.wanted)
+    if (!g_cond_wait_until (&data.cond, &data.lock, deadline))
+      break;
+  g_mutex_unlock (&data.lock);
+
+  bench_report_us ("ingest-to-push", data.samples, data.n_samples);
+
+done:
+  bench_publisher_free (pub);
+  bench_loop_free (loop);
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  gst_object_unref (sink);
+  gst_object_unref (pipeline);
+  g_free (data.samples);
+  g_mutex_clear (&data.lock);
+  g_cond_clear (&data.cond);
+}
+
+static gint64
+process_cpu_time_us (void)
+{
+  struct rusage usage;
+
+  getrusage (RUSAGE_SELF, &usage);
+  return (gint64) usage.ru_utime.tv_sec * G_USEC_PER_SEC +
+      usage.ru_utime.tv_usec + (gint64) usage.ru_stime.tv_sec *
+      G_USEC_PER_SEC + usage.ru_stime.tv_usec;
+}
+
+static void
+run_idle (guint n_elements)
+{
+  GstElement *pipeline = gst_pipeline_new (NULL);
+  gint64 cpu_start, cpu_end;
+  guint i;
+
+  for (i = 0; i < n_elements; i++) {
+    GstElement *src = gst_element_factory_make ("rtmp2serversrc", NULL);
+    GstElement *sink = gst_element_factory_make ("fakesink", NULL);
+
+    g_object_set (src, "port", BENCH_PORT + 1 + i, NULL);
+    g_object_set (sink, "sync", FALSE, NULL);
+    gst_bin_add_many (GST_BIN (pipeline), src, sink, NULL);
+    gst_element_link (src, sink);
+  }
+
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+  gst_element_get_state (pipeline, NULL, NULL, GST_CLOCK_TIME_NONE);
+
+  cpu_start = process_cpu_time_us ();
+  g_usleep (5 * G_USEC_PER_SEC);
+  cpu_end = process_cpu_time_us ();
+
+  g_print ("%-32s elements=%u cpu=%" G_GINT64_FORMAT " us over 5 s\n",
+      "idle", n_elements, cpu_end - cpu_start);
+
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  gst_object_unref (pipeline);
+}
+
+gint
+main (gint argc, gchar * argv[])
+{
+  guint messages = argc > 1 ? atoi (argv[1]) : 1000;
+  guint interval_ms = argc > 2 ? atoi (argv[2]) : 10;
+  guint idle_elements = argc > 3 ? atoi (argv[3]) : 100;
+
+  gst_init (&argc, &argv);
+
+  run_latency (messages, interval_ms);
+  run_idle (idle_elements);
+
+  return 0;
+}
@@ -0,0 +1,654 @@
+/* GStreamer
+ * Copyright (C) 2025 Yaron Torbaty <yarontorbaty@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gst/check/gstcheck.h>
+#include <string.h>
+
+#include "rtmp/rtmpflv.h"
+
+/* Tag body of size bytes, each byte its offset modulo 251 */
+static GstBuffer *
+make_body (gsize size)
+{
+  GstBuffer *buffer = gst_buffer_new_allocate (NULL, size, NULL);
+  GstMapInfo map;
+  gsize i;
+
+  gst_buffer_map (buffer, &map, GST_MAP_WRITE);
+  for (i = 0; i < size; i++)
+    map.data[i] = i % 251;
+  gst_buffer_unmap (buffer, &map);
+
+  return buffer;
+}
+
+static void
+check_framing (GstBuffer * out, guint8 tag_type, gsize body_size,
+    guint32 timestamp)
+{
+  guint8 header[RTMP2_FLV_TAG_HEADER_SIZE];
+  guint8 trailer[4];
+  gsize size = gst_buffer_get_size (out);
+
+  fail_unless_equals_int (size, RTMP2_FLV_TAG_HEADER_SIZE + body_size + 4);
+
+  gst_buffer_extract (out, 0, header, sizeof (header));
+  fail_unless_equals_int (header[0], tag_type);
+  fail_unless_equals_int (GST_READ_UINT24_BE (header + 1), body_size);
+  fail_unless_equals_int (GST_READ_UINT24_BE (header + 4),
+      timestamp & 0xffffff);
+  fail_unless_equals_int (header[7], timestamp >> 24);
+  fail_unless_equals_int (GST_READ_UINT24_BE (header + 8), 0);
+
+  gst_buffer_extract (out, size - 4, trailer, sizeof (trailer));
+  fail_unless_equals_int (GST_READ_UINT32_BE (trailer),
+      RTMP2_FLV_TAG_HEADER_SIZE + body_size);
+}
+
+GST_START_TEST (test_tag_to_buffer)
+{
+  Rtmp2FlvTag tag = { 0, };
+  GstBuffer *out, *body;
+  GstMapInfo map;
+  gsize i;
+
+  tag.tag_type = RTMP2_FLV_TAG_VIDEO;
+  tag.timestamp = 0x12345678;
+  tag.data = make_body (1000);
+  tag.data_size = 1000;
+
+  out = rtmp2_flv_tag_to_buffer (&tag);
+  check_framing (out, RTMP2_FLV_TAG_VIDEO, 1000, 0x12345678);
+
+  /* Header, the body shared by reference, trailer */
+  fail_unless_equals_int (gst_buffer_n_memory (out), 3);
+  fail_unless (gst_buffer_peek_memory (out, 1) ==
+      gst_buffer_peek_memory (tag.data, 0));
+
+  body = gst_buffer_copy_region (out, GST_BUFFER_COPY_MEMORY,
+      RTMP2_FLV_TAG_HEADER_SIZE, 1000);
+  gst_buffer_map (body, &map, GST_MAP_READ);
+  for (i = 0; i < map.size; i++)
+    fail_unless_equals_int (map.data[i], i % 251);
+  gst_buffer_unmap (body, &map);
+  gst_buffer_unref (body);
+
+  gst_buffer_unref (out);
+  rtmp2_flv_tag_clear (&tag);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_tag_to_buffer_many_memories)
+{
+  Rtmp2FlvTag tag = { 0, };
+  GstBuffer *out;
+  guint8 data[300];
+  gsize i;
+
+  /* Aggregate sub-messages and reassembled chunks may span memories */
+  tag.tag_type = RTMP2_FLV_TAG_AUDIO;
+  tag.timestamp = 40;
+  tag.data = make_body (100);
+  tag.data = gst_buffer_append (tag.data, make_body (200));
+  tag.data_size = 300;
+
+  out = rtmp2_flv_tag_to_buffer (&tag);
+  check_framing (out, RTMP2_FLV_TAG_AUDIO, 300, 40);
+  fail_unless_equals_int (gst_buffer_n_memory (out), 4);
+
+  gst_buffer_extract (out, RTMP2_FLV_TAG_HEADER_SIZE, data, sizeof (data));
+  for (i = 0; i < 100; i++)
+    fail_unless_equals_int (data[i], i % 251);
+  for (i = 0; i < 200; i++)
+    fail_unless_equals_int (data[100 + i], i % 251);
+
+  gst_buffer_unref (out);
+  rtmp2_flv_tag_clear (&tag);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_tag_to_buffer_empty)
+{
+  Rtmp2FlvTag tag = { 0, };
+  GstBuffer *out;
+
+  tag.tag_type = RTMP2_FLV_TAG_SCRIPT;
+  tag.data = gst_buffer_new ();
+
+  out = rtmp2_flv_tag_to_buffer (&tag);
+  check_framing (out, RTMP2_FLV_TAG_SCRIPT, 0, 0);
+  fail_unless_equals_int (gst_buffer_n_memory (out), 2);
+
+  gst_buffer_unref (out);
+  rtmp2_flv_tag_clear (&tag);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_tag_to_buffer_keeps_body)
+{
+  Rtmp2FlvTag tag = { 0, };
+  GstBuffer *out;
+  GstMemory *mem;
+
+  tag.tag_type = RTMP2_FLV_TAG_VIDEO;
+  tag.data = make_body (64);
+  mem = gst_buffer_peek_memory (tag.data, 0);
+
+  /* The output holds the body memory after the tag lets go of it */
+  out = rtmp2_flv_tag_to_buffer (&tag);
+  rtmp2_flv_tag_clear (&tag);
+  fail_unless (gst_buffer_peek_memory (out, 1) == mem);
+  check_framing (out, RTMP2_FLV_TAG_VIDEO, 64, 0);
+
+  gst_buffer_unref (out);
+}
+
+GST_END_TEST;
+
+static void
+push_tag (Rtmp2FlvTagRing * ring, guint32 seqnum, guint32 data_size,
+    gboolean expect)
+{
+  Rtmp2FlvTag tag = { 0, };
+
+  tag.tag_type = RTMP2_FLV_TAG_VIDEO;
+  tag.seqnum = seqnum;
+  tag.data_size = data_size;
+  fail_unless_equals_int (rtmp2_flv_tag_ring_push (ring, &tag), expect);
+}
+
+static void
+pop_tag (Rtmp2FlvTagRing * ring, guint32 seqnum, guint32 data_size)
+{
+  Rtmp2FlvTag tag = { 0, };
+
+  fail_unless (rtmp2_flv_tag_ring_pop (ring, &tag));
+  fail_unless_equals_int (tag.seqnum, seqnum);
+  fail_unless_equals_int (tag.data_size, data_size);
+}
+
+GST_START_TEST (test_ring_capacity)
+{
+  static const guint capacities[][2] = {
+    {0, 2}, {1, 2}, {2, 2}, {3, 4}, {1000, 1024}, {1024, 1024}, {1025, 2048},
+  };
+  Rtmp2FlvTagRing ring;
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (capacities); i++) {
+    rtmp2_flv_tag_ring_init (&ring, capacities[i][0]);
+    fail_unless_equals_int (ring.capacity, capacities[i][1]);
+    fail_unless_equals_int (ring.mask, capacities[i][1] - 1);
+    fail_unless_equals_int (rtmp2_flv_tag_ring_get_level (&ring), 0);
+    rtmp2_flv_tag_ring_clear (&ring);
+  }
+
+  /* head, tail and bytes each on their own cache line */
+  fail_unless_equals_int (sizeof (Rtmp2FlvTagRing),
+      4 * RTMP2_CACHE_LINE_SIZE);
+  fail_unless_equals_int (G_STRUCT_OFFSET (Rtmp2FlvTagRing, head),
+      RTMP2_CACHE_LINE_SIZE);
+  fail_unless_equals_int (G_STRUCT_OFFSET (Rtmp2FlvTagRing, tail),
+      2 * RTMP2_CACHE_LINE_SIZE);
+  fail_unless_equals_int (G_STRUCT_OFFSET (Rtmp2FlvTagRing, bytes),
+      3 * RTMP2_CACHE_LINE_SIZE);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_ring_zeroed)
+{
+  Rtmp2FlvTagRing ring;
+  Rtmp2FlvTag tag = { 0, };
+
+  /* Not yet initialized, as for sessions that never publish */
+  memset (&ring, 0, sizeof (ring));
+  push_tag (&ring, 0, 10, FALSE);
+  fail_if (rtmp2_flv_tag_ring_pop (&ring, &tag));
+  fail_unless (rtmp2_flv_tag_ring_peek (&ring, 0) == NULL);
+  fail_unless_equals_int (rtmp2_flv_tag_ring_get_level (&ring), 0);
+  fail_unless_equals_int (rtmp2_flv_tag_ring_get_bytes (&ring), 0);
+  rtmp2_flv_tag_ring_clear (&ring);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_ring_order)
+{
+  Rtmp2FlvTagRing ring;
+  Rtmp2FlvTag tag = { 0, };
+
+  rtmp2_flv_tag_ring_init (&ring, 8);
+
+  push_tag (&ring, 1, 10, TRUE);
+  push_tag (&ring, 2, 20, TRUE);
+  push_tag (&ring, 3, 30, TRUE);
+  fail_unless_equals_int (rtmp2_flv_tag_ring_get_level (&ring), 3);
+  fail_unless_equals_int (rtmp2_flv_tag_ring_get_bytes (&ring), 60);
+
+  fail_unless_equals_int (rtmp2_flv_tag_ring_peek (&ring, 0)->seqnum, 1);
+  fail_unless_equals_int (rtmp2_flv_tag_ring_peek (&ring, 2)->seqnum, 3);
+  fail_unless (rtmp2_flv_tag_ring_peek (&ring, 3) == NULL);
+
+  pop_tag (&ring, 1, 10);
+  fail_unless_equals_int (rtmp2_flv_tag_ring_get_bytes (&ring), 50);
+  pop_tag (&ring, 2, 20);
+  pop_tag (&ring, 3, 30);
+  fail_unless_equals_int (rtmp2_flv_tag_ring_get_level (&ring), 0);
+  fail_unless_equals_int (rtmp2_flv_tag_ring_get_bytes (&ring), 0);
+  fail_if (rtmp2_flv_tag_ring_pop (&ring, &tag));
+
+  rtmp2_flv_tag_ring_clear (&ring);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_ring_full)
+{
+  Rtmp2FlvTagRing ring;
+  guint i;
+
+  rtmp2_flv_tag_ring_init (&ring, 4);
+
+  for (i = 0; i < 4; i++)
+    push_tag (&ring, i, 1, TRUE);
+
+  /* A full ring refuses tags and keeps what it has */
+  push_tag (&ring, 4, 1, FALSE);
+  fail_unless_equals_int (rtmp2_flv_tag_ring_get_level (&ring), 4);
+  fail_unless_equals_int (rtmp2_flv_tag_ring_get_bytes (&ring), 4);
+
+  pop_tag (&ring, 0, 1);
+  push_tag (&ring, 4, 1, TRUE);
+
+  /* Wrap the indices around many times */
+  for (i = 5; i < 10000; i++) {
+    pop_tag (&ring, i - 4, 1);
+    push_tag (&ring, i, 1, TRUE);
+    fail_unless_equals_int (rtmp2_flv_tag_ring_get_level (&ring), 4);
+  }
+
+  rtmp2_flv_tag_ring_clear (&ring);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_ring_total)
+{
+  Rtmp2FlvTagRing a, b;
+  guint total = 0;
+
+  rtmp2_flv_tag_ring_init (&a, 4);
+  rtmp2_flv_tag_ring_init (&b, 4);
+  rtmp2_flv_tag_ring_set_total (&a, &total);
+  rtmp2_flv_tag_ring_set_total (&b, &total);
+
+  push_tag (&a, 0, 100, TRUE);
+  push_tag (&b, 0, 50, TRUE);
+  push_tag (&b, 1, 25, TRUE);
+  fail_unless_equals_int (total, 175);
+
+  pop_tag (&b, 0, 50);
+  fail_unless_equals_int (total, 125);
+
+  /* Clearing returns what was still queued */
+  rtmp2_flv_tag_ring_clear (&a);
+  rtmp2_flv_tag_ring_clear (&b);
+  fail_unless_equals_int (total, 0);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_ring_clear)
+{
+  Rtmp2FlvTagRing ring;
+  Rtmp2FlvTag tag = { 0, };
+  GstBuffer *body = make_body (16);
+
+  rtmp2_flv_tag_ring_init (&ring, 4);
+
+  /* The ring owns the queued bodies */
+  tag.data = gst_buffer_ref (body);
+  tag.data_size = 16;
+  fail_unless (rtmp2_flv_tag_ring_push (&ring, &tag));
+  ASSERT_MINI_OBJECT_REFCOUNT (body, "body", 2);
+
+  rtmp2_flv_tag_ring_clear (&ring);
+  ASSERT_MINI_OBJECT_REFCOUNT (body, "body", 1);
+  fail_unless (ring.slots == NULL);
+
+  gst_buffer_unref (body);
+}
+
+GST_END_TEST;
+
+#define RING_THREAD_TAGS 1000000
+
+static gpointer
+ring_producer (gpointer user_data)
+{
+  Rtmp2FlvTagRing *ring = user_data;
+  Rtmp2FlvTag tag = { 0, };
+  guint i;
+
+  for (i = 0; i < RING_THREAD_TAGS; i++) {
+    tag.seqnum = i;
+    tag.data_size = i % 100 + 1;
+    tag.timestamp = i * 3;
+    while (!rtmp2_flv_tag_ring_push (ring, &tag))
+      g_thread_yield ();
+  }
+
+  return NULL;
+}
+
+GST_START_TEST (test_ring_threads)
+{
+  Rtmp2FlvTagRing ring;
+  Rtmp2FlvTag tag;
+  guint total = 0;
+  GThread *producer;
+  guint i;
+
+  /* Small enough to be full and empty often */
+  rtmp2_flv_tag_ring_init (&ring, 64);
+  rtmp2_flv_tag_ring_set_total (&ring, &total);
+
+  producer = g_thread_new ("producer", ring_producer, &ring);
+
+  for (i = 0; i < RING_THREAD_TAGS; i++) {
+    const Rtmp2FlvTag *next;
+
+    while (!(next = rtmp2_flv_tag_ring_peek (&ring, 0)))
+      g_thread_yield ();
+    fail_unless_equals_int (next->seqnum, i);
+    fail_unless (rtmp2_flv_tag_ring_get_level (&ring) <= ring.capacity);
+
+    fail_unless (rtmp2_flv_tag_ring_pop (&ring, &tag));
+    fail_unless_equals_int (tag.seqnum, i);
+    fail_unless_equals_int (tag.data_size, i % 100 + 1);
+    fail_unless_equals_int (tag.timestamp, i * 3);
+  }
+
+  g_thread_join (producer);
+
+  fail_if (rtmp2_flv_tag_ring_pop (&ring, &tag));
+  fail_unless_equals_int (rtmp2_flv_tag_ring_get_bytes (&ring), 0);
+  fail_unless_equals_int (total, 0);
+  rtmp2_flv_tag_ring_clear (&ring);
+}
+
+GST_END_TEST;
+
+#define AVC1 'a', 'v', 'c', '1'
+#define HVC1 'h', 'v', 'c', '1'
+#define VP09 'v', 'p', '0', '9'
+#define AV01 'a', 'v', '0', '1'
+
+/* IsExHeader, FrameType and VideoPacketType */
+#define EX_HEADER(frame_type, packet_type) \
+  (0x80 | (frame_type) << 4 | (packet_type))
+
+/* Expected decoding of an E-RTMP video tag body */
+typedef struct
+{
+  const gchar *name;
+  guint8 data[16];
+  gsize size;
+  Rtmp2FlvVideoCodec codec;
+  gboolean sequence_header;
+  gboolean keyframe;
+  gint32 composition_time;
+  guint8 payload_offset;
+  guint32 timestamp_offset_ns;
+} ExVideoVector;
+
+static void
+check_ex_video (const ExVideoVector * vectors, guint n_vectors)
+{
+  guint i;
+
+  for (i = 0; i < n_vectors; i++) {
+    const ExVideoVector *v = &vectors[i];
+    Rtmp2FlvTag tag = { 0, };
+
+    tag.tag_type = RTMP2_FLV_TAG_VIDEO;
+    rtmp2_flv_tag_parse_header (&tag, v->data, v->size);
+
+    fail_unless (tag.video_codec == v->codec, "%s: codec %d", v->name,
+        tag.video_codec);
+    fail_unless (tag.sequence_header == v->sequence_header,
+        "%s: sequence header %d", v->name, tag.sequence_header);
+    fail_unless (tag.video_keyframe == v->keyframe, "%s: keyframe %d",
+        v->name, tag.video_keyframe);
+    fail_unless (tag.composition_time == v->composition_time,
+        "%s: composition time %d", v->name, tag.composition_time);
+    fail_unless (tag.payload_offset == v->payload_offset,
+        "%s: payload offset %u", v->name, tag.payload_offset);
+    fail_unless (tag.timestamp_offset_ns == v->timestamp_offset_ns,
+        "%s: timestamp offset %u", v->name, tag.timestamp_offset_ns);
+  }
+}
+
+GST_START_TEST (test_ex_video)
+{
+  static const ExVideoVector vectors[] = {
+    {"hevc sequence start", {EX_HEADER (1, 0), HVC1, 0x01, 0x02}, 7,
+        RTMP2_FLV_VIDEO_CODEC_H265, TRUE, TRUE, 0, 5, 0},
+    {"hevc coded frames", {EX_HEADER (1, 1), HVC1, 0x00, 0x00, 0x28, 0xaa},
+          9, RTMP2_FLV_VIDEO_CODEC_H265, FALSE, TRUE, 40, 8, 0},
+    {"avc negative composition time", {EX_HEADER (2, 1), AVC1, 0xff, 0xff,
+              0xf6, 0xaa}, 9, RTMP2_FLV_VIDEO_CODEC_H264, FALSE, FALSE, -10, 8,
+        0},
+    {"av1 coded frames", {EX_HEADER (2, 1), AV01, 0xaa, 0xbb}, 7,
+        RTMP2_FLV_VIDEO_CODEC_AV1, FALSE, FALSE, 0, 5, 0},
+    {"vp9 coded frames x", {EX_HEADER (4, 3), VP09, 0xaa}, 6,
+        RTMP2_FLV_VIDEO_CODEC_VP9, FALSE, TRUE, 0, 5, 0},
+    {"hevc coded frames x", {EX_HEADER (2, 3), HVC1, 0xaa}, 6,
+        RTMP2_FLV_VIDEO_CODEC_H265, FALSE, FALSE, 0, 5, 0},
+    {"sequence end", {EX_HEADER (1, 2), HVC1}, 5,
+        RTMP2_FLV_VIDEO_CODEC_H265, FALSE, FALSE, 0, 0, 0},
+    {"mpeg2ts sequence start", {EX_HEADER (1, 5), AV01, 0xaa}, 6,
+        RTMP2_FLV_VIDEO_CODEC_AV1, FALSE, FALSE, 0, 0, 0},
+    {"unknown fourcc", {EX_HEADER (1, 1), 'x', 'x', 'x', 'x', 0x00, 0x00,
+              0x00, 0xaa}, 9, 0, FALSE, FALSE, 0, 0, 0},
+  };
+
+  check_ex_video (vectors, G_N_ELEMENTS (vectors));
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_ex_video_mod_ex)
+{
+  static const ExVideoVector vectors[] = {
+    {"timestamp offset", {EX_HEADER (1, 7), 0x02, 0x07, 0xa1, 0x20, 0x01,
+              HVC1, 0x00, 0x00, 0x00, 0xaa}, 14, RTMP2_FLV_VIDEO_CODEC_H265,
+        FALSE, TRUE, 0, 13, 500000},
+    {"unknown modifier then timestamp offset", {EX_HEADER (1, 7), 0x00,
+              0xaa, 0x57, 0x02, 0x00, 0x01, 0xf4, 0x03, AV01, 0xbb}, 14,
+        RTMP2_FLV_VIDEO_CODEC_AV1, FALSE, TRUE, 0, 13, 500},
+    {"timestamp offset then unknown modifier", {EX_HEADER (1, 7), 0x02,
+              0x00, 0x00, 0x10, 0x07, 0x01, 0xaa, 0xbb, 0x53, VP09, 0xcc}, 15,
+        RTMP2_FLV_VIDEO_CODEC_VP9, FALSE, TRUE, 0, 14, 16},
+    {"unknown modifier only", {EX_HEADER (2, 7), 0x02, 0x01, 0x02, 0x03,
+              0x31, HVC1, 0x00, 0x00, 0x21, 0xaa}, 14,
+        RTMP2_FLV_VIDEO_CODEC_H265, FALSE, FALSE, 33, 13, 0},
+    {"short timestamp offset", {EX_HEADER (1, 7), 0x00, 0x12, 0x01, HVC1,
+              0x00, 0x00, 0x00, 0xaa}, 12, RTMP2_FLV_VIDEO_CODEC_H265, FALSE,
+        TRUE, 0, 11, 0},
+    {"sequence start", {EX_HEADER (1, 7), 0x02, 0x00, 0x00, 0x01, 0x00,
+              AV01, 0xaa}, 11, RTMP2_FLV_VIDEO_CODEC_AV1, TRUE, TRUE, 0, 10,
+        1},
+  };
+
+  check_ex_video (vectors, G_N_ELEMENTS (vectors));
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_ex_video_mod_ex_long)
+{
+  /* A modifier too large for the 8-bit size, with a 16-bit size of 257 */
+  guint8 data[1 + 1 + 2 + 257 + 1 + 4 + 3 + 1] = { 0, };
+  Rtmp2FlvTag tag = { 0, };
+  guint8 *p = data;
+
+  *p++ = EX_HEADER (1, 7);
+  *p++ = 0xff;
+  GST_WRITE_UINT16_BE (p, 256);
+  p += 2;
+  GST_WRITE_UINT24_BE (p, 123456);
+  p += 257;
+  *p++ = 0x01;
+  memcpy (p, "hvc1", 4);
+  p += 4;
+  GST_WRITE_UINT24_BE (p, 80);
+
+  tag.tag_type = RTMP2_FLV_TAG_VIDEO;
+  rtmp2_flv_tag_parse_header (&tag, data, sizeof (data));
+  fail_unless_equals_int (tag.video_codec, RTMP2_FLV_VIDEO_CODEC_H265);
+  fail_unless (tag.video_keyframe);
+  fail_unless_equals_int (tag.composition_time, 80);
+  fail_unless_equals_int (tag.timestamp_offset_ns, 123456);
+  /* The payload is out of reach of the offset */
+  fail_unless_equals_int (tag.payload_offset, 0);
+  fail_unless (rtmp2_flv_tag_get_payload (&tag) == NULL);
+
+  /* Cut in the modifier data */
+  memset (&tag, 0, sizeof (tag));
+  tag.tag_type = RTMP2_FLV_TAG_VIDEO;
+  rtmp2_flv_tag_parse_header (&tag, data, 100);
+  fail_unless_equals_int (tag.video_codec, 0);
+  fail_unless_equals_int (tag.timestamp_offset_ns, 0);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_ex_video_multitrack)
+{
+  static const ExVideoVector vectors[] = {
+    {"one track", {EX_HEADER (1, 6), 0x01, HVC1, 0x00, 0x00, 0x00, 0x05,
+              0xaa}, 11, RTMP2_FLV_VIDEO_CODEC_H265, FALSE, TRUE, 5, 10, 0},
+    {"one track sequence start", {EX_HEADER (1, 6), 0x00, AV01, 0x00,
+              0xaa}, 8, RTMP2_FLV_VIDEO_CODEC_AV1, TRUE, TRUE, 0, 7, 0},
+    {"one track, not track 0", {EX_HEADER (1, 6), 0x01, HVC1, 0x01, 0x00,
+              0x00, 0x05, 0xaa}, 11, RTMP2_FLV_VIDEO_CODEC_H265, FALSE, FALSE,
+        0, 0, 0},
+    {"many tracks", {EX_HEADER (1, 6), 0x11, HVC1, 0x00, 0x00, 0x00, 0x04,
+              0x00, 0x00, 0x00, 0xaa}, 14, RTMP2_FLV_VIDEO_CODEC_H265, FALSE,
+        FALSE, 0, 0, 0},
+    {"many tracks many codecs", {EX_HEADER (1, 6), 0x23, AV01, 0x00, 0x00,
+              0x00, 0x01, 0xaa, VP09}, 15, RTMP2_FLV_VIDEO_CODEC_AV1, FALSE,
+        FALSE, 0, 0, 0},
+    {"timestamp offset and one track", {EX_HEADER (1, 7), 0x02, 0x00,
+              0x03, 0xe8, 0x06, 0x03, VP09, 0x00, 0xaa}, 13,
+        RTMP2_FLV_VIDEO_CODEC_VP9, FALSE, TRUE, 0, 12, 1000},
+  };
+
+  check_ex_video (vectors, G_N_ELEMENTS (vectors));
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_ex_video_command)
+{
+  static const ExVideoVector vectors[] = {
+    /* VideoCommand StartSeek */
+    {"command", {EX_HEADER (5, 1), 0x00}, 2, 0, FALSE, FALSE, 0, 0, 0},
+    {"command after modifier", {EX_HEADER (5, 7), 0x02, 0x00, 0x00, 0x10,
+              0x01, 0x01}, 7, 0, FALSE, FALSE, 0, 0, 16},
+    {"command metadata", {EX_HEADER (5, 4), HVC1, 0x02, 0x00, 0x00}, 8,
+        RTMP2_FLV_VIDEO_CODEC_H265, FALSE, FALSE, 0, 0, 0},
+    {"metadata", {EX_HEADER (1, 4), AV01, 0x02, 0x00, 0x00}, 8,
+        RTMP2_FLV_VIDEO_CODEC_AV1, FALSE, FALSE, 0, 0, 0},
+  };
+
+  check_ex_video (vectors, G_N_ELEMENTS (vectors));
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_ex_video_truncated)
+{
+  static const ExVideoVector vectors[] = {
+    {"empty", {0}, 0, 0, FALSE, FALSE, 0, 0, 0},
+    {"header byte only", {EX_HEADER (1, 1)}, 1, 0, FALSE, FALSE, 0, 0, 0},
+    {"short fourcc", {EX_HEADER (1, 1), 'h', 'v', 'c'}, 4, 0, FALSE, FALSE,
+        0, 0, 0},
+    {"short composition time", {EX_HEADER (1, 1), HVC1, 0x00, 0x28}, 7,
+        RTMP2_FLV_VIDEO_CODEC_H265, FALSE, FALSE, 0, 0, 0},
+    {"coded frames without payload", {EX_HEADER (1, 1), HVC1, 0x00, 0x00,
+              0x28}, 8, RTMP2_FLV_VIDEO_CODEC_H265, FALSE, TRUE, 40, 8, 0},
+    {"modifier size only", {EX_HEADER (1, 7)}, 1, 0, FALSE, FALSE, 0, 0, 0},
+    {"short modifier", {EX_HEADER (1, 7), 0x02, 0x00, 0x01}, 4, 0, FALSE,
+        FALSE, 0, 0, 0},
+    {"modifier without packet type", {EX_HEADER (1, 7), 0x02, 0x00, 0x01,
+              0x02}, 5, 0, FALSE, FALSE, 0, 0, 0},
+    {"short 16-bit modifier size", {EX_HEADER (1, 7), 0xff, 0x01}, 3, 0,
+        FALSE, FALSE, 0, 0, 0},
+    {"modifier then nothing", {EX_HEADER (1, 7), 0x02, 0x00, 0x01, 0x02,
+              0x01}, 6, 0, FALSE, FALSE, 0, 0, 258},
+    {"multitrack type only", {EX_HEADER (1, 6)}, 1, 0, FALSE, FALSE, 0, 0,
+        0},
+    {"multitrack without track id", {EX_HEADER (1, 6), 0x01, HVC1}, 6,
+        RTMP2_FLV_VIDEO_CODEC_H265, FALSE, FALSE, 0, 0, 0},
+  };
+
+  check_ex_video (vectors, G_N_ELEMENTS (vectors));
+}
+
+GST_END_TEST;
+
+static Suite *
+rtmp2flv_suite (void)
+{
+  Suite *s = suite_create ("rtmp2flv");
+  TCase *tc_chain = tcase_create ("general");
+
+  suite_add_tcase (s, tc_chain);
+  tcase_add_test (tc_chain, test_tag_to_buffer);
+  tcase_add_test (tc_chain, test_tag_to_buffer_many_memories);
+  tcase_add_test (tc_chain, test_tag_to_buffer_empty);
+  tcase_add_test (tc_chain, test_tag_to_buffer_keeps_body);
+  tcase_add_test (tc_chain, test_ring_capacity);
+  tcase_add_test (tc_chain, test_ring_zeroed);
+  tcase_add_test (tc_chain, test_ring_order);
+  tcase_add_test (tc_chain, test_ring_full);
+  tcase_add_test (tc_chain, test_ring_total);
+  tcase_add_test (tc_chain, test_ring_clear);
+  tcase_add_test (tc_chain, test_ring_threads);
+  tcase_add_test (tc_chain, test_ex_video);
+  tcase_add_test (tc_chain, test_ex_video_mod_ex);
+  tcase_add_test (tc_chain, test_ex_video_mod_ex_long);
+  tcase_add_test (tc_chain, test_ex_video_multitrack);
+  tcase_add_test (tc_chain, test_ex_video_command);
+  tcase_add_test (tc_chain, test_ex_video_truncated);
+
+  return s;
+}
+
+GST_CHECK_MAIN (rtmp2flv);
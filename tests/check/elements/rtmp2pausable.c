@@ -0,0 +1,220 @@
+/* GStreamer
+ * Copyright (C) 2025 Yaron Torbaty <yarontorbaty@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gst/check/gstcheck.h>
+#include <sys/socket.h>
+
+#include "rtmp/rtmppausable.h"
+
+typedef struct
+{
+  GMainContext *context;
+  GSocket *peer;
+  GSocketConnection *base;
+  Rtmp2PausableConnection *connection;
+  GPollableInputStream *input;
+  guint dispatched;
+} Fixture;
+
+static void
+fixture_init (Fixture * f)
+{
+  gint fds[2];
+
+  fail_unless (socketpair (AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+
+  f->context = g_main_context_new ();
+  f->peer = g_socket_new_from_fd (fds[0], NULL);
+  f->base = g_socket_connection_factory_create_connection
+      (g_socket_new_from_fd (fds[1], NULL));
+  /* The connection holds the socket */
+  g_object_unref (g_socket_connection_get_socket (f->base));
+  f->connection = rtmp2_pausable_connection_new (f->base);
+  f->input = G_POLLABLE_INPUT_STREAM (g_io_stream_get_input_stream
+      (G_IO_STREAM (f->connection)));
+  f->dispatched = 0;
+}
+
+static void
+fixture_clear (Fixture * f)
+{
+  g_io_stream_close (G_IO_STREAM (f->connection), NULL, NULL);
+  g_object_unref (f->connection);
+  g_object_unref (f->base);
+  g_object_unref (f->peer);
+  g_main_context_unref (f->context);
+}
+
+static void
+peer_send (Fixture * f, const gchar * data)
+{
+  fail_unless_equals_int (g_socket_send (f->peer, data, strlen (data), NULL,
+          NULL), strlen (data));
+}
+
+/* Reads everything there is, like the RTMP connection does */
+static gboolean
+on_readable (GObject * stream, gpointer user_data)
+{
+  Fixture *f = user_data;
+  gchar buffer[64];
+
+  f->dispatched++;
+  while (g_pollable_input_stream_read_nonblocking (f->input, buffer,
+          sizeof (buffer), NULL, NULL) > 0);
+
+  return G_SOURCE_CONTINUE;
+}
+
+static GSource *
+attach_source (Fixture * f)
+{
+  GSource *source = g_pollable_input_stream_create_source (f->input, NULL);
+
+  g_source_set_callback (source, (GSourceFunc) on_readable, f, NULL);
+  g_source_attach (source, f->context);
+  return source;
+}
+
+static void
+iterate (Fixture * f)
+{
+  while (g_main_context_iteration (f->context, FALSE));
+}
+
+GST_START_TEST (test_read)
+{
+  Fixture f;
+  gchar buffer[16];
+  GError *error = NULL;
+
+  fixture_init (&f);
+
+  fail_unless (g_pollable_input_stream_can_poll (f.input));
+  fail_if (g_pollable_input_stream_is_readable (f.input));
+
+  peer_send (&f, "hello");
+  fail_unless (g_pollable_input_stream_is_readable (f.input));
+  fail_unless_equals_int (g_pollable_input_stream_read_nonblocking (f.input,
+          buffer, sizeof (buffer), NULL, NULL), 5);
+  fail_unless (memcmp (buffer, "hello", 5) == 0);
+
+  /* Paused, the data stays in the socket */
+  peer_send (&f, "world");
+  rtmp2_pausable_connection_set_paused (f.connection, TRUE);
+  fail_if (g_pollable_input_stream_is_readable (f.input));
+  fail_unless_equals_int (g_pollable_input_stream_read_nonblocking (f.input,
+          buffer, sizeof (buffer), NULL, &error), -1);
+  fail_unless (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_WOULD_BLOCK));
+  g_clear_error (&error);
+
+  rtmp2_pausable_connection_set_paused (f.connection, FALSE);
+  fail_unless_equals_int (g_pollable_input_stream_read_nonblocking (f.input,
+          buffer, sizeof (buffer), NULL, NULL), 5);
+  fail_unless (memcmp (buffer, "world", 5) == 0);
+
+  fixture_clear (&f);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_source)
+{
+  Fixture f;
+  GSource *source;
+
+  fixture_init (&f);
+  source = attach_source (&f);
+
+  iterate (&f);
+  fail_unless_equals_int (f.dispatched, 0);
+
+  peer_send (&f, "one");
+  iterate (&f);
+  fail_unless_equals_int (f.dispatched, 1);
+
+  /* Not polled while paused, pausing twice is fine */
+  rtmp2_pausable_connection_set_paused (f.connection, TRUE);
+  rtmp2_pausable_connection_set_paused (f.connection, TRUE);
+  peer_send (&f, "two");
+  iterate (&f);
+  fail_unless_equals_int (f.dispatched, 1);
+
+  /* What arrived meanwhile is read on resume */
+  rtmp2_pausable_connection_set_paused (f.connection, FALSE);
+  iterate (&f);
+  fail_unless_equals_int (f.dispatched, 2);
+  iterate (&f);
+  fail_unless_equals_int (f.dispatched, 2);
+
+  g_source_destroy (source);
+  g_source_unref (source);
+
+  /* Destroyed sources are left alone */
+  rtmp2_pausable_connection_set_paused (f.connection, TRUE);
+  rtmp2_pausable_connection_set_paused (f.connection, FALSE);
+
+  fixture_clear (&f);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_source_created_paused)
+{
+  Fixture f;
+  GSource *source;
+
+  fixture_init (&f);
+  rtmp2_pausable_connection_set_paused (f.connection, TRUE);
+  source = attach_source (&f);
+
+  peer_send (&f, "data");
+  iterate (&f);
+  fail_unless_equals_int (f.dispatched, 0);
+
+  rtmp2_pausable_connection_set_paused (f.connection, FALSE);
+  iterate (&f);
+  fail_unless_equals_int (f.dispatched, 1);
+
+  g_source_destroy (source);
+  g_source_unref (source);
+  fixture_clear (&f);
+}
+
+GST_END_TEST;
+
+static Suite *
+rtmp2pausable_suite (void)
+{
+  Suite *s = suite_create ("rtmp2pausable");
+  TCase *tc_chain = tcase_create ("general");
+
+  suite_add_tcase (s, tc_chain);
+  tcase_add_test (tc_chain, test_read);
+  tcase_add_test (tc_chain, test_source);
+  tcase_add_test (tc_chain, test_source_created_paused);
+
+  return s;
+}
+
+GST_CHECK_MAIN (rtmp2pausable);
@@ -0,0 +1,493 @@
+/* GStreamer
+ * Copyright (C) 2025 Yaron Torbaty <yarontorbaty@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gst/check/gstcheck.h>
+#include <string.h>
+
+#include "rtmp/amf.h"
+#include "rtmp/rtmpmessage.h"
+#include "rtmp/rtmpserver.h"
+
+/* Check a response built from its template against the serialization of
+ * the AMF nodes, as every response used to be built. Takes the nodes. */
+static void
+check_response (guint8 * data, gsize size, gdouble transaction_id,
+    const gchar * command, GstAmfNode * first, GstAmfNode * second)
+{
+  GBytes *expected;
+  gconstpointer expected_data;
+  gsize expected_size;
+
+  expected = gst_amf_serialize_command (transaction_id, command, first,
+      second, NULL);
+  expected_data = g_bytes_get_data (expected, &expected_size);
+
+  fail_unless_equals_int (size, expected_size);
+  fail_unless (memcmp (data, expected_data, size) == 0);
+
+  g_bytes_unref (expected);
+  gst_amf_node_free (first);
+  gst_amf_node_free (second);
+  g_free (data);
+}
+
+static void
+check_connect_result (gdouble transaction_id,
+    const GstRtmpEnhancedCaps * caps)
+{
+  GstAmfNode *properties, *info;
+  guint8 *data;
+  gsize size;
+
+  properties = gst_amf_node_new_object ();
+  gst_amf_node_append_field_string (properties, "fmsVer", "FMS/3,0,1,123",
+      -1);
+  gst_amf_node_append_field_number (properties, "capabilities", 31);
+
+  info = gst_amf_node_new_object ();
+  gst_amf_node_append_field_string (info, "level", "status", -1);
+  gst_amf_node_append_field_string (info, "code",
+      "NetConnection.Connect.Success", -1);
+  gst_amf_node_append_field_string (info, "description",
+      "Connection succeeded.", -1);
+  gst_amf_node_append_field_number (info, "objectEncoding", 0);
+
+  if (caps && (caps->supports_hevc || caps->supports_vp9 ||
+          caps->supports_av1)) {
+    GstAmfNode *fourcc_map = gst_amf_node_new_object ();
+
+    if (caps->supports_hevc)
+      gst_amf_node_append_take_field (fourcc_map, "hvc1",
+          gst_amf_node_new_object ());
+    if (caps->supports_vp9)
+      gst_amf_node_append_take_field (fourcc_map, "vp09",
+          gst_amf_node_new_object ());
+    if (caps->supports_av1)
+      gst_amf_node_append_take_field (fourcc_map, "av01",
+          gst_amf_node_new_object ());
+    gst_amf_node_append_take_field (info, "videoFourCcInfoMap", fourcc_map);
+  }
+
+  data = gst_rtmp_server_build_connect_result (transaction_id, caps, &size);
+  check_response (data, size, transaction_id, "_result", properties, info);
+}
+
+GST_START_TEST (test_connect_result)
+{
+  GstRtmpEnhancedCaps caps = { 0, };
+  guint variant;
+
+  check_connect_result (1, NULL);
+  check_connect_result (1, &caps);
+
+  /* Every videoFourCcInfoMap variant, twice to use the templates again */
+  for (variant = 0; variant < 16; variant++) {
+    caps.supports_hevc = (variant & 1) != 0;
+    caps.supports_vp9 = (variant & 2) != 0;
+    caps.supports_av1 = (variant & 4) != 0;
+    check_connect_result (1 + variant % 8, &caps);
+  }
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_create_stream_result)
+{
+  static const struct
+  {
+    gdouble transaction_id;
+    guint32 stream_id;
+  } cases[] = {
+    {4, 1}, {2, 1}, {9, 3}, {0, 0}, {123456789, G_MAXUINT32},
+  };
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (cases); i++) {
+    guint8 *data;
+    gsize size;
+
+    data = gst_rtmp_server_build_create_stream_result
+        (cases[i].transaction_id, cases[i].stream_id, &size);
+    check_response (data, size, cases[i].transaction_id, "_result",
+        gst_amf_node_new_null (),
+        gst_amf_node_new_number ((gdouble) cases[i].stream_id));
+  }
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_result)
+{
+  static const gdouble transaction_ids[] = { 2, 3, 5, 0, 1e9 };
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (transaction_ids); i++) {
+    guint8 *data;
+    gsize size;
+
+    data = gst_rtmp_server_build_result (transaction_ids[i], &size);
+    check_response (data, size, transaction_ids[i], "_result",
+        gst_amf_node_new_null (), gst_amf_node_new_null ());
+  }
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_publish_start)
+{
+  guint i;
+
+  for (i = 0; i < 2; i++) {
+    GstAmfNode *info = gst_amf_node_new_object ();
+    guint8 *data;
+    gsize size;
+
+    gst_amf_node_append_field_string (info, "level", "status", -1);
+    gst_amf_node_append_field_string (info, "code",
+        "NetStream.Publish.Start", -1);
+    gst_amf_node_append_field_string (info, "description",
+        "Publishing started.", -1);
+
+    data = gst_rtmp_server_build_publish_start (&size);
+    check_response (data, size, 0, "onStatus", gst_amf_node_new_null (),
+        info);
+  }
+}
+
+GST_END_TEST;
+
+/* Aggregate message under construction */
+typedef struct
+{
+  GByteArray *data;
+} Aggregate;
+
+/* Append a sub-message of size bytes, each its index plus seed */
+static void
+aggregate_append (Aggregate * agg, guint8 type, guint32 ts, guint32 size,
+    guint8 seed, gboolean back_pointer)
+{
+  guint8 header[11] = { 0, };
+  guint8 tail[4];
+  guint32 i;
+
+  header[0] = type;
+  GST_WRITE_UINT24_BE (header + 1, size);
+  GST_WRITE_UINT24_BE (header + 4, ts & 0xffffff);
+  header[7] = ts >> 24;
+  GST_WRITE_UINT24_BE (header + 8, 1);
+  g_byte_array_append (agg->data, header, sizeof (header));
+
+  for (i = 0; i < size; i++) {
+    guint8 byte = seed + i;
+
+    g_byte_array_append (agg->data, &byte, 1);
+  }
+
+  if (back_pointer) {
+    GST_WRITE_UINT32_BE (tail, sizeof (header) + size);
+    g_byte_array_append (agg->data, tail, sizeof (tail));
+  }
+}
+
+/* The aggregate as an RTMP message, dts in milliseconds or -1 for none */
+static GstBuffer *
+aggregate_finish (Aggregate * agg, gint64 dts, guint32 ts_delta)
+{
+  gsize size = agg->data->len;
+  GstBuffer *buffer;
+
+  buffer = gst_rtmp_message_new_wrapped (GST_RTMP_MESSAGE_TYPE_AGGREGATE,
+      6, 1, g_byte_array_free (agg->data, FALSE), size);
+  gst_buffer_get_rtmp_meta (buffer)->ts_delta = ts_delta;
+  if (dts >= 0)
+    GST_BUFFER_DTS (buffer) = dts * GST_MSECOND;
+  agg->data = NULL;
+
+  return buffer;
+}
+
+static void
+collect_message (GstRtmpConnection * connection, GstBuffer * buffer,
+    gpointer user_data)
+{
+  GPtrArray *messages = user_data;
+
+  g_ptr_array_add (messages, gst_buffer_ref (buffer));
+}
+
+/* Split the aggregate, returns the sub-messages */
+static GPtrArray *
+split_aggregate (GstBuffer * buffer, gboolean expect_ok)
+{
+  GPtrArray *messages =
+      g_ptr_array_new_with_free_func ((GDestroyNotify) gst_buffer_unref);
+
+  fail_unless_equals_int (gst_rtmp_server_foreach_aggregate (NULL, buffer,
+          collect_message, messages), expect_ok);
+  return messages;
+}
+
+static void
+check_message (GPtrArray * messages, guint index, GstRtmpMessageType type,
+    guint32 size, guint8 seed, gint64 dts, guint32 ts_delta)
+{
+  GstBuffer *buffer = g_ptr_array_index (messages, index);
+  GstRtmpMeta *meta = gst_buffer_get_rtmp_meta (buffer);
+  GstMapInfo map;
+  guint32 i;
+
+  fail_unless (meta != NULL);
+  fail_unless_equals_int (meta->type, type);
+  fail_unless_equals_int (meta->size, size);
+  fail_unless_equals_int (meta->mstream, 1);
+  fail_unless_equals_int (meta->cstream, 6);
+  fail_unless_equals_int (meta->ts_delta, ts_delta);
+  if (dts >= 0)
+    fail_unless_equals_uint64 (GST_BUFFER_DTS (buffer), dts * GST_MSECOND);
+  else
+    fail_if (GST_BUFFER_DTS_IS_VALID (buffer));
+
+  fail_unless_equals_int (gst_buffer_get_size (buffer), size);
+  gst_buffer_map (buffer, &map, GST_MAP_READ);
+  for (i = 0; i < size; i++)
+    fail_unless_equals_int (map.data[i], (guint8) (seed + i));
+  gst_buffer_unmap (buffer, &map);
+}
+
+GST_START_TEST (test_aggregate)
+{
+  Aggregate agg = { g_byte_array_new () };
+  GstBuffer *buffer, *first;
+  GPtrArray *messages;
+  GstMapInfo map, sub_map;
+
+  aggregate_append (&agg, GST_RTMP_MESSAGE_TYPE_DATA_AMF0, 1000, 30, 7, TRUE);
+  aggregate_append (&agg, GST_RTMP_MESSAGE_TYPE_VIDEO, 1000, 200, 1, TRUE);
+  aggregate_append (&agg, GST_RTMP_MESSAGE_TYPE_AUDIO, 1021, 10, 2, TRUE);
+  /* Not a media message, skipped but still part of the timeline */
+  aggregate_append (&agg, GST_RTMP_MESSAGE_TYPE_COMMAND_AMF0, 1030, 5, 0,
+      TRUE);
+  aggregate_append (&agg, GST_RTMP_MESSAGE_TYPE_VIDEO, 1040, 100, 3, TRUE);
+  buffer = aggregate_finish (&agg, 5000, 33);
+
+  messages = split_aggregate (buffer, TRUE);
+  fail_unless_equals_int (messages->len, 4);
+  check_message (messages, 0, GST_RTMP_MESSAGE_TYPE_DATA_AMF0, 30, 7, 5000,
+      33);
+  check_message (messages, 1, GST_RTMP_MESSAGE_TYPE_VIDEO, 200, 1, 5000, 0);
+  check_message (messages, 2, GST_RTMP_MESSAGE_TYPE_AUDIO, 10, 2, 5021, 21);
+  check_message (messages, 3, GST_RTMP_MESSAGE_TYPE_VIDEO, 100, 3, 5040, 10);
+
+  /* The sub-messages share the memory of the aggregate */
+  first = g_ptr_array_index (messages, 0);
+  gst_buffer_map (buffer, &map, GST_MAP_READ);
+  gst_buffer_map (first, &sub_map, GST_MAP_READ);
+  fail_unless (sub_map.data == map.data + 11);
+  gst_buffer_unmap (first, &sub_map);
+  gst_buffer_unmap (buffer, &map);
+
+  g_ptr_array_unref (messages);
+  gst_buffer_unref (buffer);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_aggregate_truncated_header)
+{
+  Aggregate agg = { g_byte_array_new () };
+  guint8 partial[5] = { GST_RTMP_MESSAGE_TYPE_VIDEO, 0, 0, 10, 0 };
+  GstBuffer *buffer;
+  GPtrArray *messages;
+
+  aggregate_append (&agg, GST_RTMP_MESSAGE_TYPE_VIDEO, 0, 50, 1, TRUE);
+  g_byte_array_append (agg.data, partial, sizeof (partial));
+  buffer = aggregate_finish (&agg, 0, 0);
+
+  /* What came before is still delivered */
+  messages = split_aggregate (buffer, FALSE);
+  fail_unless_equals_int (messages->len, 1);
+  check_message (messages, 0, GST_RTMP_MESSAGE_TYPE_VIDEO, 50, 1, 0, 0);
+
+  g_ptr_array_unref (messages);
+  gst_buffer_unref (buffer);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_aggregate_truncated_body)
+{
+  Aggregate agg = { g_byte_array_new () };
+  GstBuffer *buffer;
+  GPtrArray *messages;
+
+  aggregate_append (&agg, GST_RTMP_MESSAGE_TYPE_AUDIO, 0, 20, 1, TRUE);
+  aggregate_append (&agg, GST_RTMP_MESSAGE_TYPE_VIDEO, 20, 100, 2, FALSE);
+  g_byte_array_set_size (agg.data, agg.data->len - 50);
+  buffer = aggregate_finish (&agg, 0, 0);
+
+  messages = split_aggregate (buffer, FALSE);
+  fail_unless_equals_int (messages->len, 1);
+  check_message (messages, 0, GST_RTMP_MESSAGE_TYPE_AUDIO, 20, 1, 0, 0);
+  g_ptr_array_unref (messages);
+  gst_buffer_unref (buffer);
+
+  /* A lone header that announces more than there is */
+  agg.data = g_byte_array_new ();
+  aggregate_append (&agg, GST_RTMP_MESSAGE_TYPE_VIDEO, 0, 100, 2, FALSE);
+  g_byte_array_set_size (agg.data, 11 + 99);
+  buffer = aggregate_finish (&agg, 0, 0);
+
+  messages = split_aggregate (buffer, FALSE);
+  fail_unless_equals_int (messages->len, 0);
+  g_ptr_array_unref (messages);
+  gst_buffer_unref (buffer);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_aggregate_no_final_back_pointer)
+{
+  Aggregate agg = { g_byte_array_new () };
+  GstBuffer *buffer;
+  GPtrArray *messages;
+
+  aggregate_append (&agg, GST_RTMP_MESSAGE_TYPE_VIDEO, 100, 40, 1, TRUE);
+  aggregate_append (&agg, GST_RTMP_MESSAGE_TYPE_AUDIO, 140, 8, 2, FALSE);
+  buffer = aggregate_finish (&agg, 100, 0);
+
+  messages = split_aggregate (buffer, TRUE);
+  fail_unless_equals_int (messages->len, 2);
+  check_message (messages, 0, GST_RTMP_MESSAGE_TYPE_VIDEO, 40, 1, 100, 0);
+  check_message (messages, 1, GST_RTMP_MESSAGE_TYPE_AUDIO, 8, 2, 140, 40);
+
+  g_ptr_array_unref (messages);
+  gst_buffer_unref (buffer);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_aggregate_extended_timestamp)
+{
+  Aggregate agg = { g_byte_array_new () };
+  GstBuffer *buffer;
+  GPtrArray *messages;
+
+  /* The upper byte of the timestamps is set */
+  aggregate_append (&agg, GST_RTMP_MESSAGE_TYPE_VIDEO, 0x01fffff0, 10, 1,
+      TRUE);
+  aggregate_append (&agg, GST_RTMP_MESSAGE_TYPE_VIDEO, 0x02000010, 10, 2,
+      TRUE);
+  buffer = aggregate_finish (&agg, 0x01fffff0, 5);
+
+  messages = split_aggregate (buffer, TRUE);
+  fail_unless_equals_int (messages->len, 2);
+  check_message (messages, 0, GST_RTMP_MESSAGE_TYPE_VIDEO, 10, 1,
+      0x01fffff0, 5);
+  check_message (messages, 1, GST_RTMP_MESSAGE_TYPE_VIDEO, 10, 2,
+      0x02000010, 0x20);
+  g_ptr_array_unref (messages);
+  gst_buffer_unref (buffer);
+
+  /* Timestamps wrapping around 32 bits */
+  agg.data = g_byte_array_new ();
+  aggregate_append (&agg, GST_RTMP_MESSAGE_TYPE_AUDIO, 0xfffffff0, 4, 1,
+      TRUE);
+  aggregate_append (&agg, GST_RTMP_MESSAGE_TYPE_AUDIO, 0x00000010, 4, 2,
+      TRUE);
+  buffer = aggregate_finish (&agg, G_GINT64_CONSTANT (0x100000000) - 0x10, 0);
+
+  messages = split_aggregate (buffer, TRUE);
+  fail_unless_equals_int (messages->len, 2);
+  check_message (messages, 0, GST_RTMP_MESSAGE_TYPE_AUDIO, 4, 1,
+      G_GINT64_CONSTANT (0x100000000) - 0x10, 0);
+  check_message (messages, 1, GST_RTMP_MESSAGE_TYPE_AUDIO, 4, 2,
+      G_GINT64_CONSTANT (0x100000000) + 0x10, 0x20);
+  g_ptr_array_unref (messages);
+  gst_buffer_unref (buffer);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_aggregate_rebased_dts)
+{
+  Aggregate agg = { g_byte_array_new () };
+  GstBuffer *buffer;
+  GPtrArray *messages;
+
+  /* The sub-message timestamps are offsets from the first one, whatever
+   * the absolute timestamp of the aggregate */
+  aggregate_append (&agg, GST_RTMP_MESSAGE_TYPE_VIDEO, 0, 10, 1, TRUE);
+  aggregate_append (&agg, GST_RTMP_MESSAGE_TYPE_VIDEO, 40, 10, 2, TRUE);
+  aggregate_append (&agg, GST_RTMP_MESSAGE_TYPE_VIDEO, 80, 10, 3, TRUE);
+  buffer = aggregate_finish (&agg, 123456, 40);
+
+  messages = split_aggregate (buffer, TRUE);
+  fail_unless_equals_int (messages->len, 3);
+  check_message (messages, 0, GST_RTMP_MESSAGE_TYPE_VIDEO, 10, 1, 123456,
+      40);
+  check_message (messages, 1, GST_RTMP_MESSAGE_TYPE_VIDEO, 10, 2, 123496,
+      40);
+  check_message (messages, 2, GST_RTMP_MESSAGE_TYPE_VIDEO, 10, 3, 123536,
+      40);
+  g_ptr_array_unref (messages);
+  gst_buffer_unref (buffer);
+
+  /* Without a DTS on the aggregate, none on the sub-messages */
+  agg.data = g_byte_array_new ();
+  aggregate_append (&agg, GST_RTMP_MESSAGE_TYPE_AUDIO, 500, 4, 1, TRUE);
+  aggregate_append (&agg, GST_RTMP_MESSAGE_TYPE_AUDIO, 523, 4, 2, TRUE);
+  buffer = aggregate_finish (&agg, -1, 0);
+
+  messages = split_aggregate (buffer, TRUE);
+  fail_unless_equals_int (messages->len, 2);
+  check_message (messages, 0, GST_RTMP_MESSAGE_TYPE_AUDIO, 4, 1, -1, 0);
+  check_message (messages, 1, GST_RTMP_MESSAGE_TYPE_AUDIO, 4, 2, -1, 23);
+  g_ptr_array_unref (messages);
+  gst_buffer_unref (buffer);
+}
+
+GST_END_TEST;
+
+static Suite *
+rtmp2server_suite (void)
+{
+  Suite *s = suite_create ("rtmp2server");
+  TCase *tc_chain = tcase_create ("general");
+
+  suite_add_tcase (s, tc_chain);
+  tcase_add_test (tc_chain, test_connect_result);
+  tcase_add_test (tc_chain, test_create_stream_result);
+  tcase_add_test (tc_chain, test_result);
+  tcase_add_test (tc_chain, test_publish_start);
+  tcase_add_test (tc_chain, test_aggregate);
+  tcase_add_test (tc_chain, test_aggregate_truncated_header);
+  tcase_add_test (tc_chain, test_aggregate_truncated_body);
+  tcase_add_test (tc_chain, test_aggregate_no_final_back_pointer);
+  tcase_add_test (tc_chain, test_aggregate_extended_timestamp);
+  tcase_add_test (tc_chain, test_aggregate_rebased_dts);
+
+  return s;
+}
+
+GST_CHECK_MAIN (rtmp2server);
@@ -0,0 +1,306 @@
+/* GStreamer
+ * Copyright (C) 2025 Yaron Torbaty <yarontorbaty@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gst/check/gstcheck.h>
+
+#include "rtmp/rtmptimerwheel.h"
+
+#define N_TIMERS 64
+
+typedef struct
+{
+  Rtmp2Timer timer;
+  guint index;
+} Owner;
+
+static void
+expire_nothing (gpointer owner)
+{
+}
+
+static void
+init_owners (Owner * owners, guint n)
+{
+  guint i;
+
+  for (i = 0; i < n; i++) {
+    rtmp2_timer_init (&owners[i].timer, &owners[i]);
+    owners[i].index = i;
+  }
+}
+
+GST_START_TEST (test_expiry_order)
+{
+  Rtmp2TimerWheel wheel;
+  Owner owners[3];
+  GList *expired;
+
+  rtmp2_timer_wheel_init (&wheel, expire_nothing);
+  init_owners (owners, 3);
+
+  rtmp2_timer_wheel_arm (&wheel, &owners[0].timer, 3);
+  rtmp2_timer_wheel_arm (&wheel, &owners[1].timer, 1);
+  rtmp2_timer_wheel_arm (&wheel, &owners[2].timer, 2);
+
+  fail_unless (rtmp2_timer_wheel_advance (&wheel, 0) == NULL);
+
+  /* Catching up on several ticks at once keeps the expiry order */
+  expired = rtmp2_timer_wheel_advance (&wheel, 3);
+  fail_unless_equals_int (g_list_length (expired), 3);
+  fail_unless (g_list_nth_data (expired, 0) == &owners[1]);
+  fail_unless (g_list_nth_data (expired, 1) == &owners[2]);
+  fail_unless (g_list_nth_data (expired, 2) == &owners[0]);
+  g_list_free (expired);
+
+  fail_if (rtmp2_timer_wheel_is_armed (&wheel, &owners[0].timer));
+  fail_if (rtmp2_timer_wheel_is_armed (&wheel, &owners[1].timer));
+  fail_if (rtmp2_timer_wheel_is_armed (&wheel, &owners[2].timer));
+  fail_unless (rtmp2_timer_wheel_advance (&wheel, 10) == NULL);
+
+  rtmp2_timer_wheel_clear (&wheel);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_rearm)
+{
+  Rtmp2TimerWheel wheel;
+  Owner owner;
+  GList *expired;
+
+  rtmp2_timer_wheel_init (&wheel, expire_nothing);
+  init_owners (&owner, 1);
+
+  /* Re-arming replaces the timeout, the timer is queued once */
+  rtmp2_timer_wheel_arm (&wheel, &owner.timer, 2);
+  rtmp2_timer_wheel_arm (&wheel, &owner.timer, 5);
+  fail_unless (rtmp2_timer_wheel_advance (&wheel, 4) == NULL);
+  fail_unless (rtmp2_timer_wheel_is_armed (&wheel, &owner.timer));
+
+  expired = rtmp2_timer_wheel_advance (&wheel, 5);
+  fail_unless_equals_int (g_list_length (expired), 1);
+  fail_unless (expired->data == &owner);
+  g_list_free (expired);
+
+  /* Armed again from the current tick */
+  rtmp2_timer_wheel_arm (&wheel, &owner.timer, 1);
+  expired = rtmp2_timer_wheel_advance (&wheel, 6);
+  fail_unless_equals_int (g_list_length (expired), 1);
+  g_list_free (expired);
+
+  rtmp2_timer_wheel_clear (&wheel);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_cancel)
+{
+  Rtmp2TimerWheel wheel;
+  Owner owners[2];
+  GList *expired;
+
+  rtmp2_timer_wheel_init (&wheel, expire_nothing);
+  init_owners (owners, 2);
+
+  /* Cancelling twice or a timer that was never armed is fine */
+  rtmp2_timer_wheel_cancel (&wheel, &owners[1].timer);
+
+  rtmp2_timer_wheel_arm (&wheel, &owners[0].timer, 1);
+  rtmp2_timer_wheel_arm (&wheel, &owners[1].timer, 1);
+  rtmp2_timer_wheel_cancel (&wheel, &owners[0].timer);
+  rtmp2_timer_wheel_cancel (&wheel, &owners[0].timer);
+  fail_if (rtmp2_timer_wheel_is_armed (&wheel, &owners[0].timer));
+
+  /* Arming with 0 only cancels */
+  rtmp2_timer_wheel_arm (&wheel, &owners[1].timer, 0);
+  fail_if (rtmp2_timer_wheel_is_armed (&wheel, &owners[1].timer));
+
+  expired = rtmp2_timer_wheel_advance (&wheel, 5);
+  fail_unless (expired == NULL);
+
+  rtmp2_timer_wheel_clear (&wheel);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_long_timeout)
+{
+  Rtmp2TimerWheel wheel;
+  Owner owners[2];
+  GList *expired;
+
+  rtmp2_timer_wheel_init (&wheel, expire_nothing);
+  init_owners (owners, 2);
+
+  /* Same slot, the longer one stays for two more rounds */
+  rtmp2_timer_wheel_arm (&wheel, &owners[0].timer, 10);
+  rtmp2_timer_wheel_arm (&wheel, &owners[1].timer,
+      10 + 2 * RTMP2_TIMER_WHEEL_SLOTS);
+
+  expired = rtmp2_timer_wheel_advance (&wheel, 10);
+  fail_unless_equals_int (g_list_length (expired), 1);
+  fail_unless (expired->data == &owners[0]);
+  g_list_free (expired);
+
+  fail_unless (rtmp2_timer_wheel_advance (&wheel,
+          9 + 2 * RTMP2_TIMER_WHEEL_SLOTS) == NULL);
+  fail_unless (rtmp2_timer_wheel_is_armed (&wheel, &owners[1].timer));
+
+  expired = rtmp2_timer_wheel_advance (&wheel,
+      10 + 2 * RTMP2_TIMER_WHEEL_SLOTS);
+  fail_unless_equals_int (g_list_length (expired), 1);
+  fail_unless (expired->data == &owners[1]);
+  g_list_free (expired);
+
+  rtmp2_timer_wheel_clear (&wheel);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_stop)
+{
+  GMainContext *context = g_main_context_new ();
+  Rtmp2TimerWheel wheel;
+  Owner owners[N_TIMERS];
+  guint i;
+
+  rtmp2_timer_wheel_init (&wheel, expire_nothing);
+  init_owners (owners, N_TIMERS);
+  rtmp2_timer_wheel_start (&wheel, context);
+
+  for (i = 0; i < N_TIMERS; i++)
+    rtmp2_timer_wheel_arm (&wheel, &owners[i].timer, i + 1);
+
+  /* Stopping disarms all timers and ignores new ones */
+  rtmp2_timer_wheel_stop (&wheel);
+  for (i = 0; i < N_TIMERS; i++)
+    fail_if (rtmp2_timer_wheel_is_armed (&wheel, &owners[i].timer));
+
+  rtmp2_timer_wheel_arm (&wheel, &owners[0].timer, 1);
+  fail_if (rtmp2_timer_wheel_is_armed (&wheel, &owners[0].timer));
+  rtmp2_timer_wheel_cancel (&wheel, &owners[0].timer);
+  fail_unless (wheel.source == NULL);
+
+  /* Started again from tick 0 */
+  rtmp2_timer_wheel_start (&wheel, context);
+  rtmp2_timer_wheel_arm (&wheel, &owners[0].timer, 1);
+  fail_unless (rtmp2_timer_wheel_is_armed (&wheel, &owners[0].timer));
+  rtmp2_timer_wheel_stop (&wheel);
+
+  rtmp2_timer_wheel_clear (&wheel);
+  g_main_context_unref (context);
+}
+
+GST_END_TEST;
+
+typedef struct
+{
+  Rtmp2TimerWheel wheel;
+  Owner owners[N_TIMERS];
+  gint done;
+} ThreadData;
+
+/* Cancels from another thread, like the streaming task does */
+static gpointer
+cancel_func (gpointer user_data)
+{
+  ThreadData *data = user_data;
+  guint i;
+
+  while (!g_atomic_int_get (&data->done)) {
+    for (i = 0; i < N_TIMERS; i += 2)
+      rtmp2_timer_wheel_cancel (&data->wheel, &data->owners[i].timer);
+  }
+
+  return NULL;
+}
+
+GST_START_TEST (test_cancel_threads)
+{
+  ThreadData data;
+  GThread *thread;
+  GList *expired;
+  guint64 tick;
+  guint i, n_expired = 0;
+
+  rtmp2_timer_wheel_init (&data.wheel, expire_nothing);
+  init_owners (data.owners, N_TIMERS);
+  data.done = FALSE;
+
+  thread = g_thread_new ("cancel", cancel_func, &data);
+  for (tick = 1; tick <= 10000; tick++) {
+    GList *l;
+
+    for (i = 0; i < N_TIMERS; i++)
+      rtmp2_timer_wheel_arm (&data.wheel, &data.owners[i].timer, i % 3 + 1);
+
+    expired = rtmp2_timer_wheel_advance (&data.wheel, tick);
+    for (l = expired; l; l = l->next) {
+      Owner *owner = l->data;
+
+      fail_unless (owner >= data.owners && owner < data.owners + N_TIMERS);
+      n_expired++;
+    }
+    g_list_free (expired);
+  }
+  g_atomic_int_set (&data.done, TRUE);
+  g_thread_join (thread);
+
+  /* The odd ones are never cancelled */
+  fail_unless (n_expired > 0);
+
+  /* The slots are consistent, what is left armed expires exactly once */
+  n_expired = 0;
+  for (i = 0; i < N_TIMERS; i++) {
+    if (rtmp2_timer_wheel_is_armed (&data.wheel, &data.owners[i].timer))
+      n_expired++;
+  }
+  expired = rtmp2_timer_wheel_advance (&data.wheel, tick + 3);
+  fail_unless_equals_int (g_list_length (expired), n_expired);
+  g_list_free (expired);
+  for (i = 0; i < N_TIMERS; i++)
+    fail_if (rtmp2_timer_wheel_is_armed (&data.wheel, &data.owners[i].timer));
+
+  rtmp2_timer_wheel_clear (&data.wheel);
+}
+
+GST_END_TEST;
+
+static Suite *
+rtmp2timerwheel_suite (void)
+{
+  Suite *s = suite_create ("rtmp2timerwheel");
+  TCase *tc_chain = tcase_create ("general");
+
+  suite_add_tcase (s, tc_chain);
+  tcase_add_test (tc_chain, test_expiry_order);
+  tcase_add_test (tc_chain, test_rearm);
+  tcase_add_test (tc_chain, test_cancel);
+  tcase_add_test (tc_chain, test_long_timeout);
+  tcase_add_test (tc_chain, test_stop);
+  tcase_add_test (tc_chain, test_cancel_threads);
+
+  return s;
+}
+
+GST_CHECK_MAIN (rtmp2timerwheel);